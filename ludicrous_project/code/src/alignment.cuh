@@ -2,11 +2,17 @@
  * \file
  * \brief   Set of functions used for the alignment part of the algorithm. Including:
  * 		   	* Warping
- * 		   	* Jacobian
+ * 		   	* Jacobian (forward and inverse compositional)
  * 		   	* Residuals & error
  * 		   	* Weights
  * 		   	* Matrix multiplications (non-cuBLAS)
  *
+ *          The per pixel kernels run over the points of the first frame, its
+ *          pixels to align (all of them, or a semi-dense selection, see
+ *          select_pixels_CUDA) with depth, back-projected once per frame (see
+ *          back_project_CUDA), with one thread per point. Their per pixel
+ *          arrays have one element per point.
+ *
  * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
  */
 
@@ -14,8 +20,8 @@
 
 #include <cuda_runtime.h>
 #include <stdio.h>  // for a single warning
-
-#define TDIST_DOF 5
+#include "weights.hpp"
+#include "preprocessing.cuh"  // d_central_differences
 
 //_____________________________________________
 //_____________________________________________
@@ -24,16 +30,19 @@
 //_____________________________________________
 
 /**
- * Image transformation function. Takes in the gray and depth values of the first
- * frame and calculates their positions and proyection in the second frame.
- * The transformation matrices RK_inv and K are not passed as arguments because
- * they are in constant memory.
+ * Image transformation function. Takes in the 3D points of the first frame and
+ * calculates their positions and proyection in the second frame.
+ * The rotation R, the translation and K are not passed as arguments because
+ * they are in constant memory. To be called with a 1D grid and 1D blocks.
  * @param x_prime  Output. Is the x coordinate of the 3D point in the second frame.
  * @param y_prime  Output. Is the y coordinate of the 3D point in the second frame.
  * @param z_prime  Output. Is the z coordinate of the 3D point in the second frame.
- * @param u_warped Output. Is the u coordinate of the point in the second camera frame. It is set to -1 for non valid points (bad depth value or out of bounds in the second camera frame).
- * @param v_warped Output. Is the v coordinate of the point in the second camera frame. It is set to -1 for non valid points (bad depth value or out of bounds in the second camera frame).
- * @param depthImg Input. Depth image in the first frame.
+ * @param u_warped Output. Is the u coordinate of the point in the second camera frame. It is set to -1 for non valid points (out of bounds in the second camera frame).
+ * @param v_warped Output. Is the v coordinate of the point in the second camera frame. It is set to -1 for non valid points (out of bounds in the second camera frame).
+ * @param X        Input. x coordinates of the points of the first frame, see back_project_CUDA.
+ * @param Y        Input. y coordinates of the points of the first frame.
+ * @param Z        Input. z coordinates of the points of the first frame.
+ * @param n        Number of points.
  * @param width    Current image height.
  * @param height   Current image height.
  * @param level    Current level in the pyramid.
@@ -43,42 +52,33 @@ __global__ void d_transform_points( float *x_prime,
                                     float *z_prime,
                                     float *u_warped,    //used as valid/non-valid mask too
                                     float *v_warped,    //used as valid/non-valid mask too
-                                    const float *depthImg,
+                                    const float *X,
+                                    const float *Y,
+                                    const float *Z,
+                                    const int n,
                                     const int width,
                                     const int height,
                                     const int level ) {
-        // Get the 2D-coordinate of the pixel of the current thread
-        const int   x = blockIdx.x * blockDim.x + threadIdx.x;
-        const int   y = blockIdx.y * blockDim.y + threadIdx.y;
-        const int pos = x + y * width;
+        // Get the entry of the current thread
+        const int   k = blockIdx.x * blockDim.x + threadIdx.x;
 
-        // If the 2D position is outside the image, do nothing
-        if ( (x >= width) || (y >= height) )
+        // If the entry is outside the list, do nothing
+        if ( k >= n )
                 return;
 
-        // if the depth value is not valid
-        if ( (depthImg[pos] == 0) ) {
-                u_warped[pos] = -1; // mark as not valid
-                v_warped[pos] = -1; // mark as not valid
-                return;
-        }
+        // 3D point, already unprojected: p = K_inv * (u*d, v*d, d)
+        float p[3] = { X[k], Y[k], Z[k] };
 
-        // get 3D point: p=(u*d, v*d, d) // u, v are the camera coordinates
-        float p[3] = { x * depthImg[pos],
-                       y * depthImg[pos],
-                           depthImg[pos] };
-
-        // unproject and transform: aux = RK_inv * p + t      // unproyect from camera: p = K_inv * p
-                                                              // transform: p = R * p + t
+        // transform: aux = R * p + t
         // matrices in constant memory are stored column-wise
         float aux[3];  // auxiliar variable
         for (int i = 0; i < 3; i++) {
                 aux[i] = const_translation[i]
-                         + p[0] * const_RK_inv[0 + i]
-                         + p[1] * const_RK_inv[3 + i]
-                         + p[2] * const_RK_inv[6 + i];
+                         + p[0] * const_R[0 + i]
+                         + p[1] * const_R[3 + i]
+                         + p[2] * const_R[6 + i];
         }
-        x_prime[pos] = aux[0];  y_prime[pos] = aux[1];  z_prime[pos] = aux[2];  // TODO: watch out if z_prime is 0. Looks unlikely...
+        x_prime[k] = aux[0];  y_prime[k] = aux[1];  z_prime[k] = aux[2];  // TODO: watch out if z_prime is 0. Looks unlikely...
 
         // proyect to camera: p = K * aux
         for (int i = 0; i < 3; i++) {
@@ -89,17 +89,17 @@ __global__ void d_transform_points( float *x_prime,
 
         // get 2D camera coordinates in second frame: u2 = x/z; v2 = y/z
         // store (x',y') position for each (x,y)
-        u_warped[pos] = p[0] / p[2];
-        v_warped[pos] = p[1] / p[2];
+        u_warped[k] = p[0] / p[2];
+        v_warped[k] = p[1] / p[2];
 
         // if (x', y') is out of bounds in the second frame (not interpolable)
-        if (    (u_warped[pos] < 0)
-             || (u_warped[pos] > width-1)
-             || (v_warped[pos] < 0)
-             || (v_warped[pos] > height-1) )
+        if (    (u_warped[k] < 0)
+             || (u_warped[k] > width-1)
+             || (v_warped[k] < 0)
+             || (v_warped[k] > height-1) )
         {
-                u_warped[pos] = -1; // mark as not valid
-                v_warped[pos] = -1; // mark as not valid
+                u_warped[k] = -1; // mark as not valid
+                v_warped[k] = -1; // mark as not valid
         }
 
         // const_K_pyr DEBUG
@@ -111,44 +111,77 @@ __global__ void d_transform_points( float *x_prime,
 
 /**
  * Calculates the jacobian matrix. Non valid pixels result in a whole row set to 0.
- * @param J        Output. Jacobian stored as a single array component-wise/column-wise (this is: the componets for each pixel are width*height positions apart).
+ * @param J        Output. Jacobian stored as a single array component-wise/column-wise (this is: the componets for each pixel are n positions apart).
  * @param x_prime  Input. Is the x coordinate of the 3D point in the second frame.
  * @param y_prime  Input. Is the y coordinate of the 3D point in the second frame.
  * @param z_prime  Input. Is the z coordinate of the 3D point in the second frame.
- * @param u_warped Input. Is the u coordinate of the point in the second camera frame. Used to get the interpolation coordinates for the derivatives. It is -1 for non valid points (bad depth value or out of bounds in the second camera frame).
- * @param v_warped Input. Is the v coordinate of the point in the second camera frame. Used to get the interpolation coordinates for the derivatives. It is -1 for non valid points (bad depth value or out of bounds in the second camera frame).
- * @param width    Current image height.
+ * @param u_warped Input. Is the u coordinate of the point in the second camera frame. Used to get the interpolation coordinates for the derivatives. It is -1 for non valid points (out of bounds in the second camera frame).
+ * @param v_warped Input. Is the v coordinate of the point in the second camera frame. Used to get the interpolation coordinates for the derivatives. It is -1 for non valid points (out of bounds in the second camera frame).
+ * @param grayPrev Input. Gray image of the first frame. Only read if esm, without derivatives.
+ * @param gray_dx  Input. Horizontal derivatives of the first frame. Only read if esm. NULL to compute them from grayPrev, see d_central_differences.
+ * @param gray_dy  Input. Vertical derivatives of the first frame. Only read if esm.
+ * @param pixels   Input. Pixel of every point, n entries. Only read if esm.
+ * @param n        Number of points.
+ * @param width    Current image width.
  * @param height   Current image height.
  * @param level    Current level in the pyramid.
+ * @param esm      Use the mean of the gradients of both frames (efficient second-order minimization).
+ *
+ * With GRADIENTS_ON_THE_FLY the gradients of the second frame are not stored
+ * in textures of their own: they are the central differences of two lookups
+ * of the gray texture one pixel apart, which is the interpolation of the
+ * central differences at the corners. Only the lookups within half a pixel
+ * of the border differ: their corners outside the image get a 0 derivative
+ * instead of the one of the border.
  */
+template<bool esm>
 __global__ void d_calculate_jacobian( float *J,
                                     const float *x_prime,
                                     const float *y_prime,
                                     const float *z_prime,
                                     const float *u_warped,   // This is -1 for non-valid points
                                     const float *v_warped,   // This is -1 for non-valid points
+                                    const float *grayPrev,
+                                    const float *gray_dx,
+                                    const float *gray_dy,
+                                    const int *pixels,
+                                    const int n,
                                     const int width,
                                     const int height,
                                     const int level ) {
-        // Get the 2D-coordinate of the pixel of the current thread
-        const int   x = blockIdx.x * blockDim.x + threadIdx.x;
-        const int   y = blockIdx.y * blockDim.y + threadIdx.y;
-        const int pos = x + y * width;
+        // Get the entry of the current thread
+        const int   k = blockIdx.x * blockDim.x + threadIdx.x;
 
-        // If the 2D position is outside the first image do nothing
-        if ( (x >= width) || (y >= height) )
+        // If the entry is outside the list do nothing
+        if ( k >= n )
                 return;
         // if the projection is outside the second frame gray values, set residual to 0
-        if ( u_warped[pos] < 0 ) {
+        if ( u_warped[k] < 0 ) {
                 for (int i = 0; i < 6; i++)
-                    J[pos + i*width*height] = 0.0f;
+                    J[k + i*n] = 0.0f;
                 return;
         }
 
         // dxfx is the image gradient in x direction times the fx of the intrinsic camera calibration
         float dxfx, dyfy;   // factors common to all jacobian positions
-        dxfx = tex2D( texRef_gray_dx, u_warped[pos], v_warped[pos] ) * const_K_pyr[0 + 9*level];
-        dyfy = tex2D( texRef_gray_dy, u_warped[pos], v_warped[pos] ) * const_K_pyr[4 + 9*level];
+        const float u = u_warped[k], v = v_warped[k];
+#ifdef GRADIENTS_ON_THE_FLY
+        dxfx = ( tex2D( texRef_grayImg, u + 1, v ) - tex2D( texRef_grayImg, u - 1, v ) )*0.5f;
+        dyfy = ( tex2D( texRef_grayImg, u, v + 1 ) - tex2D( texRef_grayImg, u, v - 1 ) )*0.5f;
+#else
+        dxfx = tex2D( texRef_gray_dx, u, v );
+        dyfy = tex2D( texRef_gray_dy, u, v );
+#endif
+        if (esm) {
+                const int pos = pixels[k];
+                float dx_ref, dy_ref;
+                if (gray_dx) { dx_ref = gray_dx[pos]; dy_ref = gray_dy[pos]; }
+                else d_central_differences( grayPrev, pos % width, pos / width, width, height, dx_ref, dy_ref );
+                dxfx = 0.5f * ( dxfx + dx_ref );
+                dyfy = 0.5f * ( dyfy + dy_ref );
+        }
+        dxfx *= const_K_pyr[0 + 9*level];
+        dyfy *= const_K_pyr[4 + 9*level];
         // // DEBUG
         // if (dxfx != dxfx)
         //              printf ("dxfx: pix %d intrp %f x %d y %d u %f v %f w %d h %d l %d \n", pos, tex2D( texRef_gray_dx, u_warped[pos], v_warped[pos] ), x, y, u_warped[pos], v_warped[pos], width, height, level );
@@ -160,22 +193,22 @@ __global__ void d_calculate_jacobian( float *J,
         //              printf ("%d %f %d %d %f %f %d %d %d \n", pos, tex2D( texRef_gray_dy, u_warped[pos], v_warped[pos] ), x, y, u_warped[pos], v_warped[pos], width, height, level );
 
         float xp, yp, zp;   // for easyness of reading and debugging
-        xp = x_prime[pos]; yp = y_prime[pos]; zp = z_prime[pos];
+        xp = x_prime[k]; yp = y_prime[k]; zp = z_prime[k];
 
         if (zp == 0) printf("WARNING! DIVIDE BY zp ZERO in d_calculate_jacobian!!!"); // TODO
 
-        J[pos + 0*width*height] = - dxfx / zp;
-        J[pos + 1*width*height] = - dyfy / zp;
-        J[pos + 2*width*height] = + ( dxfx*xp + dyfy*yp )
-                                    / ( zp * zp );
-        J[pos + 3*width*height] = + ( dxfx*xp*yp + dyfy*yp*yp )
-                                    / ( zp * zp )
-                                  + dyfy;
-        J[pos + 4*width*height] = - ( dyfy*xp*yp + dxfx*xp*xp )
-                                    / ( zp * zp )
-                                  - dxfx;
-        J[pos + 5*width*height] = + dxfx*yp / zp
-                                  - dyfy*xp / zp;
+        J[k + 0*n] = - dxfx / zp;
+        J[k + 1*n] = - dyfy / zp;
+        J[k + 2*n] = + ( dxfx*xp + dyfy*yp )
+                       / ( zp * zp );
+        J[k + 3*n] = + ( dxfx*xp*yp + dyfy*yp*yp )
+                       / ( zp * zp )
+                     + dyfy;
+        J[k + 4*n] = - ( dyfy*xp*yp + dxfx*xp*xp )
+                       / ( zp * zp )
+                     - dxfx;
+        J[k + 5*n] = + dxfx*yp / zp
+                     - dyfy*xp / zp;
 
         // // DEBUG // mostly big numbers??? // sometimes dxfx *or* dyfy are wrong. Not both.
         // for (int i = 0; i < 6; i++) {
@@ -185,39 +218,158 @@ __global__ void d_calculate_jacobian( float *J,
 
 }
 
+/**
+ * Calculates the Jacobian of the inverse compositional mode, once per level.
+ * The increment is applied to the first (reference) frame, so the Jacobian
+ * only depends on its gradients and 3D points, and not on the current pose.
+ * The sign is flipped with respect to d_calculate_jacobian because the warped
+ * reference image is the one subtracted in the residual. Also stores the
+ * upper triangle of J'*J of every pixel (row after row), so that A = J'*W*J
+ * is a product of H' and the weights.
+ * @param J        Output. Jacobian stored component-wise, like in d_calculate_jacobian.
+ * @param H        Output. 21 components of J'*J stored component-wise.
+ * @param X        Input. x coordinates of the points of the first frame, see back_project_CUDA.
+ * @param Y        Input. y coordinates of the points of the first frame.
+ * @param Z        Input. z coordinates of the points of the first frame.
+ * @param gray     Input. Gray image of the first frame. Only read without derivatives.
+ * @param gray_dx  Input. Horizontal derivatives of the first frame. NULL to compute them from gray, see d_central_differences.
+ * @param gray_dy  Input. Vertical derivatives of the first frame.
+ * @param pixels   Input. Pixel of every point, n entries.
+ * @param n        Number of points.
+ * @param width    Current image width.
+ * @param height   Current image height.
+ * @param level    Current level in the pyramid.
+ */
+__global__ void d_calculate_reference_jacobian( float *J,
+                                                float *H,
+                                                const float *X,
+                                                const float *Y,
+                                                const float *Z,
+                                                const float *gray,
+                                                const float *gray_dx,
+                                                const float *gray_dy,
+                                                const int *pixels,
+                                                const int n,
+                                                const int width,
+                                                const int height,
+                                                const int level ) {
+        // Get the entry of the current thread and its pixel
+        const int   k = blockIdx.x * blockDim.x + threadIdx.x;
+
+        // If the entry is outside the list do nothing
+        if ( k >= n )
+                return;
+
+        const int pos = pixels[k];
+
+        // K is stored column-wise
+        const float *K = &const_K_pyr[9*level];
+        float xp = X[k];
+        float yp = Y[k];
+        float zp = Z[k];
+
+        float dx, dy;
+        if (gray_dx) { dx = gray_dx[pos]; dy = gray_dy[pos]; }
+        else d_central_differences( gray, pos % width, pos / width, width, height, dx, dy );
+        float dxfx = - dx * K[0];
+        float dyfy = - dy * K[4];
+
+        float Jp[6];
+        Jp[0] = - dxfx / zp;
+        Jp[1] = - dyfy / zp;
+        Jp[2] = + ( dxfx*xp + dyfy*yp )
+                  / ( zp * zp );
+        Jp[3] = + ( dxfx*xp*yp + dyfy*yp*yp )
+                  / ( zp * zp )
+                + dyfy;
+        Jp[4] = - ( dyfy*xp*yp + dxfx*xp*xp )
+                  / ( zp * zp )
+                - dxfx;
+        Jp[5] = + dxfx*yp / zp
+                - dyfy*xp / zp;
+
+        int c = 0;
+        for (int row = 0; row < 6; row++) {
+                J[k + row*n] = Jp[row];
+                for (int col = row; col < 6; col++)
+                        H[k + (c++)*n] = Jp[row] * Jp[col];
+        }
+}
+
+/**
+ * Adds up val over all the threads of a block of g_CUDA_blockSize2DX *
+ * g_CUDA_blockSize2DY threads, and adds the block sum to *sum with a single
+ * atomic operation. All the threads of the block have to call it.
+ */
+__device__ void d_block_sum_atomic( float val, float *sum ) {
+        __shared__ float s_sum[g_CUDA_blockSize2DX * g_CUDA_blockSize2DY];
+        const int tid = threadIdx.x + threadIdx.y * blockDim.x;
+        s_sum[tid] = val;
+        __syncthreads();
+        for (int offset = blockDim.x * blockDim.y / 2; offset > 0; offset /= 2) {
+                if (tid < offset) s_sum[tid] += s_sum[tid + offset];
+                __syncthreads();
+        }
+        if (tid == 0) atomicAdd( sum, s_sum[0] );
+}
+
 /**
  * Calculates the residuals array. Non valid pixels get a 0 residual.
  * The gray image of the second frame is accessed through texture memory for interpolation.
+ * With histogram set, the absolute residuals of the valid pixels are also
+ * counted into hist (see tdist_histogram_bin), first per block in shared
+ * memory and then added to the global counts.
+ * The error (sum of the squared residuals) is added up in the same pass, so
+ * no reduction over r is needed afterwards.
  * @param r        Output. Array with all the residuals.
+ * @param error    Output. Sum of the squared residuals, to be set to 0 beforehand.
+ * @param hist     Output. TDIST_HIST_BINS counts, to be set to 0 beforehand. Only used if histogram.
  * @param grayPrev Input. Gray image of the first frame.
- * @param u_warped Input. Is the u coordinate of the point in the second camera frame. Used to get the interpolation coordinates for the derivatives. It is -1 for non valid points (bad depth value or out of bounds in the second camera frame).
- * @param v_warped Input. Is the v coordinate of the point in the second camera frame. Used to get the interpolation coordinates for the derivatives. It is -1 for non valid points (bad depth value or out of bounds in the second camera frame).
- * @param width    Current image height.
- * @param height   Current image height.
+ * @param u_warped Input. Is the u coordinate of the point in the second camera frame. Used to get the interpolation coordinates for the derivatives. It is -1 for non valid points (out of bounds in the second camera frame).
+ * @param v_warped Input. Is the v coordinate of the point in the second camera frame. Used to get the interpolation coordinates for the derivatives. It is -1 for non valid points (out of bounds in the second camera frame).
+ * @param pixels   Input. Pixel of every point, n entries.
+ * @param n        Number of points.
  * @param level    Current level in the pyramid.
  */
+template<bool histogram>
 __global__ void d_calculate_residuals( float *r,
+                                    float *error,
+                                    unsigned int *hist,
                                     const float *grayPrev,
                                     const float *u_warped,   // This is -1 for non-valid points
                                     const float *v_warped,   // This is -1 for non-valid points
-                                    const int width,
-                                    const int height,
+                                    const int *pixels,
+                                    const int n,
                                     const int level ) {
-        // Get the 2D-coordinate of the pixel of the current thread
-        const int   x = blockIdx.x * blockDim.x + threadIdx.x;
-        const int   y = blockIdx.y * blockDim.y + threadIdx.y;
-        const int pos = x + y * width;
+        __shared__ unsigned int s_hist[histogram ? TDIST_HIST_BINS : 1];
 
-        // If the 2D position is outside the first image do nothing
-        if ( (x >= width) || (y >= height) )
-                return;
+        // Get the entry of the current thread
+        const int   k = blockIdx.x * blockDim.x + threadIdx.x;
+        const int tid = threadIdx.x;
+        const int threads = blockDim.x;
+
+        if (histogram) {
+                for (int bin = tid; bin < TDIST_HIST_BINS; bin += threads) s_hist[bin] = 0;
+                __syncthreads();
+        }
+
+        // If the entry is outside the list do nothing
         // if the projection is outside the second frame gray values, set residual to 0
-        if ( u_warped[pos] < 0 ) {
-                r[pos] = 0.0f;
-                return;
+        float res = 0.0f;
+        if ( k < n ) {
+                if ( u_warped[k] >= 0 ) {
+                        res = grayPrev[pixels[k]] - tex2D( texRef_grayImg, u_warped[k], v_warped[k] );
+                        if (histogram) atomicAdd( &s_hist[tdist_histogram_bin(res)], 1 );
+                }
+                r[k] = res;
         }
+        d_block_sum_atomic( res * res, error );
 
-        r[pos] = grayPrev[pos] - tex2D( texRef_grayImg, u_warped[pos], v_warped[pos] );
+        if (histogram) {
+                __syncthreads();
+                for (int bin = tid; bin < TDIST_HIST_BINS; bin += threads)
+                        if (s_hist[bin] > 0) atomicAdd( &hist[bin], s_hist[bin] );
+        }
 }
 
 //_____________________________________________
@@ -227,65 +379,36 @@ __global__ void d_calculate_residuals( float *r,
 //_____________________________________________
 
 /**
- * Set an array of size width*height to ones.
- * @param W      Output. Array of size width*height to fill with ones.
- * @param width    Current image height.
- * @param height   Current image height.
- */
-__global__ void d_set_uniform_weights( float *W,
-                                      const int width,
-                                      const int height ) {
-        // Get the 2D-coordinate of the pixel of the current thread
-        const int   x = blockIdx.x * blockDim.x + threadIdx.x;
-        const int   y = blockIdx.y * blockDim.y + threadIdx.y;
-        const int pos = x + y * width;
-
-        // If the 2D position is outside the first image or the projection outside the second, do nothing
-        if ( (x >= width) || (y >= height) )
-                return;
-
-        W[pos] = 1.0f;
-}
-
-/**
- * Execute one step in the iteration to calculate the T-Distribution variance.
- * The number of degrees of freedom of the T-Distribution is set by the global
- * variable TDIST_DOF.
- * After this step a reduction is needed in order to sum up and average the values in aux.
- * @param aux       Output. Squared residuals multiplied by a factor. It is a step in the iteration to calculate a T-Distribution variance.
+ * Calculate the weight of every residual with the weight function of the
+ * Weights policy (see weights.hpp). Not needed for uniform weights, which
+ * are never read. Non valid pixels get a 0 weight, which matters for the
+ * inverse compositional mode, where their Jacobian rows are not 0.
+ * Also adds up the weighted error, sum of W * r^2, for the convergence test.
+ * @param weights   Output. Weights array.
+ * @param error_weighted Output. Sum of the weighted squared residuals, to be set to 0 beforehand.
  * @param residuals Input. Residuals array.
- * @param width     Current level image width.
- * @param height    Current level image height.
- * @param variance  Input. T-Distribution variance in the previous iterative step.
+ * @param u_warped  Input. It is -1 for non valid points.
+ * @param n         Number of points.
+ * @param variance  Input. Variance of the residuals, if the policy uses it.
  */
-__global__ void d_calculate_tdist_variance(float *aux,
-                                      const float *residuals,
-                                      const int width,
-                                      const int height,
-                                      float variance) {
-        int x = threadIdx.x + blockIdx.x * blockDim.x;
-        int y = threadIdx.y + blockIdx.y * blockDim.y;
-
-        if (x < width && y < height) {
-                float r_data_squared = residuals[x + y*width] * residuals[x + y*width];
-                //TDIST_DOF is degrees of freedom and is set to 5 as a compiler variable
-                aux[x + y*width] = r_data_squared * ( (TDIST_DOF + 1.0f) / (TDIST_DOF + (r_data_squared) / (variance) ) );
-        }
-}
-
-__global__ void d_calculate_tdist_weights( float *weights,
+template<class Weights>
+__global__ void d_calculate_weights( float *weights,
+                                     float *error_weighted,
                                      const float *residuals,
-                                     const int width,
-                                     const int height,
+                                     const float *u_warped,
+                                     const int n,
                                      float variance) {
-       int x = threadIdx.x + blockIdx.x * blockDim.x;
-       int y = threadIdx.y + blockIdx.y * blockDim.y;
-
-       if (x < width && y < height) {
-               float r_data_squared = residuals[x + y*width] * residuals[x + y*width];
-               //TDIST_DOF is degrees of freedom and is set to 5 at the very top
-               weights[x + y*width] = ( (TDIST_DOF + 1.0f) / (TDIST_DOF + (r_data_squared) / (variance) ) );
+       int k = threadIdx.x + blockIdx.x * blockDim.x;
+
+       float wr2 = 0.0f;
+       if (k < n) {
+               float r = residuals[k];
+               float w = u_warped[k] < 0 ? 0.0f
+                         : Weights::weight(r, variance);
+               weights[k] = w;
+               wr2 = w * r * r;
        }
+       d_block_sum_atomic( wr2, error_weighted );
 }
 
 //_____________________________________________
@@ -419,9 +542,10 @@ __global__ void d_calculate_jtw( float *JTW,
  * of the resulting A matrix.
  * @param *pre_A        output for storing this pre-computation
  * @param *J            input Jacobian, component-wise stretched to 1D
- * @param *W            input weights matrix, corresponding to each pixel of the images
+ * @param *W            input weights matrix, corresponding to each pixel of the images. Not read if !weighted
  * @param level_size    number of pixels in the image
  */
+template<bool weighted>
 __global__ void d_product_JacT_W_Jac(   float *pre_A,
                                         const float *J,
                                         const float *W,
@@ -438,7 +562,10 @@ __global__ void d_product_JacT_W_Jac(   float *pre_A,
 
         // load input into __shared__ memory
         if ( idxW < level_size ) {  // check if W is out of bounds and simultaneously check correct index of idxJac and idxJacT (these can wrap around rows)
-                sdata[tx] = J[idxJacT] * W[idxW] * J[idxJac];   // J.T * W * J
+                if (weighted)
+                        sdata[tx] = J[idxJacT] * W[idxW] * J[idxJac];   // J.T * W * J
+                else
+                        sdata[tx] = J[idxJacT] * J[idxJac];   // J.T * J
                 __syncthreads();
         } else {
                 sdata[tx] = 0;
@@ -525,10 +652,11 @@ __global__ void d_reduce_pre_M_towards_M(   float *pre_M_reduced,
  * for the sake of understandability.
  * @param *pre_b        output for storing this pre-computation
  * @param *J            input Jacobian, component-wise stretched to 1D
- * @param *W            input weights matrix, corresponding to each pixel of the images
+ * @param *W            input weights matrix, corresponding to each pixel of the images. Not read if !weighted
  * @param *res          input residual array
  * @param level_size    number of pixels in the image
  */
+template<bool weighted>
 __global__ void d_product_JacT_W_res(   float *pre_b,
                                         const float *J,
                                         const float *W,
@@ -544,7 +672,10 @@ __global__ void d_product_JacT_W_res(   float *pre_b,
 
         // load input into __shared__ memory
         if ( idx < level_size ) {  // check if W is out of bounds and simultaneously check correct index of idxJac and idxJacT (these can wrap around rows)
-                sdata[tx] = J[idxJac] * W[idx] * res[idx];   // J.T * W * res
+                if (weighted)
+                        sdata[tx] = J[idxJac] * W[idx] * res[idx];   // J.T * W * res
+                else
+                        sdata[tx] = J[idxJac] * res[idx];   // J.T * res
                 __syncthreads();
         } else {
                 sdata[tx] = 0;
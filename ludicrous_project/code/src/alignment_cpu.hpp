@@ -0,0 +1,839 @@
+/**
+ * \file
+ * \brief   Host counterpart of alignment.cuh, used by the CPU backend. Including:
+ * 		   	* Texture fetch emulation, on separate planes or on interleaved texels,
+ * 		   	  in float or half precision, and derivatives computed
+ * 		   	  at the lookup from the gray plane, also in integer
+ * 		   	  arithmetic on a fixed point plane
+ * 		   	* Fused warping, residual, weight, Jacobian and normal equations
+ * 		   	* Reference Jacobian of the inverse compositional mode
+ *
+ *          Unlike the CUDA version, which runs one kernel per stage and keeps
+ *          every intermediate result in a per-pixel array, the CPU version does
+ *          all stages for a pixel at once and only keeps the running sums of
+ *          A = J'*W*J, b = J'*W*r and the error. A pixel is read once per
+ *          iteration and nothing is written back to memory.
+ *
+ *          The matrices that live in constant memory on the GPU (R,
+ *          translation and K of the current level) are passed as column-wise
+ *          float arrays instead. The pixel loop is parallelized over fixed
+ *          blocks of pixels with OpenMP, and the sums do not depend on the
+ *          number of threads.
+ *
+ *          Compiled once per instruction set, see isa.hpp.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#ifndef ALIGNMENT_CPU_HPP
+#define ALIGNMENT_CPU_HPP
+
+#include <cmath>
+#include <algorithm>
+#include "weights.hpp"
+#include "preprocessing_cpu.hpp"
+#include "half.hpp"
+#include "isa.hpp"
+
+#ifdef __SSE2__
+        #include <emmintrin.h>
+#endif
+
+namespace CPU_ISA_NAMESPACE {
+
+//_____________________________________________
+//_____________________________________________
+//________TEXTURE EMULATION
+//_____________________________________________
+//_____________________________________________
+
+/**
+ * Corners and weights of a bilinear lookup, as computed by the texture unit
+ * for cudaFilterModeLinear, unnormalized coordinates and cudaAddressModeClamp.
+ * Computed once per lookup position, and shared by every image (or channel)
+ * sampled there.
+ */
+struct Bilinear {
+        int p00, p10, p01, p11;         // pixel index of the corners, (x, y)
+        float w00, w10, w01, w11;       // weights of the corners
+        int ax, ay;                     // horizontal and vertical fractions in FIXED_WEIGHT_BITS fixed point
+        int x0, y0;                     // top left corner
+};
+
+// Fractional bits of the fixed point bilinear weights, as in the texture unit
+#define FIXED_WEIGHT_BITS 8
+
+/**
+ * Bilinear lookup at the texture coordinates (u, v). Texel centers are at
+ * +0.5, so sampling with it returns the same values as the texture unit does
+ * in alignment.cuh (up to the 8 bit fixed point weights of the hardware).
+ * The corners are not clamped: for (u, v) inside the image (see h_warp) they
+ * are at most 1 pixel outside of it, in the guard band, which replicates the
+ * border like clamp addressing does (see image.hpp).
+ * @param width  Image width.
+ * @param height Image height.
+ * @param u      Horizontal texture coordinate.
+ * @param v      Vertical texture coordinate.
+ * @param tiled  Layout of the sampled texels, see texel_index. Planes are always row-major.
+ */
+inline Bilinear h_bilinear( const int width,
+                            const int height,
+                            float u,
+                            float v,
+                            const bool tiled = false ) {
+        float xb = u - 0.5f;
+        float yb = v - 0.5f;
+        float fx = floorf(xb);
+        float fy = floorf(yb);
+        float a = xb - fx;
+        float b = yb - fy;
+        const int x0 = (int)fx;
+        const int y0 = (int)fy;
+        const int x1 = x0 + 1;
+        const int y1 = y0 + 1;
+
+        Bilinear bl;
+        bl.p00 = texel_index(x0, y0, width, tiled);  bl.w00 = (1.0f - a) * (1.0f - b);
+        bl.p10 = texel_index(x1, y0, width, tiled);  bl.w10 =       a  * (1.0f - b);
+        bl.p01 = texel_index(x0, y1, width, tiled);  bl.w01 = (1.0f - a) *        b;
+        bl.p11 = texel_index(x1, y1, width, tiled);  bl.w11 =       a  *        b;
+        bl.ax = (int)(a * (1 << FIXED_WEIGHT_BITS) + 0.5f);
+        bl.ay = (int)(b * (1 << FIXED_WEIGHT_BITS) + 0.5f);
+        bl.x0 = x0;
+        bl.y0 = y0;
+        return bl;
+}
+
+/**
+ * Samples an image (a plane of floats) at a bilinear lookup.
+ */
+inline float h_sample( const float *img,
+                       const Bilinear &bl ) {
+        return bl.w00 * img[bl.p00]
+             + bl.w10 * img[bl.p10]
+             + bl.w01 * img[bl.p01]
+             + bl.w11 * img[bl.p11];
+}
+
+/**
+ * Samples the gray value and both derivatives of an interleaved image
+ * (TEXEL_SIZE floats {I, Ix, Iy, pad} per pixel, see image_derivatives_CPU) at a bilinear
+ * lookup. Reads one texel per corner instead of one value of each of the
+ * three planes.
+ */
+inline void h_sample_texels( const float *texels,
+                             const Bilinear &bl,
+                             float &I,
+                             float &Ix,
+                             float &Iy ) {
+        const float *t00 = &texels[TEXEL_SIZE * bl.p00];
+        const float *t10 = &texels[TEXEL_SIZE * bl.p10];
+        const float *t01 = &texels[TEXEL_SIZE * bl.p01];
+        const float *t11 = &texels[TEXEL_SIZE * bl.p11];
+        I  = bl.w00 * t00[0] + bl.w10 * t10[0] + bl.w01 * t01[0] + bl.w11 * t11[0];
+        Ix = bl.w00 * t00[1] + bl.w10 * t10[1] + bl.w01 * t01[1] + bl.w11 * t11[1];
+        Iy = bl.w00 * t00[2] + bl.w10 * t10[2] + bl.w01 * t01[2] + bl.w11 * t11[2];
+}
+
+/**
+ * Samples a half precision image at a bilinear lookup. Same result as
+ * h_sample on the image converted back to float.
+ */
+inline float h_sample( const half_t *img,
+                       const Bilinear &bl ) {
+        return bl.w00 * h_half_to_float(img[bl.p00])
+             + bl.w10 * h_half_to_float(img[bl.p10])
+             + bl.w01 * h_half_to_float(img[bl.p01])
+             + bl.w11 * h_half_to_float(img[bl.p11]);
+}
+
+inline float h_texel_to_float( const float t ) { return t; }
+inline float h_texel_to_float( const half_t t ) { return h_half_to_float(t); }
+
+/**
+ * Samples a gray plane (float or half precision, row-major) and the
+ * derivatives it would have, computed at the four corners with the formula of
+ * central_differences instead of being read from their own planes. The
+ * corners are clamped to the image for the derivatives, so that the corners
+ * in the guard band get the derivatives of the border, like the replicated
+ * derivative planes. Same result as h_sample on the gray plane and its
+ * derivative planes up to rounding, for 12 reads of one plane instead of 4
+ * of three.
+ * @param width  Image width.
+ * @param height Image height.
+ */
+template<typename T>
+inline void h_sample_gradients( const T *img,
+                                const Bilinear &bl,
+                                const int width,
+                                const int height,
+                                float &I,
+                                float &dx,
+                                float &dy ) {
+        const int pitch = image_pitch(width);
+        const int x0 = std::max(bl.x0, 0), x1 = std::min(bl.x0 + 1, width - 1);
+        const int y0 = std::max(bl.y0, 0), y1 = std::min(bl.y0 + 1, height - 1);
+        const int p[4] = { x0 + y0 * pitch, x1 + y0 * pitch, x0 + y1 * pitch, x1 + y1 * pitch };
+        const float w[4] = { bl.w00, bl.w10, bl.w01, bl.w11 };
+        I = dx = dy = 0.0f;
+        for (int c = 0; c < 4; c++) {
+                I  += w[c] * h_texel_to_float( img[p[c]] );
+                dx += w[c] * ( ( h_texel_to_float( img[p[c] + 1] )     - h_texel_to_float( img[p[c] - 1] ) )*0.5f );
+                dy += w[c] * ( ( h_texel_to_float( img[p[c] + pitch] ) - h_texel_to_float( img[p[c] - pitch] ) )*0.5f );
+        }
+}
+
+/**
+ * Samples half precision texels (see interleave_half_CPU) at a bilinear
+ * lookup. A texel is 8 bytes; with F16C each corner is converted to float
+ * with a single instruction and the three channels are blended at once.
+ */
+inline void h_sample_texels( const half_t *texels,
+                             const Bilinear &bl,
+                             float &I,
+                             float &Ix,
+                             float &Iy ) {
+#if CPU_HAS_F16C
+        __m128 t00 = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)&texels[TEXEL_SIZE * bl.p00]));
+        __m128 t10 = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)&texels[TEXEL_SIZE * bl.p10]));
+        __m128 t01 = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)&texels[TEXEL_SIZE * bl.p01]));
+        __m128 t11 = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)&texels[TEXEL_SIZE * bl.p11]));
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(bl.w00), t00),
+                                                      _mm_mul_ps(_mm_set1_ps(bl.w10), t10)),
+                                           _mm_mul_ps(_mm_set1_ps(bl.w01), t01)),
+                                _mm_mul_ps(_mm_set1_ps(bl.w11), t11));
+        float out[4];
+        _mm_storeu_ps(out, sum);
+        I = out[0];
+        Ix = out[1];
+        Iy = out[2];
+#else
+        const half_t *t00 = &texels[TEXEL_SIZE * bl.p00];
+        const half_t *t10 = &texels[TEXEL_SIZE * bl.p10];
+        const half_t *t01 = &texels[TEXEL_SIZE * bl.p01];
+        const half_t *t11 = &texels[TEXEL_SIZE * bl.p11];
+        float c[3];
+        for (int i = 0; i < 3; i++)
+                c[i] = bl.w00 * h_half_to_float(t00[i]) + bl.w10 * h_half_to_float(t10[i])
+                     + bl.w01 * h_half_to_float(t01[i]) + bl.w11 * h_half_to_float(t11[i]);
+        I = c[0];
+        Ix = c[1];
+        Iy = c[2];
+#endif
+}
+
+/**
+ * Samples a fixed point gray plane (row-major, see FIXED_SHIFT) at a bilinear
+ * lookup in integer arithmetic, with the weights bl.ax and bl.ay, and its
+ * derivatives if gradients is set, computed at the corners with the formula
+ * of central_differences like h_sample_gradients. The columns x0 - 1 to
+ * x0 + 2 are interpolated vertically, gray and vertical differences at once,
+ * and rounded back to the fixed point of the plane; then gray, horizontal
+ * differences and vertical differences horizontally, also at once. That is a
+ * pmaddwd per direction, and the results are only converted to float at the
+ * end, as the residual and the gradients of the Jacobian. The scalar version
+ * gives the same result bit by bit.
+ * Unlike h_sample_gradients the derivatives of the corners in the guard band
+ * are not clamped to the border: they are those of the replicated pixels,
+ * which only differ within a pixel of the border.
+ * @param width  Image width.
+ */
+inline void h_sample_fixed( const uint16_t *img,
+                            const Bilinear &bl,
+                            const int width,
+                            const bool gradients,
+                            float &I,
+                            float &dx,
+                            float &dy ) {
+        const int one = 1 << FIXED_WEIGHT_BITS;
+        const int pitch = image_pitch(width);
+        const uint16_t *p = &img[bl.x0 + bl.y0 * pitch];
+        // horizontal and vertical passes scale by one, differences by 2 more
+        const float scale_I = 1.0f / (FIXED_SCALE * one);
+        const float scale_d = 0.5f * scale_I;
+#ifdef __SSE2__
+        const __m128i round = _mm_set1_epi32(one / 2);
+        const __m128i wx = _mm_set1_epi32( (bl.ax << 16) | (one - bl.ax) );
+        const __m128i wy = _mm_set1_epi32( (bl.ay << 16) | (one - bl.ay) );
+        if (!gradients) {
+                // {top, bottom} pairs of the two columns, then {left, right}
+                int32_t top, bottom;
+                memcpy(&top, p, sizeof(top));
+                memcpy(&bottom, p + pitch, sizeof(bottom));
+                __m128i cols = _mm_unpacklo_epi16( _mm_cvtsi32_si128(top), _mm_cvtsi32_si128(bottom) );
+                cols = _mm_srai_epi32( _mm_add_epi32(_mm_madd_epi16(cols, wy), round), FIXED_WEIGHT_BITS );
+                I = _mm_cvtsi128_si32( _mm_madd_epi16(_mm_packs_epi32(cols, cols), wx) ) * scale_I;
+                return;
+        }
+        // pixels x0 - 1 to x0 + 2 of the rows y0 - 1 to y0 + 2
+        const __m128i r0 = _mm_loadl_epi64( (const __m128i *)(p - pitch - 1) );
+        const __m128i r1 = _mm_loadl_epi64( (const __m128i *)(p - 1) );
+        const __m128i r2 = _mm_loadl_epi64( (const __m128i *)(p + pitch - 1) );
+        const __m128i r3 = _mm_loadl_epi64( (const __m128i *)(p + 2*pitch - 1) );
+        // vertical: {top, bottom} pairs of the 4 columns, of gray and of the vertical differences
+        __m128i cols = _mm_madd_epi16( _mm_unpacklo_epi16(r1, r2), wy );
+        __m128i cols_dy = _mm_madd_epi16( _mm_unpacklo_epi16(_mm_sub_epi16(r2, r0), _mm_sub_epi16(r3, r1)), wy );
+        cols = _mm_packs_epi32( _mm_srai_epi32(_mm_add_epi32(cols, round), FIXED_WEIGHT_BITS),
+                                _mm_srai_epi32(_mm_add_epi32(cols_dy, round), FIXED_WEIGHT_BITS) );
+        // horizontal: {left, right} pairs of gray, of the horizontal differences and of the vertical ones
+        __m128i cols_dx = _mm_sub_epi16( _mm_srli_si128(cols, 4), cols );
+        __m128i pairs = _mm_unpacklo_epi32( _mm_shuffle_epi32(_mm_srli_si128(cols, 2), _MM_SHUFFLE(3, 2, 2, 0)), cols_dx );
+        __m128i sum = _mm_madd_epi16( pairs, wx );
+        float out[4];
+        _mm_storeu_ps( out, _mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_setr_ps(scale_I, scale_d, scale_d, 0.0f)) );
+        I = out[0];
+        dx = out[1];
+        dy = out[2];
+#else
+        if (!gradients) {
+                int cols[2];
+                for (int c = 0; c < 2; c++)
+                        cols[c] = (p[c] * (one - bl.ay) + p[c + pitch] * bl.ay + one / 2) >> FIXED_WEIGHT_BITS;
+                I = (cols[0] * (one - bl.ax) + cols[1] * bl.ax) * scale_I;
+                return;
+        }
+        int cols[4], cols_dy[4];
+        for (int c = 0; c < 4; c++) {
+                const uint16_t *q = p + c - 1;
+                cols[c] = (q[0] * (one - bl.ay) + q[pitch] * bl.ay + one / 2) >> FIXED_WEIGHT_BITS;
+                cols_dy[c] = ((q[pitch] - q[-pitch]) * (one - bl.ay) + (q[2*pitch] - q[0]) * bl.ay + one / 2) >> FIXED_WEIGHT_BITS;
+        }
+        I  = (cols[1] * (one - bl.ax) + cols[2] * bl.ax) * scale_I;
+        dx = ((cols[2] - cols[0]) * (one - bl.ax) + (cols[3] - cols[1]) * bl.ax) * scale_d;
+        dy = (cols_dy[1] * (one - bl.ax) + cols_dy[2] * bl.ax) * scale_d;
+#endif
+}
+
+//_____________________________________________
+//_____________________________________________
+//________FUSED ALIGNMENT KERNEL
+//_____________________________________________
+//_____________________________________________
+
+// Number of floats accumulated per pixel: upper triangle of A (21), b (6),
+// error (1) and weighted error (1)
+#define NE_A_SIZE 21
+#define NE_B_OFFSET 21
+#define NE_ERROR_OFFSET 27
+#define NE_WERROR_OFFSET 28
+#define NE_SIZE 29
+
+/**
+ * Copies the packed upper triangle of A (row after row, as accumulated by
+ * h_calculate_normal_equations) into a full 6x6 matrix stored column-wise.
+ */
+void h_unpack_A( float *A, const float *A_upper ) {
+        int k = 0;
+        for (int row = 0; row < 6; row++) {
+                for (int col = row; col < 6; col++) {
+                        A[row + col*6] = A_upper[k];
+                        A[col + row*6] = A_upper[k];
+                        k++;
+                }
+        }
+}
+
+// Number of pixels per block of the reduction. The partition only depends on
+// the image size, never on the number of threads
+#define NE_BLOCK_SIZE 1024
+
+/**
+ * Number of blocks h_calculate_normal_equations splits an image of n pixels
+ * into. The partials buffer needs NE_SIZE floats per block.
+ */
+inline int h_ne_blocks( const int n ) {
+        return (n + NE_BLOCK_SIZE - 1) / NE_BLOCK_SIZE;
+}
+
+/**
+ * Type used to accumulate the normal equations. Float is the fastest. Double
+ * and Kahan (compensated float) sums are less sensitive to the order and the
+ * number of terms, at some cost in speed.
+ */
+enum Accumulator { ACCUMULATE_FLOAT, ACCUMULATE_DOUBLE, ACCUMULATE_KAHAN };
+
+/**
+ * Compensated (Kahan) float sum. Do not compile with -ffast-math, which is
+ * allowed to optimize the compensation away.
+ */
+struct KahanSum {
+        float sum, c;
+        KahanSum() : sum(0.0f), c(0.0f) {}
+        KahanSum& operator+=(const float val) {
+                float y = val - c;
+                float t = sum + y;
+                c = (t - sum) - y;
+                sum = t;
+                return *this;
+        }
+        operator float() const { return sum; }
+};
+
+/**
+ * Where h_calculate_normal_equations takes the Jacobian from:
+ *      LINEARIZE_FORWARD  gradients of the second frame at the warped points
+ *      LINEARIZE_INVERSE  cached reference Jacobian (inverse compositional)
+ *      LINEARIZE_ESM      mean of the gradients of the second frame at the
+ *                         warped points and of the first frame at the pixels
+ *                         (efficient second-order minimization)
+ */
+enum Linearization { LINEARIZE_FORWARD, LINEARIZE_INVERSE, LINEARIZE_ESM };
+
+/**
+ * Input of h_calculate_normal_equations for the current level and iteration.
+ * The matrices are stored column-wise. The images are pitched and the ones
+ * sampled have their guard band filled, see image.hpp.
+ */
+struct NormalEquationsInput {
+        const float *grayPrev;    // gray image of the first frame
+        const float *X;           // back-projected points of the first frame, see back_project_CPU
+        const float *Y;
+        const float *Z;
+        const int *pointPixels;   // position of the pixel of every point in the images of the first frame
+        int n;                    // number of points
+        const float *grayCur;     // gray image of the second frame, sampled like a texture
+        const float *gray_dx;     // horizontal derivatives of grayCur. Forward compositional only. NULL to compute them at the lookup, see h_sample_gradients
+        const float *gray_dy;     // vertical derivatives of grayCur. Forward compositional only
+        const float *texels;      // grayCur and its derivatives interleaved, see h_sample_texels. Used instead of the planes if not NULL
+        const half_t *grayCur_half; // grayCur in half precision, see half.hpp. Used instead of the float planes if not NULL
+        const half_t *gray_dx_half; // gray_dx in half precision. NULL to compute them at the lookup from grayCur_half
+        const half_t *gray_dy_half; // gray_dy in half precision
+        const half_t *texels_half;  // texels in half precision, see interleave_half_CPU. Used instead of all the above if not NULL
+        const uint16_t *grayCur_fixed; // grayCur in fixed point, see h_sample_fixed. Used instead of all the above if not NULL
+        bool tiled;               // layout of the texels, see texel_index. Only with texels
+        const float *gray_dx_ref; // horizontal derivatives of grayPrev. ESM only. NULL to compute them, see central_differences
+        const float *gray_dy_ref; // vertical derivatives of grayPrev. ESM only
+        const float *J_ref;       // reference Jacobian, see h_calculate_reference_jacobian. Inverse compositional only
+        const float *H_ref;       // reference J'*J per pixel, see h_calculate_reference_jacobian. Inverse compositional only
+        const float *R;           // rotation matrix
+        const float *translation; // translation vector
+        const float *K;           // intrinsic matrix of the current level
+        int width;                // current level image width
+        int height;               // current level image height
+        float variance;           // variance of the residuals. Only used if Weights::needsVariance
+};
+
+/**
+ * Samples the second frame at a bilinear lookup: the gray value, and its
+ * derivatives if gradients is set. Reads whichever storage in has: fixed
+ * point before half precision before float, and texels before planes. The texels are read
+ * even without gradients, since the lookup may be tiled. Without derivative
+ * planes the derivatives are computed from the gray plane.
+ */
+inline void h_sample_current( const NormalEquationsInput &in,
+                              const Bilinear &bl,
+                              const bool gradients,
+                              float &I,
+                              float &dx,
+                              float &dy ) {
+        if (in.grayCur_fixed) {
+                h_sample_fixed( in.grayCur_fixed, bl, in.width, gradients, I, dx, dy );
+        } else if (in.texels_half) {
+                h_sample_texels( in.texels_half, bl, I, dx, dy );
+        } else if (in.texels) {
+                h_sample_texels( in.texels, bl, I, dx, dy );
+        } else if (in.grayCur_half) {
+                if (gradients && !in.gray_dx_half) {
+                        h_sample_gradients( in.grayCur_half, bl, in.width, in.height, I, dx, dy );
+                        return;
+                }
+                I = h_sample( in.grayCur_half, bl );
+                if (gradients) {
+                        dx = h_sample( in.gray_dx_half, bl );
+                        dy = h_sample( in.gray_dy_half, bl );
+                }
+        } else {
+                if (gradients && !in.gray_dx) {
+                        h_sample_gradients( in.grayCur, bl, in.width, in.height, I, dx, dy );
+                        return;
+                }
+                I = h_sample( in.grayCur, bl );
+                if (gradients) {
+                        dx = h_sample( in.gray_dx, bl );
+                        dy = h_sample( in.gray_dy, bl );
+                }
+        }
+}
+
+/**
+ * Transforms the point (X, Y, Z) of the first frame with R and the
+ * translation and projects it onto the second frame. Same computation as
+ * d_transform_points.
+ * @return  Whether (u, v) is inside the second frame (interpolable).
+ */
+inline bool h_warp( const float X,
+                    const float Y,
+                    const float Z,
+                    const NormalEquationsInput &in,
+                    float &xp,
+                    float &yp,
+                    float &zp,
+                    float &u,
+                    float &v ) {
+        const float *R = in.R;
+        const float *K = in.K;
+
+        // transform: p' = R * p + t
+        xp = in.translation[0] + X * R[0] + Y * R[3] + Z * R[6];
+        yp = in.translation[1] + X * R[1] + Y * R[4] + Z * R[7];
+        zp = in.translation[2] + X * R[2] + Y * R[5] + Z * R[8];
+
+        // proyect to camera: (u, v) = K * p' / z'
+        u = ( xp * K[0] + yp * K[3] + zp * K[6] )
+          / ( xp * K[2] + yp * K[5] + zp * K[8] );
+        v = ( xp * K[1] + yp * K[4] + zp * K[7] )
+          / ( xp * K[2] + yp * K[5] + zp * K[8] );
+
+        // if (u, v) is out of bounds in the second frame (not interpolable)
+        return (u >= 0) && (u <= in.width-1) && (v >= 0) && (v <= in.height-1);
+}
+
+/**
+ * Jacobian of a residual with respect to a left increment of the pose, at the
+ * 3D point (xp, yp, zp). dxfx and dyfy are the image gradients at its
+ * projection times fx and fy. Same formulas as d_calculate_jacobian.
+ */
+inline void h_jacobian( float *J,
+                        const float dxfx,
+                        const float dyfy,
+                        const float xp,
+                        const float yp,
+                        const float zp ) {
+        J[0] = - dxfx / zp;
+        J[1] = - dyfy / zp;
+        J[2] = + ( dxfx*xp + dyfy*yp )
+                 / ( zp * zp );
+        J[3] = + ( dxfx*xp*yp + dyfy*yp*yp )
+                 / ( zp * zp )
+               + dyfy;
+        J[4] = - ( dyfy*xp*yp + dxfx*xp*xp )
+                 / ( zp * zp )
+               - dxfx;
+        J[5] = + dxfx*yp / zp
+               - dyfy*xp / zp;
+}
+
+/**
+ * Calculates the Jacobian of the inverse compositional mode, once per level.
+ * The increment is applied to the first (reference) frame, so the Jacobian
+ * only depends on the reference gradients and 3D points, and not on the
+ * current pose. Its sign is flipped with respect to h_jacobian because the
+ * warped reference image is the one subtracted in the residual.
+ * @param J_ref       Output. 6 floats per point.
+ * @param H_ref       Output. Upper triangle of J'*J per point, NE_A_SIZE floats per point.
+ * @param X, Y, Z     Input. Points of the first frame, see back_project_CPU.
+ * @param pointPixels Input. Position of the pixel of every point in the images.
+ * @param n           Number of points.
+ * @param gray        Input. Gray image of the first frame. Only read without derivatives.
+ * @param gray_dx     Input. Horizontal derivatives of the first frame. NULL to compute them, see central_differences.
+ * @param gray_dy     Input. Vertical derivatives of the first frame.
+ * @param K           Input. Intrinsic matrix of the current level, stored column-wise.
+ * @param width       Current level image width.
+ */
+void h_calculate_reference_jacobian( float *J_ref,
+                                     float *H_ref,
+                                     const float *X,
+                                     const float *Y,
+                                     const float *Z,
+                                     const int *pointPixels,
+                                     const int n,
+                                     const float *gray,
+                                     const float *gray_dx,
+                                     const float *gray_dy,
+                                     const float *K,
+                                     const int width ) {
+        const int pitch = image_pitch(width);
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++) {
+                const int pos = pointPixels[i];
+                float *J = &J_ref[6 * i];
+                float *H = &H_ref[NE_A_SIZE * i];
+
+                float dx, dy;
+                if (gray_dx) { dx = gray_dx[pos]; dy = gray_dy[pos]; }
+                else central_differences( gray, pos, pitch, dx, dy );
+                h_jacobian( J, - dx * K[0], - dy * K[4], X[i], Y[i], Z[i] );
+
+                int k = 0;
+                for (int row = 0; row < 6; row++)
+                        for (int col = row; col < 6; col++)
+                                H[k++] = J[row] * J[col];
+        }
+}
+
+/**
+ * Sums up the per-pixel J'*J of h_calculate_reference_jacobian over the whole
+ * level. A of the inverse compositional mode with uniform weights is this
+ * sum, which stays the same for all iterations of the level, minus the J'*J
+ * of the points warped outside at each iteration. Same fixed blocks and
+ * ordered merge as h_calculate_normal_equations.
+ * @param A_upper  Output. NE_A_SIZE floats.
+ * @param partials Scratch. NE_SIZE * h_ne_blocks(n) floats.
+ * @param H_ref    Input. NE_A_SIZE floats per pixel.
+ * @param n        Number of pixels.
+ */
+template<typename T>
+void h_sum_reference_hessian( float *A_upper,
+                              float *partials,
+                              const float *H_ref,
+                              const int n ) {
+        const int blocks = h_ne_blocks(n);
+
+        #pragma omp parallel for schedule(static)
+        for (int block = 0; block < blocks; block++) {
+                T acc[NE_A_SIZE] = {};
+                const int end = std::min(n, (block + 1) * NE_BLOCK_SIZE);
+                for (int pos = block * NE_BLOCK_SIZE; pos < end; pos++)
+                        for (int k = 0; k < NE_A_SIZE; k++) acc[k] += H_ref[NE_A_SIZE * pos + k];
+                for (int k = 0; k < NE_A_SIZE; k++) partials[block * NE_SIZE + k] = acc[k];
+        }
+
+        // ordered merge of the block partials
+        T sum[NE_A_SIZE] = {};
+        for (int block = 0; block < blocks; block++)
+                for (int k = 0; k < NE_A_SIZE; k++) sum[k] += partials[block * NE_SIZE + k];
+        for (int k = 0; k < NE_A_SIZE; k++) A_upper[k] = sum[k];
+}
+
+/**
+ * Runs h_sum_reference_hessian with the accumulation type chosen at run time.
+ */
+void h_sum_reference_hessian( Accumulator accumulator,
+                              float *A_upper,
+                              float *partials,
+                              const float *H_ref,
+                              const int n ) {
+        switch (accumulator) {
+        case ACCUMULATE_DOUBLE: h_sum_reference_hessian<double>(A_upper, partials, H_ref, n); break;
+        case ACCUMULATE_KAHAN: h_sum_reference_hessian<KahanSum>(A_upper, partials, H_ref, n); break;
+        default: h_sum_reference_hessian<float>(A_upper, partials, H_ref, n);
+        }
+}
+
+/**
+ * Builds the histogram of the absolute residuals of the points warping inside
+ * the second frame (see weights.hpp), for the T-Distribution variance of the
+ * normal equations pass at the same pose. Only the gray value is sampled, so
+ * this pass costs a fraction of the normal equations one. Counts are
+ * integers, so the per-thread histograms are merged in any order.
+ * @param hist  Output. TDIST_HIST_BINS counts.
+ * @param in    Input. Images and matrices, see NormalEquationsInput.
+ */
+void h_residual_histogram( unsigned int *hist,
+                           const NormalEquationsInput &in ) {
+        for (int bin = 0; bin < TDIST_HIST_BINS; bin++) hist[bin] = 0;
+
+        #pragma omp parallel
+        {
+                unsigned int thread_hist[TDIST_HIST_BINS] = {};
+
+                #pragma omp for schedule(static)
+                for (int i = 0; i < in.n; i++) {
+                        float xp, yp, zp, u, v;
+                        if ( !h_warp( in.X[i], in.Y[i], in.Z[i], in, xp, yp, zp, u, v ) )
+                                continue;
+                        Bilinear bl = h_bilinear( in.width, in.height, u, v, in.tiled );
+                        float I, dx = 0.0f, dy = 0.0f;
+                        h_sample_current( in, bl, false, I, dx, dy );
+                        thread_hist[tdist_histogram_bin(in.grayPrev[in.pointPixels[i]] - I)]++;
+                }
+
+                #pragma omp critical
+                for (int bin = 0; bin < TDIST_HIST_BINS; bin++) hist[bin] += thread_hist[bin];
+        }
+}
+
+/**
+ * Warps every pixel of the first frame onto the second one, samples the gray
+ * value and its derivatives there, and accumulates the residual, weight and
+ * Jacobian of the pixel into the normal equations. This does the job of
+ * d_transform_points, d_calculate_residuals, d_calculate_jacobian, the weight
+ * kernels and d_product_JacT_W_Jac/res in a single pass.
+ *
+ * Only the points of the pixels with depth are visited (see back_project_CPU),
+ * so the loop needs no depth test and does not even read the depth image.
+ * Points warped outside of the second frame contribute nothing, exactly like
+ * the 0 residual and Jacobian rows of the CUDA version. The per point arrays
+ * in.J_ref and in.H_ref follow the points.
+ *
+ * In the inverse compositional mode the Jacobian and J'*J of every pixel come
+ * from in.J_ref and in.H_ref instead, and the gradients of the second frame
+ * are not sampled. With uniform weights A is the sum of the cached J'*J of all
+ * the points (see h_sum_reference_hessian) minus that of the points warped
+ * outside, and only the latter, usually few, are accumulated into the A part
+ * of ne; otherwise A is the weighted sum of the cached J'*J of the valid
+ * points.
+ *
+ * ESM uses the forward compositional Jacobian with the mean of both gradients,
+ * which approximates the second order terms of the error without a Hessian.
+ *
+ * The weight function is the Weights policy (see weights.hpp), so every weight
+ * function gets its own loop. Uniform weights skip the multiply altogether.
+ *
+ * Weights that depend on the variance use the variance passed in, which the
+ * caller estimates from the residuals at the same pose beforehand, see
+ * h_residual_histogram.
+ *
+ * The image is split into fixed blocks of NE_BLOCK_SIZE pixels. Every block is
+ * summed up in pixel order into its own partial, whichever thread runs it, and
+ * the partials are then merged in block order. The result is therefore the
+ * same bit by bit for any number of threads. The merge only touches
+ * NE_SIZE floats per block and is negligible next to the pixel pass.
+ *
+ * @param T        Accumulation type: float, double or KahanSum.
+ * @param Weights  Weight policy: GaussianWeights, HuberWeights, TukeyWeights or TDistWeights.
+ * @param lin      Where the Jacobian comes from, see Linearization.
+ * @param ne       Output. NE_SIZE floats, see the NE_* offsets.
+ * @param partials Scratch. NE_SIZE * h_ne_blocks(in.n) floats.
+ * @param in       Input. Images, matrices and variance, see NormalEquationsInput.
+ */
+template<typename T, class Weights, Linearization lin>
+void h_calculate_normal_equations( float *ne,
+                                   float *partials,
+                                   const NormalEquationsInput &in ) {
+        const int width = in.width;
+        const int height = in.height;
+        const int n = in.n;
+        const int blocks = h_ne_blocks(n);
+
+        #pragma omp parallel
+        {
+                #pragma omp for schedule(static)
+                for (int block = 0; block < blocks; block++) {
+                        T acc[NE_SIZE] = {};
+                        const int end = std::min(n, (block + 1) * NE_BLOCK_SIZE);
+                        for (int i = block * NE_BLOCK_SIZE; i < end; i++) {
+                                const int pos = in.pointPixels[i];
+
+                                float xp, yp, zp, u, v;
+                                if ( !h_warp( in.X[i], in.Y[i], in.Z[i], in, xp, yp, zp, u, v ) ) {
+                                        // J'*J to take out of the sum over all the points, see above
+                                        if (lin == LINEARIZE_INVERSE && Weights::uniform) {
+                                                const float *H = &in.H_ref[NE_A_SIZE * i];
+                                                for (int k = 0; k < NE_A_SIZE; k++)
+                                                        acc[k] += H[k];
+                                        }
+                                        continue;
+                                }
+
+                                // gray value of the second frame, and its derivatives unless the Jacobian is cached.
+                                // The bilinear weights are computed once for all of them
+                                Bilinear bl = h_bilinear( width, height, u, v, in.tiled );
+                                float I, dx = 0.0f, dy = 0.0f;
+                                h_sample_current( in, bl, lin != LINEARIZE_INVERSE, I, dx, dy );
+
+                                // residual
+                                float r = in.grayPrev[pos] - I;
+
+                                // weight
+                                float w = Weights::weight(r, in.variance);
+
+                                if (lin == LINEARIZE_INVERSE) {
+                                        // accumulate b = J'*W*r with the reference Jacobian, and A = J'*W*J
+                                        // from the cached J'*J unless it is constant
+                                        const float *J = &in.J_ref[6 * i];
+                                        for (int row = 0; row < 6; row++)
+                                                acc[NE_B_OFFSET + row] += (Weights::uniform ? J[row] : J[row] * w) * r;
+                                        if (!Weights::uniform) {
+                                                const float *H = &in.H_ref[NE_A_SIZE * i];
+                                                for (int k = 0; k < NE_A_SIZE; k++)
+                                                        acc[k] += w * H[k];
+                                        }
+                                } else {
+                                        // jacobian. dxfx is the image gradient in x direction times the fx of the intrinsic camera calibration
+                                        if (lin == LINEARIZE_ESM) {
+                                                float dx_ref, dy_ref;
+                                                if (in.gray_dx_ref) { dx_ref = in.gray_dx_ref[pos]; dy_ref = in.gray_dy_ref[pos]; }
+                                                else central_differences( in.grayPrev, pos, image_pitch(width), dx_ref, dy_ref );
+                                                dx = 0.5f * ( dx + dx_ref );
+                                                dy = 0.5f * ( dy + dy_ref );
+                                        }
+                                        float dxfx = dx * in.K[0];
+                                        float dyfy = dy * in.K[4];
+
+                                        float J[6];
+                                        h_jacobian( J, dxfx, dyfy, xp, yp, zp );
+
+                                        // accumulate A = J'*W*J (upper triangle), b = J'*W*r
+                                        int k = 0;
+                                        for (int row = 0; row < 6; row++) {
+                                                float jw = Weights::uniform ? J[row] : J[row] * w;
+                                                for (int col = row; col < 6; col++)
+                                                        acc[k++] += jw * J[col];
+                                                acc[NE_B_OFFSET + row] += jw * r;
+                                        }
+                                }
+                                acc[NE_ERROR_OFFSET] += r * r;
+                                if (!Weights::uniform) acc[NE_WERROR_OFFSET] += w * r * r;
+                        }
+                        for (int i = 0; i < NE_SIZE; i++) partials[block * NE_SIZE + i] = acc[i];
+                }
+        }
+
+        // ordered merge of the block partials
+        T sum[NE_SIZE] = {};
+        for (int block = 0; block < blocks; block++)
+                for (int i = 0; i < NE_SIZE; i++) sum[i] += partials[block * NE_SIZE + i];
+        for (int i = 0; i < NE_SIZE; i++) ne[i] = sum[i];
+}
+
+/**
+ * Runs h_calculate_normal_equations with the linearization chosen at run time.
+ */
+template<typename T, class Weights>
+void h_calculate_normal_equations_linearized( Linearization lin,
+                                              float *ne,
+                                              float *partials,
+                                                         const NormalEquationsInput &in ) {
+        switch (lin) {
+        case LINEARIZE_INVERSE: h_calculate_normal_equations<T, Weights, LINEARIZE_INVERSE>(ne, partials, in); break;
+        case LINEARIZE_ESM: h_calculate_normal_equations<T, Weights, LINEARIZE_ESM>(ne, partials, in); break;
+        default: h_calculate_normal_equations<T, Weights, LINEARIZE_FORWARD>(ne, partials, in);
+        }
+}
+
+/**
+ * Runs h_calculate_normal_equations with the accumulation type and the
+ * linearization chosen at run time.
+ */
+template<class Weights>
+void h_calculate_normal_equations_weighted( Accumulator accumulator,
+                                            Linearization lin,
+                                            float *ne,
+                                            float *partials,
+                                                     const NormalEquationsInput &in ) {
+        switch (accumulator) {
+        case ACCUMULATE_DOUBLE: h_calculate_normal_equations_linearized<double, Weights>(lin, ne, partials, in); break;
+        case ACCUMULATE_KAHAN: h_calculate_normal_equations_linearized<KahanSum, Weights>(lin, ne, partials, in); break;
+        default: h_calculate_normal_equations_linearized<float, Weights>(lin, ne, partials, in);
+        }
+}
+
+/**
+ * Runs h_calculate_normal_equations with the weight function, the
+ * accumulation type and the linearization chosen at run time.
+ */
+void h_calculate_normal_equations( ResidualWeight weightType,
+                                   Accumulator accumulator,
+                                   Linearization lin,
+                                   float *ne,
+                                   float *partials,
+                                   const NormalEquationsInput &in ) {
+        switch (weightType) {
+        case HUBER:
+                h_calculate_normal_equations_weighted<HuberWeights>(accumulator, lin, ne, partials, in);
+                break;
+        case TUKEY:
+                h_calculate_normal_equations_weighted<TukeyWeights>(accumulator, lin, ne, partials, in);
+                break;
+        case TDIST:
+                h_calculate_normal_equations_weighted<TDistWeights>(accumulator, lin, ne, partials, in);
+                break;
+        default:
+                h_calculate_normal_equations_weighted<GaussianWeights>(accumulator, lin, ne, partials, in);
+        }
+}
+
+}   // namespace CPU_ISA_NAMESPACE
+
+#endif
@@ -0,0 +1,795 @@
+/**
+ * \file
+ * \brief   Benchmarks of the CPU backend, run outside of the tracker on the
+ *          first frame of a dataset. Including:
+ * 				* layout: lookups of the normal equations pass with the
+ * 				  row-major and the tiled texel layouts (see texel_index)
+ * 				  and the fixed point gray plane (see h_sample_fixed)
+ * 				  under pure translation, yaw and roll of the second frame
+ * 				* gradients: stored derivative planes against derivatives
+ * 				  computed at the lookups (GRADIENTS_ON_THE_FLY), in float
+ * 				  and half precision
+ * 				* isa: the whole tracker (pyramid and alignment of a frame)
+ * 				  with the variant of each instruction set the CPU supports,
+ * 				  see isa.hpp
+ * 				* pyramid: the gray and depth levels of a pyramid, downscaled
+ * 				  with imresize_CPU and with downsample2x_gray/depth_CPU
+ * 				* scales: the whole tracker over the dataset with pyramids
+ * 				  of several scales between levels, see pyramid.hpp
+ *
+ *          The first frame is aligned against itself at a fixed synthetic
+ *          pose, so the residuals mean nothing but the lookups follow the
+ *          motion: rows of the first frame stay rows of the second one under
+ *          translation and yaw, and cross it diagonally under roll. Each
+ *          configuration reports the time of a full resolution pass and, if
+ *          the kernel gives access to the hardware counters (perf events on
+ *          Linux), the L1 and last level cache read misses per pixel.
+ *
+ *          The gradients benchmark reports, for the full resolution level of
+ *          one frame, the time to compute the derivative planes (float or
+ *          half precision), their memory, and the time of a normal
+ *          equations pass of the forward compositional and ESM
+ *          linearizations, which read the derivatives. A whole pyramid adds
+ *          about a third to the first two.
+ *
+ *          The isa benchmark aligns the first two frames of the dataset
+ *          against each other, back and forth, and reports the time and the
+ *          iterations per frame and how far the poses are from those of the
+ *          baseline variant, which should only differ by rounding.
+ *
+ *          The pyramid benchmark reports the time to build the levels above
+ *          the full resolution one, with imresize_CPU and with the fused
+ *          downscaling by 2 of every supported variant, and the largest
+ *          difference of the levels to those of imresize_CPU: rounding for
+ *          gray, none for depth. Once for the frame and once for a crop of
+ *          it with odd sized levels, whose last column and row are left out
+ *          (imresize_CPU downscales their even crop).
+ *
+ *          The scales benchmark tracks all the frames of the dataset with
+ *          pyramids of several scales between levels (0.5 is the usual factor
+ *          2), each with as many levels as keep its coarsest level no smaller
+ *          than that of the usual 5 levels. It reports the time per frame
+ *          (pyramid and iterations), the iterations per frame and the relative
+ *          pose error between consecutive frames against the groundtruth, so
+ *          the cheapest scale that converges as well can be picked (see
+ *          -pyramidScale in main.cu). Smaller steps between levels need more
+ *          levels but fewer iterations at the finest ones.
+ *
+ *          The threads benchmark tracks all the frames of the dataset with
+ *          every accumulator (see alignment_cpu.hpp) in the forward, inverse
+ *          compositional and ESM modes, once per number of OpenMP threads
+ *          from 1 to BENCHMARK_MAX_THREADS (or the number of processors if
+ *          more). The sums of the normal equations are reduced over fixed
+ *          blocks of pixels in a fixed order, so every pose has to be bit
+ *          identical to that of 1 thread: it reports the time per frame of
+ *          each number of threads and MISMATCH for any pose that differs, and
+ *          exits with 1 if one does.
+ *
+ *          Build with "make benchmark" and run e.g.
+ *          ./benchmark layout -path ../data/rgbd_dataset_freiburg1_xyz -repetitions 20
+ *          ./benchmark gradients -path ../data/rgbd_dataset_freiburg1_xyz
+ *          ./benchmark isa -path ../data/rgbd_dataset_freiburg1_xyz
+ *          ./benchmark pyramid -path ../data/rgbd_dataset_freiburg1_xyz -repetitions 100
+ *          ./benchmark scales -path ../data/rgbd_dataset_freiburg1_xyz -repetitions 1
+ *          ./benchmark threads -path ../data/rgbd_dataset_freiburg1_xyz
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <omp.h>
+#include <Eigen/Dense>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include "helper_cpu.h"
+#include "tum_benchmark.hpp"
+#include "dataset.hpp"
+#include "alignment_cpu.hpp"
+#include "tracker_cpu_dispatch.hpp"
+#include "common.h"
+
+#ifdef __linux__
+        #include <linux/perf_event.h>
+        #include <sys/ioctl.h>
+        #include <sys/syscall.h>
+        #include <unistd.h>
+#endif
+
+//_______________________________________________________
+//_______________________________________________________
+//________ HARDWARE COUNTERS
+//_______________________________________________________
+//_______________________________________________________
+
+/**
+ * Read misses of a cache level, counted for the calling thread and the
+ * threads it creates afterwards (so it has to be created before the OpenMP
+ * thread pool). Not available without perf events or if the kernel does not
+ * allow them (e.g. in most virtual machines).
+ */
+class CacheMissCounter {
+
+public:
+
+enum Cache { L1D, LAST_LEVEL };
+
+CacheMissCounter(Cache cache) : fd(-1) {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = (cache == L1D ? PERF_COUNT_HW_CACHE_L1D : PERF_COUNT_HW_CACHE_LL)
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+~CacheMissCounter() {
+#ifdef __linux__
+        if (fd >= 0) close(fd);
+#endif
+}
+
+bool available() const { return fd >= 0; }
+
+void start() {
+#ifdef __linux__
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+/**
+ * @return  Misses since start, -1 if not available.
+ */
+long long stop() {
+        long long count = -1;
+#ifdef __linux__
+        if (fd < 0) return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+        return count;
+}
+
+private:
+
+int fd;
+
+};
+
+//_______________________________________________________
+//_______________________________________________________
+//________ LAYOUT
+//_______________________________________________________
+//_______________________________________________________
+
+/**
+ * Times the normal equations pass over the full resolution frame for every
+ * motion and storage of the second frame, see the file description.
+ */
+void benchmark_layout(const PitchedImage<float> &gray, const PitchedImage<float> &depth, const Eigen::Matrix3f &K, int repetitions) {
+        const int w = gray.width;
+        const int h = gray.height;
+        CacheMissCounter l1(CacheMissCounter::L1D);
+        CacheMissCounter llc(CacheMissCounter::LAST_LEVEL);
+        if (!l1.available())
+                std::cout << "Cache miss counters not available, timing only\n" << std::endl;
+
+        // second frame in every storage and layout
+        PitchedImage<float> dx, dy, texels_rows, texels_tiled;
+        PitchedImage<half_t> half_rows, half_tiled;
+        PitchedImage<uint16_t> fixed;
+        dx.allocate(w, h);
+        dy.allocate(w, h);
+        texels_rows.allocate(w, h, TEXEL_SIZE, false);
+        texels_tiled.allocate(w, h, TEXEL_SIZE, true);
+        half_rows.allocate(w, h, TEXEL_SIZE, false);
+        half_tiled.allocate(w, h, TEXEL_SIZE, true);
+        fixed.allocate(w, h);
+        image_derivatives_CPU(gray.data, dx.data, dy.data, w, h, texels_rows.data, false);
+        image_derivatives_CPU(gray.data, dx.data, dy.data, w, h, texels_tiled.data, true);
+        interleave_half_CPU(gray.data, dx.data, dy.data, half_rows.data, w, h, false);
+        interleave_half_CPU(gray.data, dx.data, dy.data, half_tiled.data, w, h, true);
+        float_to_fixed_CPU(gray.begin(), fixed.begin(), gray.count());
+        dx.replicate_border();
+        dy.replicate_border();
+        texels_rows.replicate_border();
+        texels_tiled.replicate_border();
+        half_rows.replicate_border();
+        half_tiled.replicate_border();
+
+        struct Storage { const char *name; const float *texels; const half_t *texels_half; const uint16_t *gray_fixed; bool tiled; };
+        const Storage storages[] = {
+                { "float planes",        NULL,              NULL,            NULL,       false },
+                { "float texels, rows",  texels_rows.data,  NULL,            NULL,       false },
+                { "float texels, tiles", texels_tiled.data, NULL,            NULL,       true  },
+                { "half texels, rows",   NULL,              half_rows.data,  NULL,       false },
+                { "half texels, tiles",  NULL,              half_tiled.data, NULL,       true  },
+                { "fixed point plane",   NULL,              NULL,            fixed.data, false },
+        };
+
+        // pure motions of the second frame, of the size of a fast frame to frame motion
+        const float deg = 3.14159265f / 180.0f;
+        struct Motion { const char *name; Eigen::Matrix3f R; Eigen::Vector3f t; };
+        const Motion motions[] = {
+                { "translation", Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.05f, 0.02f, 0.0f) },
+                { "yaw",  Eigen::AngleAxisf(5.0f * deg, Eigen::Vector3f::UnitY()).toRotationMatrix(), Eigen::Vector3f::Zero() },
+                { "roll", Eigen::AngleAxisf(10.0f * deg, Eigen::Vector3f::UnitZ()).toRotationMatrix(), Eigen::Vector3f::Zero() },
+        };
+
+        // first frame
+        Eigen::Matrix3f K_inv = invertKMat(K);
+        std::vector<float> X(w*h), Y(w*h), Z(w*h);
+        std::vector<int> pointPixels(w*h);
+        int n_points = back_project_CPU(X.data(), Y.data(), Z.data(), pointPixels.data(), NULL, w*h, depth.data, K_inv.data(), w);
+        std::vector<float> partials(NE_SIZE*h_ne_blocks(w*h));
+        float ne[NE_SIZE];
+
+        std::cout << std::left << std::setw(13) << "motion" << std::setw(21) << "storage"
+                  << std::right << std::setw(10) << "ms/pass" << std::setw(14) << "L1 miss/px" << std::setw(14) << "LLC miss/px" << std::endl;
+        for (const Motion &motion : motions) {
+                for (const Storage &storage : storages) {
+                        NormalEquationsInput in;
+                        memset(&in, 0, sizeof(in));
+                        in.grayPrev = gray.data;
+                        in.X = X.data();
+                        in.Y = Y.data();
+                        in.Z = Z.data();
+                        in.pointPixels = pointPixels.data();
+                        in.n = n_points;
+                        in.grayCur = gray.data;
+                        in.gray_dx = dx.data;
+                        in.gray_dy = dy.data;
+                        in.texels = storage.texels;
+                        in.texels_half = storage.texels_half;
+                        in.grayCur_fixed = storage.gray_fixed;
+                        in.tiled = storage.tiled;
+                        in.R = motion.R.data();
+                        in.translation = motion.t.data();
+                        in.K = K.data();
+                        in.width = w;
+                        in.height = h;
+
+                        // warm up, then measure
+                        h_calculate_normal_equations(GAUSSIAN, ACCUMULATE_FLOAT, LINEARIZE_FORWARD, ne, partials.data(), in);
+                        WallTimer timer; timer.start();
+                        l1.start(); llc.start();
+                        for (int i = 0; i < repetitions; i++)
+                                h_calculate_normal_equations(GAUSSIAN, ACCUMULATE_FLOAT, LINEARIZE_FORWARD, ne, partials.data(), in);
+                        long long l1_misses = l1.stop(), llc_misses = llc.stop();
+                        timer.end();
+
+                        std::cout << std::left << std::setw(13) << motion.name << std::setw(21) << storage.name << std::right << std::fixed
+                                  << std::setw(10) << std::setprecision(3) << 1000 * timer.get() / repetitions;
+                        if (l1_misses >= 0) std::cout << std::setw(14) << std::setprecision(4) << (double)l1_misses / repetitions / (w*h);
+                        else std::cout << std::setw(14) << "n/a";
+                        if (llc_misses >= 0) std::cout << std::setw(14) << std::setprecision(4) << (double)llc_misses / repetitions / (w*h);
+                        else std::cout << std::setw(14) << "n/a";
+                        std::cout << std::endl;
+                }
+        }
+
+        dx.release(); dy.release();
+        texels_rows.release(); texels_tiled.release();
+        half_rows.release(); half_tiled.release();
+        fixed.release();
+}
+
+//_______________________________________________________
+//_______________________________________________________
+//________ GRADIENTS
+//_______________________________________________________
+//_______________________________________________________
+
+/**
+ * Compares stored derivative planes with derivatives computed at the lookups,
+ * see the file description.
+ */
+void benchmark_gradients(const PitchedImage<float> &gray, const PitchedImage<float> &depth, const Eigen::Matrix3f &K, int repetitions) {
+        const int w = gray.width;
+        const int h = gray.height;
+
+        PitchedImage<float> dx, dy;
+        PitchedImage<half_t> gray_half, dx_half, dy_half;
+        dx.allocate(w, h);
+        dy.allocate(w, h);
+        gray_half.allocate(w, h);
+        dx_half.allocate(w, h);
+        dy_half.allocate(w, h);
+        float_to_half_CPU(gray.begin(), gray_half.begin(), gray.count());
+
+        // first frame, and a small translation of the second one
+        Eigen::Matrix3f K_inv = invertKMat(K);
+        std::vector<float> X(w*h), Y(w*h), Z(w*h);
+        std::vector<int> pointPixels(w*h);
+        int n_points = back_project_CPU(X.data(), Y.data(), Z.data(), pointPixels.data(), NULL, w*h, depth.data, K_inv.data(), w);
+        std::vector<float> partials(NE_SIZE*h_ne_blocks(w*h));
+        float ne[NE_SIZE];
+        const Eigen::Matrix3f R = Eigen::Matrix3f::Identity();
+        const Eigen::Vector3f t(0.05f, 0.02f, 0.0f);
+
+        std::cout << std::left << std::setw(22) << "gradients"
+                  << std::right << std::setw(10) << "build ms" << std::setw(11) << "memory MB"
+                  << std::setw(12) << "forward ms" << std::setw(10) << "ESM ms" << std::endl;
+        for (int half = 0; half < 2; half++) {
+                for (int stored = 1; stored >= 0; stored--) {
+                        // derivative planes, as fill_level builds them: half precision ones straight from gray
+                        double build_ms = 0.0, memory_mb = 0.0;
+                        if (stored) {
+                                WallTimer timer; timer.start();
+                                for (int i = 0; i < repetitions; i++) {
+                                        if (half) {
+                                                image_derivatives_half_CPU(gray.data, dx_half.data, dy_half.data, w, h);
+                                                dx_half.replicate_border();
+                                                dy_half.replicate_border();
+                                        } else {
+                                                image_derivatives_CPU(gray.data, dx.data, dy.data, w, h);
+                                                dx.replicate_border();
+                                                dy.replicate_border();
+                                        }
+                                }
+                                timer.end();
+                                build_ms = 1000 * timer.get() / repetitions;
+                                memory_mb = 2.0 * dx.count() * (half ? sizeof(half_t) : sizeof(float)) / (1 << 20);
+                        }
+
+                        NormalEquationsInput in;
+                        memset(&in, 0, sizeof(in));
+                        in.grayPrev = gray.data;
+                        in.X = X.data();
+                        in.Y = Y.data();
+                        in.Z = Z.data();
+                        in.pointPixels = pointPixels.data();
+                        in.n = n_points;
+                        in.grayCur = gray.data;
+                        // in half precision the tracker keeps no float derivative planes, see allocate_level
+                        in.gray_dx = stored && !half ? dx.data : NULL;
+                        in.gray_dy = stored && !half ? dy.data : NULL;
+                        in.grayCur_half = half ? gray_half.data : NULL;
+                        in.gray_dx_half = half && stored ? dx_half.data : NULL;
+                        in.gray_dy_half = half && stored ? dy_half.data : NULL;
+                        in.gray_dx_ref = in.gray_dx;
+                        in.gray_dy_ref = in.gray_dy;
+                        in.R = R.data();
+                        in.translation = t.data();
+                        in.K = K.data();
+                        in.width = w;
+                        in.height = h;
+
+                        double pass_ms[2];
+                        const Linearization lins[2] = { LINEARIZE_FORWARD, LINEARIZE_ESM };
+                        for (int l = 0; l < 2; l++) {
+                                // warm up, then measure
+                                h_calculate_normal_equations(GAUSSIAN, ACCUMULATE_FLOAT, lins[l], ne, partials.data(), in);
+                                WallTimer timer; timer.start();
+                                for (int i = 0; i < repetitions; i++)
+                                        h_calculate_normal_equations(GAUSSIAN, ACCUMULATE_FLOAT, lins[l], ne, partials.data(), in);
+                                timer.end();
+                                pass_ms[l] = 1000 * timer.get() / repetitions;
+                        }
+
+                        std::string name = std::string(stored ? "stored" : "on the fly") + (half ? ", half" : ", float");
+                        std::cout << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(3)
+                                  << std::setw(10) << build_ms << std::setw(11) << memory_mb
+                                  << std::setw(12) << pass_ms[0] << std::setw(10) << pass_ms[1] << std::endl;
+                }
+        }
+
+        dx.release(); dy.release();
+        gray_half.release(); dx_half.release(); dy_half.release();
+}
+
+//_______________________________________________________
+//_______________________________________________________
+//________ INSTRUCTION SETS
+//_______________________________________________________
+//_______________________________________________________
+
+/**
+ * Runs the tracker with every supported instruction set, see the file description.
+ */
+void benchmark_isa(const Dataset &dataset, int repetitions) {
+        // the first two frames, tight as the tracker takes them
+        std::vector< std::vector<float> > gray(2), depth(2);
+        int w = 0, h = 0;
+        for (int f = 0; f < 2; f++) {
+                const Frame &frame = dataset.frames[std::min<size_t>(f, dataset.frames.size() - 1)];
+                cv::Mat mGray = loadIntensity(frame.colorPath);
+                cv::Mat mDepth = loadDepth(frame.depthPath);
+                w = mGray.cols;
+                h = mGray.rows;
+                gray[f].resize((size_t)w*h);
+                depth[f].resize((size_t)w*h);
+                convert_mat_to_layered(gray[f].data(), mGray);
+                convert_mat_to_layered(depth[f].data(), mDepth);
+        }
+
+        std::cout << "best supported: " << cpu_isa_name(cpu_isa_best()) << std::endl;
+        std::cout << std::left << std::setw(10) << "isa" << std::right << std::setw(12) << "ms/frame"
+                  << std::setw(14) << "iters/frame" << std::setw(16) << "pose diff" << std::endl;
+        std::vector<Vector6f> poses_generic;
+        for (int i = 0; i < CPU_ISA_COUNT; i++) {
+                CpuIsa isa = (CpuIsa)i;
+                if (!cpu_isa_supported(isa)) continue;
+                TrackerBase *tracker = createTrackerCPU(isa, gray[0].data(), depth[0].data(), w, h, dataset.K);
+                std::vector<Vector6f> poses;
+                int iterations = 0;
+                WallTimer timer; timer.start();
+                for (int r = 0; r < repetitions; r++) {
+                        const int f = (r + 1) % 2;
+                        poses.push_back(tracker->align(gray[f].data(), depth[f].data()));
+                        for (size_t level = 0; level < tracker->getIterations().size(); level++)
+                                iterations += tracker->getIterations()[level];
+                }
+                timer.end();
+                delete tracker;
+
+                // largest difference of a twist coordinate to the baseline
+                if (isa == CPU_ISA_GENERIC) poses_generic = poses;
+                float diff = 0.0f;
+                for (size_t r = 0; r < poses.size(); r++)
+                        diff = std::max(diff, (poses[r] - poses_generic[r]).cwiseAbs().maxCoeff());
+                std::cout << std::left << std::setw(10) << cpu_isa_name(isa) << std::right << std::fixed << std::setprecision(3)
+                          << std::setw(12) << 1000 * timer.get() / repetitions
+                          << std::setw(14) << (float)iterations / repetitions
+                          << std::setw(16) << std::scientific << diff << std::endl;
+        }
+}
+
+//_______________________________________________________
+//_______________________________________________________
+//________ PYRAMID
+//_______________________________________________________
+//_______________________________________________________
+
+// levels of the pyramid built by benchmark_pyramid, as the tracker's default maxLevel
+#define BENCHMARK_PYRAMID_LEVELS 5
+// scales between pyramid levels tracked by benchmark_scales: 1/2, 3/5, 2/3, 1/sqrt(2), 3/4 and 4/5
+#define BENCHMARK_SCALES 0.5f, 0.6f, 0.6667f, 0.7071f, 0.75f, 0.8f
+
+// crop of the frame also downscaled by benchmark_pyramid: its odd levels 125 and 93 pixels wide
+// have a pitch other than that of twice the level above, see image_pitch
+#define BENCHMARK_PYRAMID_ODD_WIDTH 500
+#define BENCHMARK_PYRAMID_ODD_HEIGHT 372
+
+// downscaling of the pyramid levels by a variant, see benchmark_pyramid
+struct PyramidDownscaling {
+        CpuIsa isa;
+        void (*gray)(const float *, float *, float *, int, int, int);
+        void (*depth)(const float *, float *, int, int, int);
+};
+
+/**
+ * benchmark_pyramid of the top left w x h pixels of the frame.
+ */
+void benchmark_pyramid_size(const PitchedImage<float> &gray, const PitchedImage<float> &depth, int w, int h, int repetitions) {
+        std::vector<PitchedImage<float> > ref(2 * BENCHMARK_PYRAMID_LEVELS), out(2 * BENCHMARK_PYRAMID_LEVELS);
+        for (int level = 0; level < BENCHMARK_PYRAMID_LEVELS; level++) {
+                for (int p = 0; p < 2; p++) {
+                        ref[2*level + p].allocate(w >> level, h >> level);
+                        out[2*level + p].allocate(w >> level, h >> level);
+                }
+        }
+        for (int p = 0; p < 2; p++) {
+                const PitchedImage<float> &src = p == 0 ? gray : depth;
+                for (int y = 0; y < h; y++) {
+                        memcpy(ref[p].pixel(0, y), src.pixel(0, y), w * sizeof(float));
+                        memcpy(out[p].pixel(0, y), src.pixel(0, y), w * sizeof(float));
+                }
+                ref[p].replicate_border();
+                out[p].replicate_border();
+        }
+        std::vector<float> tmp(2 * image_size(w, h, false));
+        // imresize_CPU downscales odd sized levels from their even crop, as downsample2x
+        std::vector<PitchedImage<float> > crop(BENCHMARK_PYRAMID_LEVELS);
+        for (int level = 1; level < BENCHMARK_PYRAMID_LEVELS; level++)
+                crop[level].allocate(2 * (w >> level), 2 * (h >> level));
+
+        PyramidDownscaling variants[] = {
+                { CPU_ISA_GENERIC, isa_generic::downsample2x_gray_CPU<int, int, int>, isa_generic::downsample2x_depth_CPU<int, int, int> },
+#ifdef CPU_ISA_DISPATCH
+                { CPU_ISA_SSE42, isa_sse42::downsample2x_gray_CPU<int, int, int>, isa_sse42::downsample2x_depth_CPU<int, int, int> },
+                { CPU_ISA_AVX2, isa_avx2::downsample2x_gray_CPU<int, int, int>, isa_avx2::downsample2x_depth_CPU<int, int, int> },
+                { CPU_ISA_AVX512, isa_avx512::downsample2x_gray_CPU<int, int, int>, isa_avx512::downsample2x_depth_CPU<int, int, int> },
+#endif
+        };
+
+        std::cout << "levels 1 to " << BENCHMARK_PYRAMID_LEVELS - 1 << " of " << w << "x" << h << ", gray and depth" << std::endl;
+        std::cout << std::left << std::setw(24) << "downscaling" << std::right << std::setw(14) << "ms/pyramid"
+                  << std::setw(16) << "gray diff" << std::setw(16) << "depth diff" << std::endl;
+        for (int v = -1; v < (int)(sizeof(variants) / sizeof(variants[0])); v++) {
+                if (v >= 0 && !cpu_isa_supported(variants[v].isa)) continue;
+                std::vector<PitchedImage<float> > &levels = v < 0 ? ref : out;
+                WallTimer timer;
+                // the first pass warms up the caches and the OpenMP threads
+                for (int r = 0; r <= repetitions; r++) {
+                        if (r == 1) timer.start();
+                        for (int level = 1; level < BENCHMARK_PYRAMID_LEVELS; level++) {
+                                const int lw = w >> level, lh = h >> level, src_w = w >> (level - 1);
+                                const PitchedImage<float> *src_gray = &levels[2*(level-1)], *src_depth = &levels[2*(level-1) + 1];
+                                float *dst_gray = levels[2*level].data, *dst_depth = levels[2*level + 1].data;
+                                if (v < 0) {
+                                        for (int p = 0; p < 2; p++) {
+                                                const PitchedImage<float> *src = p == 0 ? src_gray : src_depth;
+                                                if (src->width != 2*lw || src->height != 2*lh) {
+                                                        for (int y = 0; y < 2*lh; y++)
+                                                                memcpy(crop[level].pixel(0, y), src->pixel(0, y), 2*lw * sizeof(float));
+                                                        src = &crop[level];
+                                                }
+                                                imresize_CPU(src->data, p == 0 ? dst_gray : dst_depth, tmp.data(), 2*lw, 2*lh, lw, lh, 1, p == 1);
+                                        }
+                                } else {
+                                        variants[v].gray(src_gray->data, dst_gray, tmp.data(), src_w, lw, lh);
+                                        variants[v].depth(src_depth->data, dst_depth, src_w, lw, lh);
+                                }
+                                levels[2*level].replicate_border();
+                                levels[2*level + 1].replicate_border();
+                        }
+                }
+                timer.end();
+
+                // largest difference to imresize_CPU over all the levels
+                float diff[2] = { 0.0f, 0.0f };
+                for (int level = 1; level < BENCHMARK_PYRAMID_LEVELS && v >= 0; level++)
+                        for (int p = 0; p < 2; p++)
+                                for (int y = 0; y < (h >> level); y++)
+                                        for (int x = 0; x < (w >> level); x++)
+                                                diff[p] = std::max(diff[p], std::abs(*out[2*level + p].pixel(x, y) - *ref[2*level + p].pixel(x, y)));
+                std::string name = v < 0 ? "imresize_CPU" : std::string("downsample2x ") + cpu_isa_name(variants[v].isa);
+                std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(3)
+                          << std::setw(14) << 1000 * timer.get() / repetitions << std::scientific
+                          << std::setw(16) << diff[0] << std::setw(16) << diff[1] << std::endl;
+        }
+        for (size_t i = 0; i < ref.size(); i++) {
+                ref[i].release();
+                out[i].release();
+        }
+        for (size_t i = 0; i < crop.size(); i++)
+                crop[i].release();
+}
+
+/**
+ * Builds the gray and depth levels of a pyramid (without derivatives) with
+ * imresize_CPU and with the downsample2x functions of every supported variant,
+ * for the frame and for a crop with odd sized levels, see the file description.
+ */
+void benchmark_pyramid(const PitchedImage<float> &gray, const PitchedImage<float> &depth, int repetitions) {
+        benchmark_pyramid_size(gray, depth, gray.width, gray.height, repetitions);
+        std::cout << std::endl;
+        benchmark_pyramid_size(gray, depth, std::min(gray.width, BENCHMARK_PYRAMID_ODD_WIDTH),
+                               std::min(gray.height, BENCHMARK_PYRAMID_ODD_HEIGHT), repetitions);
+}
+
+//_______________________________________________________
+//_______________________________________________________
+//________ PYRAMID SCALES
+//_______________________________________________________
+//_______________________________________________________
+
+/**
+ * Tracks the dataset with pyramids of every scale of BENCHMARK_SCALES, see
+ * the file description.
+ */
+void benchmark_scales(const Dataset &dataset, int repetitions) {
+        // every frame, tight as the tracker takes them
+        const size_t n_frames = dataset.frames.size();
+        std::vector< std::vector<float> > gray(n_frames), depth(n_frames);
+        int w = 0, h = 0;
+        for (size_t f = 0; f < n_frames; f++) {
+                cv::Mat mGray = loadIntensity(dataset.frames[f].colorPath);
+                cv::Mat mDepth = loadDepth(dataset.frames[f].depthPath);
+                w = mGray.cols;
+                h = mGray.rows;
+                gray[f].resize((size_t)w*h);
+                depth[f].resize((size_t)w*h);
+                convert_mat_to_layered(gray[f].data(), mGray);
+                convert_mat_to_layered(depth[f].data(), mDepth);
+        }
+        std::vector<Matrix4f> groundtruth(n_frames);
+        for (size_t f = 0; f < n_frames; f++)
+                groundtruth[f] = lieExp(dataset.frames[f].groundtruthXi);
+
+        // the coarsest level of every pyramid is no smaller than that of the usual one
+        const int min_size = std::min(w, h) >> (BENCHMARK_PYRAMID_LEVELS - 1);
+        const float scales[] = { BENCHMARK_SCALES };
+        const CpuIsa isa = cpu_isa_best();
+        std::cout << n_frames << " frames, isa " << cpu_isa_name(isa) << ", coarsest level at least " << min_size << " pixels" << std::endl;
+        std::cout << std::left << std::setw(8) << "scale" << std::right << std::setw(8) << "levels" << std::setw(12) << "coarsest"
+                  << std::setw(12) << "ms/frame" << std::setw(14) << "iters/frame"
+                  << std::setw(14) << "RPE mm" << std::setw(14) << "RPE deg" << std::endl;
+        for (size_t i = 0; i < sizeof(scales) / sizeof(scales[0]); i++) {
+                const float scale = scales[i];
+                const int levels = pyramid_levels(w, h, scale, min_size);
+                std::vector<Matrix4f> poses(n_frames, Matrix4f::Identity());
+                double seconds = 0.0;
+                int iterations = 0;
+                for (int r = 0; r < repetitions; r++) {
+                        TrackerBase *tracker = createTrackerCPU(isa, gray[0].data(), depth[0].data(), w, h, dataset.K, 0, levels - 1,
+                                                                TDIST, 20, GAUSS_NEWTON, FORWARD_COMPOSITIONAL, ACCUMULATE_FLOAT,
+                                                                1.0f, false, false, false, false, scale);
+                        for (size_t f = 1; f < n_frames; f++) {
+                                WallTimer timer; timer.start();
+                                Vector6f xi = tracker->align(gray[f].data(), depth[f].data());
+                                timer.end();
+                                seconds += timer.get();
+                                poses[f] = lieExp(xi);
+                                for (size_t level = 0; level < tracker->getIterations().size(); level++)
+                                        iterations += tracker->getIterations()[level];
+                        }
+                        delete tracker;
+                }
+
+                // relative pose error between consecutive frames against the groundtruth, root mean square
+                double trans = 0.0, rot = 0.0;
+                for (size_t f = 1; f < n_frames; f++) {
+                        Matrix4f E = (groundtruth[f-1].inverse() * groundtruth[f]).inverse() * (poses[f-1].inverse() * poses[f]);
+                        float cos_angle = std::min(1.0f, std::max(-1.0f, 0.5f * (E.topLeftCorner<3, 3>().trace() - 1.0f)));
+                        trans += E.topRightCorner<3, 1>().squaredNorm();
+                        rot += std::pow(std::acos(cos_angle) * 180.0 / M_PI, 2);
+                }
+                const size_t aligned = std::max<size_t>(n_frames - 1, 1);
+                std::ostringstream coarsest;
+                coarsest << pyramid_level_size(w, scale, levels - 1) << "x" << pyramid_level_size(h, scale, levels - 1);
+                std::cout << std::left << std::setw(8) << std::fixed << std::setprecision(4) << scale << std::right
+                          << std::setw(8) << levels << std::setw(12) << coarsest.str() << std::setprecision(3)
+                          << std::setw(12) << 1000 * seconds / (repetitions * aligned)
+                          << std::setw(14) << (float)iterations / (repetitions * aligned)
+                          << std::setw(14) << 1000 * std::sqrt(trans / aligned)
+                          << std::setw(14) << std::sqrt(rot / aligned) << std::endl;
+        }
+}
+
+//_______________________________________________________
+//_______________________________________________________
+//________ THREADS
+//_______________________________________________________
+//_______________________________________________________
+
+// numbers of threads compared by benchmark_threads, at least: on fewer processors they take turns
+#define BENCHMARK_MAX_THREADS 8
+
+/**
+ * Tracks the dataset with 1 to BENCHMARK_MAX_THREADS threads, see the file description.
+ * @return True if the poses do not depend on the number of threads
+ */
+bool benchmark_threads(const Dataset &dataset) {
+        // every frame, tight as the tracker takes them
+        const size_t n_frames = dataset.frames.size();
+        std::vector< std::vector<float> > gray(n_frames), depth(n_frames);
+        int w = 0, h = 0;
+        for (size_t f = 0; f < n_frames; f++) {
+                cv::Mat mGray = loadIntensity(dataset.frames[f].colorPath);
+                cv::Mat mDepth = loadDepth(dataset.frames[f].depthPath);
+                w = mGray.cols;
+                h = mGray.rows;
+                gray[f].resize((size_t)w*h);
+                depth[f].resize((size_t)w*h);
+                convert_mat_to_layered(gray[f].data(), mGray);
+                convert_mat_to_layered(depth[f].data(), mDepth);
+        }
+
+        struct Mode { const char *name; SolvingMethod solver; AlignmentMode alignment; };
+        const Mode modes[] = {
+                { "forward", GAUSS_NEWTON, FORWARD_COMPOSITIONAL },
+                { "inverse", GAUSS_NEWTON, INVERSE_COMPOSITIONAL },
+                { "ESM",     ESM,          FORWARD_COMPOSITIONAL },
+        };
+        const char *accumulators[] = { "float", "double", "Kahan" };
+        const int max_threads = std::max(BENCHMARK_MAX_THREADS, omp_get_num_procs());
+        const int default_threads = omp_get_max_threads();
+        const CpuIsa isa = cpu_isa_best();
+        std::cout << n_frames << " frames, isa " << cpu_isa_name(isa) << ", " << omp_get_num_procs() << " processors" << std::endl;
+        std::cout << std::left << std::setw(10) << "mode" << std::setw(13) << "accumulator" << std::right << std::setw(9) << "threads"
+                  << std::setw(12) << "ms/frame" << std::setw(12) << "poses" << std::endl;
+        bool identical = true;
+        for (const Mode &mode : modes) {
+                for (int a = 0; a < 3; a++) {
+                        std::vector<Vector6f> poses_single;
+                        for (int threads = 1; threads <= max_threads; threads++) {
+                                omp_set_num_threads(threads);
+                                TrackerBase *tracker = createTrackerCPU(isa, gray[0].data(), depth[0].data(), w, h, dataset.K, 0, 4,
+                                                                        TDIST, 20, mode.solver, mode.alignment, (Accumulator)a);
+                                std::vector<Vector6f> poses;
+                                WallTimer timer; timer.start();
+                                for (size_t f = 1; f < n_frames; f++)
+                                        poses.push_back(tracker->align(gray[f].data(), depth[f].data()));
+                                timer.end();
+                                delete tracker;
+
+                                // bit by bit, not up to rounding
+                                if (threads == 1) poses_single = poses;
+                                bool same = true;
+                                for (size_t f = 0; f < poses.size(); f++)
+                                        same = same && memcmp(poses[f].data(), poses_single[f].data(), sizeof(Vector6f)) == 0;
+                                identical = identical && same;
+                                std::cout << std::left << std::setw(10) << mode.name << std::setw(13) << accumulators[a] << std::right
+                                          << std::setw(9) << threads << std::fixed << std::setprecision(3)
+                                          << std::setw(12) << 1000 * timer.get() / std::max<size_t>(n_frames - 1, 1)
+                                          << std::setw(12) << (same ? "identical" : "MISMATCH") << std::endl;
+                        }
+                }
+        }
+        omp_set_num_threads(default_threads);
+        return identical;
+}
+
+//_______________________________________________________
+//_______________________________________________________
+//________ MAIN
+//_______________________________________________________
+//_______________________________________________________
+
+int main(int argc, char *argv[]) {
+        if (argc < 2 || argv[1][0] == '-') {
+                std::cout << "Usage: " << argv[0] << " layout|gradients|isa|pyramid|scales|threads [-path ../data/mypath_to_dataset] [-repetitions N]" << std::endl;
+                return 1;
+        }
+        std::string benchmark = argv[1];
+
+        // e.g. "-path ../data/mypath_to_dataset"
+        std::string path = "../data/freiburg1_xyz_first_10";
+        getParam("path", path, argc, argv);
+        // passes per configuration
+        int repetitions = 10;
+        getParam("repetitions", repetitions, argc, argv);
+        repetitions = std::max(1, repetitions);
+
+        Dataset dataset(path);
+        cv::Mat mGray = loadIntensity(dataset.frames[0].colorPath);
+        cv::Mat mDepth = loadDepth(dataset.frames[0].depthPath);
+        int w = mGray.cols;
+        int h = mGray.rows;
+        std::vector<float> gray_tight((size_t)w*h), depth_tight((size_t)w*h);
+        convert_mat_to_layered(gray_tight.data(), mGray);
+        convert_mat_to_layered(depth_tight.data(), mDepth);
+        // the CPU backend works on pitched images, see image.hpp
+        PitchedImage<float> gray, depth;
+        gray.allocate(w, h);
+        depth.allocate(w, h);
+        for (int y = 0; y < h; y++) {
+                memcpy(gray.pixel(0, y), &gray_tight[y*w], w*sizeof(float));
+                memcpy(depth.pixel(0, y), &depth_tight[y*w], w*sizeof(float));
+        }
+        gray.replicate_border();
+        depth.replicate_border();
+        std::cout << "Dataset " << path << ", " << w << "x" << h << ", " << repetitions << " repetitions\n" << std::endl;
+
+        if (benchmark == "layout") {
+                benchmark_layout(gray, depth, dataset.K, repetitions);
+        } else if (benchmark == "gradients") {
+                benchmark_gradients(gray, depth, dataset.K, repetitions);
+        } else if (benchmark == "isa") {
+                benchmark_isa(dataset, repetitions);
+        } else if (benchmark == "pyramid") {
+                benchmark_pyramid(gray, depth, repetitions);
+        } else if (benchmark == "scales") {
+                benchmark_scales(dataset, repetitions);
+        } else if (benchmark == "threads") {
+                if (!benchmark_threads(dataset)) {
+                        std::cout << "\nThe poses depend on the number of threads" << std::endl;
+                        gray.release();
+                        depth.release();
+                        return 1;
+                }
+        } else {
+                std::cout << "Unknown benchmark " << benchmark << std::endl;
+                return 1;
+        }
+        gray.release();
+        depth.release();
+        return 0;
+}
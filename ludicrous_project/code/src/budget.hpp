@@ -0,0 +1,149 @@
+/**
+ * \file
+ * \brief   Time budget per frame for the alignment, shared by the CUDA and the
+ *          CPU tracker.
+ *
+ *          The cost of an iteration at each pyramid level is measured on the
+ *          fly, and so is the cost of setting up a level before its first
+ *          iteration (building its images on demand, back-projecting the
+ *          reference points, the reference Jacobian of the inverse
+ *          compositional mode). A level is only set up if its setup and one
+ *          iteration fit in what is left of the budget of the frame, and an
+ *          iteration is only started if its estimated cost fits, so the
+ *          latency of align stays within the budget as long as nothing takes
+ *          longer than its estimate. The estimate is the maximum of the
+ *          measured costs, decaying from frame to frame, so a slow iteration
+ *          is remembered for a while but cannot block a level for good.
+ *
+ *          The iterations are shared across levels coarse to fine: at the
+ *          start of a frame, plan picks the finest level that can still get
+ *          BUDGET_MIN_ITERATIONS at every level, and finer levels are dropped.
+ *          Coarser levels then iterate while they leave enough time for
+ *          BUDGET_MIN_ITERATIONS at each of the remaining finer levels.
+ *
+ *          A level without a measurement yet is estimated from the measured
+ *          level nearest to it, preferably a coarser one, scaled by its
+ *          number of pixels. Only the first level ever aligned with a budget,
+ *          the coarsest one, has nothing to be estimated from. The conversion
+ *          of the new frame into the bottom of its pyramid, before any level,
+ *          counts against the budget but is not predicted.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+// iterations reserved for every finer level when iterating at a coarser one
+#define BUDGET_MIN_ITERATIONS 2
+// per frame decay of the cost estimates towards newer (cheaper) measurements
+#define BUDGET_COST_DECAY 0.9f
+
+class TimeBudget {
+
+public:
+
+TimeBudget() : budget(0), finest(0) {}
+
+/**
+ * Sets the budget of every following frame.
+ * @param microseconds  Budget per frame. 0 for no budget.
+ */
+void set(int microseconds) { budget = std::max(microseconds, 0); }
+
+bool enabled() const { return budget > 0; }
+
+/**
+ * Starts the clock of a new frame.
+ * @param level_pixels  Number of pixels of every pyramid level, to estimate the levels not measured yet.
+ */
+void start_frame(const std::vector<int> &level_pixels) {
+        pixels = level_pixels;
+        cost.resize(pixels.size(), 0.0f);
+        setup.resize(pixels.size(), 0.0f);
+        for (size_t l = 0; l < pixels.size(); l++) {
+                cost[l] *= BUDGET_COST_DECAY;
+                setup[l] *= BUDGET_COST_DECAY;
+        }
+        frame_start = std::chrono::steady_clock::now();
+}
+
+/**
+ * Chooses the finest level to align in this frame, see above.
+ * @return  Finest level, not below minLevel. maxLevel+1 if not even one level fits.
+ */
+int plan(int minLevel, int maxLevel) {
+        float left = budget - elapsed(frame_start);
+        finest = maxLevel + 1;
+        for (int level = maxLevel; level >= minLevel; level--) {
+                left -= estimate(setup, level) + BUDGET_MIN_ITERATIONS * estimate(cost, level);
+                if (left < 0) break;
+                finest = level;
+        }
+        return finest;
+}
+
+/**
+ * Whether the setup of level and its first iteration fit in what is left of the frame budget.
+ * Checked before the level is touched.
+ */
+bool fits_setup(int level) const {
+        return elapsed(frame_start) + estimate(setup, level) + estimate(cost, level) <= budget;
+}
+
+/**
+ * Whether an iteration at level fits in what is left of the frame budget.
+ * @param reserve  Keep the setup and BUDGET_MIN_ITERATIONS for each level finer than level, down to the planned one.
+ */
+bool fits(int level, bool reserve) const {
+        float needed = estimate(cost, level);
+        if (reserve)
+                for (int l = finest; l < level; l++) needed += estimate(setup, l) + BUDGET_MIN_ITERATIONS * estimate(cost, l);
+        return elapsed(frame_start) + needed <= budget;
+}
+
+void start_setup() { setup_start = std::chrono::steady_clock::now(); }
+
+void end_setup(int level) {
+        setup[level] = std::max(elapsed(setup_start), setup[level]);
+}
+
+void start_iteration() { iteration_start = std::chrono::steady_clock::now(); }
+
+void end_iteration(int level) {
+        cost[level] = std::max(elapsed(iteration_start), cost[level]);
+}
+
+private:
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+int budget;   // microseconds per frame
+std::vector<float> cost;   // estimated microseconds per iteration at each level, 0 if not measured yet
+std::vector<float> setup;   // estimated microseconds of the setup of each level, 0 if not measured yet
+std::vector<int> pixels;   // pixels of each level
+int finest;   // finest level of the current frame, see plan
+TimePoint frame_start;
+TimePoint setup_start;
+TimePoint iteration_start;
+
+// measured cost of level, or else that of the nearest measured level scaled to the pixels of level.
+// Coarser levels are preferred: their overhead per pixel is higher, so the estimate errs on the safe side
+float estimate(const std::vector<float> &measured, int level) const {
+        if (measured[level] > 0.0f) return measured[level];
+        for (size_t l = level + 1; l < measured.size(); l++)
+                if (measured[l] > 0.0f) return measured[l] / pixels[l] * pixels[level];
+        for (int l = level - 1; l >= 0; l--)
+                if (measured[l] > 0.0f) return measured[l] / pixels[l] * pixels[level];
+        return 0.0f;
+}
+
+// microseconds since t
+static float elapsed(const TimePoint &t) {
+        return std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - t).count();
+}
+
+};
@@ -1,12 +1,21 @@
 /**
  * \file
  * \brief   Global declarations.
+ *
+ * Define CPU_ONLY to build without the CUDA toolkit. Only the CPU backend
+ * (TrackerCPU) is available then. Define GRADIENTS_ON_THE_FLY to compute the
+ * image derivatives where they are read instead of storing them, see below.
  */
 
 #pragma once
 
 #include <Eigen/Dense>
+#include <stdint.h>
+#include <vector>
+#include "budget.hpp"
+#ifndef CPU_ONLY
 #include <cuda_runtime.h>
+#endif
 
 using namespace Eigen;
 
@@ -14,21 +23,111 @@ typedef Matrix<float,6,1> Vector6f;
 typedef Matrix<float,6,6> Matrix6f;
 
 // global variables
-const int MAX_LEVELS = 7;   // TODO: potential bug for more levels
+// Most pyramid levels, the capacity of const_K_pyr. main also limits the levels to the image
+// size. The sizes of the levels are in PyramidGeometry, see pyramid.hpp
+const int MAX_LEVELS = 7;
 
+const int BORDER_ZERO = 1;
+const int BORDER_REPLICATE = 2;
+
+// ESM (efficient second-order minimization) takes Gauss-Newton steps with the
+// mean of the gradients of both frames in the Jacobian. It is always forward
+// compositional, since the Jacobian depends on the current warp.
+enum SolvingMethod { GAUSS_NEWTON, LEVENBERG_MARQUARDT, GRADIENT_DESCENT, ESM };
+
+// FORWARD_COMPOSITIONAL linearizes the warped second frame at every iteration.
+// INVERSE_COMPOSITIONAL linearizes the first frame once per level and applies
+// the inverse of the increment to the pose.
+enum AlignmentMode { FORWARD_COMPOSITIONAL, INVERSE_COMPOSITIONAL };
+
+// Compile with -DGRADIENTS_ON_THE_FLY to compute the derivatives of the gray images
+// where they are read (central differences, see central_differences) instead of
+// storing them in every pyramid level. Saves the two derivative planes (and their
+// half precision copies) per level and their computation in every pyramid build,
+// for a few more reads of the gray image per lookup. The texels of the
+// interleaved mode still carry the derivatives, and the fixed point mode never
+// stores them.
+#ifdef GRADIENTS_ON_THE_FLY
+const bool g_storeGradients = false;
+#else
+const bool g_storeGradients = true;
+#endif
+
+// Scales of the decoded frames of the dataset to the float images of the trackers (see loadIntensity
+// and loadDepth): 8 bit gray levels to [0, 1], and 16 bit depth to meters (5000 per meter in the TUM
+// RGB-D benchmark)
+const float GRAY_SCALE = 1.0f / 255.0f;
+const float DEPTH_SCALE = 1.0f / 5000.0f;
+
+/**
+ * A frame as decoded, before its conversion to floats: rows of 8 bit gray and
+ * 16 bit depth values, see GRAY_SCALE and DEPTH_SCALE. Steps are in bytes.
+ */
+struct RawFrame {
+        const uint8_t *gray;
+        const uint16_t *depth;
+        int width;
+        int height;
+        size_t grayStep;
+        size_t depthStep;
+
+        const uint8_t *grayRow(int y) const { return gray + y * grayStep; }
+        const uint16_t *depthRow(int y) const { return (const uint16_t *)((const uint8_t *)depth + y * depthStep); }
+};
+
+/**
+ * Interface shared by the CUDA tracker and the CPU tracker, so that the backend
+ * can be chosen at run time.
+ */
+class TrackerBase {
+public:
+        virtual ~TrackerBase() {}
+        virtual Vector6f align(float *grayCur, float *depthCur) = 0;
+        // align of a frame as decoded. By default converted to floats first, the CPU tracker
+        // converts it while building the pyramid, see ingest_CPU
+        virtual Vector6f alignRaw(const RawFrame &frame) {
+                rawGray.resize((size_t)frame.width * frame.height);
+                rawDepth.resize((size_t)frame.width * frame.height);
+                for (int y = 0; y < frame.height; y++) {
+                        const uint8_t *gray = frame.grayRow(y);
+                        const uint16_t *depth = frame.depthRow(y);
+                        for (int x = 0; x < frame.width; x++) {
+                                rawGray[x + (size_t)y * frame.width] = gray[x] * GRAY_SCALE;
+                                rawDepth[x + (size_t)y * frame.width] = depth[x] * DEPTH_SCALE;
+                        }
+                }
+                return align(rawGray.data(), rawDepth.data());
+        }
+        // iterations run at each pyramid level by the last call to align, indexed by level
+        const std::vector<int>& getIterations() const { return iterations; }
+        // pixels aligned at each pyramid level by the last call to align: the pixels to align of the first
+        // frame with depth, compacted when it became the first frame. 0 for the levels left out
+        const std::vector<int>& getValidPixels() const { return validPixels; }
+        // time budget of each call to align in microseconds, 0 for none. See budget.hpp
+        void setTimeBudget(int microseconds) { budget.set(microseconds); }
+protected:
+        std::vector<int> iterations;
+        std::vector<int> validPixels;
+        TimeBudget budget;
+        std::vector<float> rawGray, rawDepth;   // frame converted by alignRaw
+};
+
+#ifndef CPU_ONLY
 // CUDA related
 int devID;
 cudaDeviceProp props;
 int g_CUDA_maxSharedMemSize;
 const int g_CUDA_blockSize2DX = 16;
 const int g_CUDA_blockSize2DY = 16;
-const int BORDER_ZERO = 1;
-const int BORDER_REPLICATE = 2;
 
 // tracker uses these global variables, so it has to be included after them
 __constant__ float const_K_pyr[9*MAX_LEVELS];     // Allocates constant memory in excess for K and K downscaled. Stored column-wise and matrix after matrix
-__constant__ float const_RK_inv[9];     // Allocates space for the concatenation of a rotation and an intrinsic matrix. Stored column-wise
+__constant__ float const_R[9];     // Allocates space for a rotation matrix. Stored column-wise
 __constant__ float const_translation[3];     // Allocates space for a translation vector
+// Largest radius of the Gaussian filters of preprocessing.cuh (imresize_CUDA downscales by up to about 1/10 with it)
+const int MAX_GAUSS_RADIUS = 16;
+__constant__ float const_gauss[2*MAX_GAUSS_RADIUS+1];     // Taps of the current Gaussian, see upload_gaussian_CUDA
 texture <float, 2, cudaReadModeElementType> texRef_grayImg;
 texture <float, 2, cudaReadModeElementType> texRef_gray_dx;
 texture <float, 2, cudaReadModeElementType> texRef_gray_dy;
+#endif
@@ -122,8 +122,8 @@ public:
       double tDepth = depthRows[l].timestamp;
       double tGround = groundtruthRows[m].timestamp;
 
-      double tMin = min(tGround, min(tRGB, tDepth));
-      double tMax = max(tGround, max(tRGB, tDepth));
+      double tMin = std::min(tGround, std::min(tRGB, tDepth));
+      double tMax = std::max(tGround, std::max(tRGB, tDepth));
 
       // Create a frame if all three entries are new
       if (tMax == tMaxLastPushed) { frames.pop_back(); }
@@ -0,0 +1,99 @@
+/**
+ * \file
+ * \brief   IEEE 754 half precision (binary16) storage on the host.
+ *
+ *          Values are stored as half_t and converted to float on load, all
+ *          arithmetic stays in float. With F16C (e.g. -march=native on any
+ *          recent x86) the conversions are single instructions, otherwise
+ *          they are done in software, rounding to nearest even like F16C.
+ *
+ *          Half has an 11 bit significand: gray values in [0, 1] keep an
+ *          absolute error below 2^-12, about 1/16 of a gray level of the
+ *          8 bit input, and the derivatives a relative error below 2^-11.
+ *
+ *          Compiled once per instruction set, see isa.hpp: the F16C
+ *          conversions are used by the variants that have them.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#ifndef HALF_HPP
+#define HALF_HPP
+
+#include <stdint.h>
+#include <cstring>
+#include "isa.hpp"
+
+namespace CPU_ISA_NAMESPACE {
+
+typedef uint16_t half_t;
+
+/**
+ * Converts a float to the nearest half (ties to even). Overflows to infinity.
+ */
+inline half_t h_float_to_half( float f ) {
+#if CPU_HAS_F16C
+        return _cvtss_sh(f, 0);
+#else
+        uint32_t x;
+        memcpy(&x, &f, sizeof(float));
+        const uint32_t sign = (x >> 16) & 0x8000;
+        const uint32_t exp_bits = (x >> 23) & 0xff;
+        uint32_t mant = x & 0x7fffff;
+        const int exp = (int)exp_bits - 127 + 15;
+
+        // infinity and NaN (kept quiet)
+        if (exp_bits == 0xff) return sign | 0x7c00 | (mant ? 0x200 | (mant >> 13) : 0);
+        // too large: infinity
+        if (exp >= 0x1f) return sign | 0x7c00;
+        // too small for a normal half: subnormal or 0
+        if (exp <= 0) {
+                if (exp < -10) return sign;
+                mant |= 0x800000;
+                const int shift = 14 - exp;
+                uint32_t h = mant >> shift;
+                const uint32_t rest = mant & ((1u << shift) - 1);
+                const uint32_t halfway = 1u << (shift - 1);
+                if (rest > halfway || (rest == halfway && (h & 1))) h++;
+                return sign | h;
+        }
+        // normal. Rounding up may carry into the exponent, up to infinity
+        uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+        const uint32_t rest = mant & 0x1fff;
+        if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+        return sign | h;
+#endif
+}
+
+/**
+ * Converts a half to float, exactly.
+ */
+inline float h_half_to_float( half_t h ) {
+#if CPU_HAS_F16C
+        return _cvtsh_ss(h);
+#else
+        const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+        uint32_t exp = (h >> 10) & 0x1f;
+        uint32_t mant = h & 0x3ff;
+        uint32_t x;
+        if (exp == 0x1f) {
+                x = sign | 0x7f800000 | (mant ? 0x400000 | (mant << 13) : 0);   // infinity and NaN (kept quiet)
+        } else if (exp != 0) {
+                x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+        } else if (mant == 0) {
+                x = sign;   // signed 0
+        } else {
+                // subnormal half, normal float
+                exp = 127 - 15 + 1;
+                while (!(mant & 0x400)) { mant <<= 1; exp--; }
+                x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+        float f;
+        memcpy(&f, &x, sizeof(float));
+        return f;
+#endif
+}
+
+}   // namespace CPU_ISA_NAMESPACE
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * \file
+ * \brief   Helpers of the CPU backend, next to helper.h, which stays as it was
+ *          handed out. Including:
+ * 				* the declarations of helper.h for the builds without the CUDA
+ * 				  toolkit (CPU_ONLY), implemented by helper_cpu.cpp
+ * 				* a wall clock timer: the Timer of helper.h measures with
+ * 				  clock(), which adds up the time of all threads of the CPU
+ * 				  backend
+ *
+ *          Included instead of helper.h by the sources that also build
+ *          without CUDA; with CUDA it includes helper.h.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#ifndef HELPER_CPU_H
+#define HELPER_CPU_H
+
+#include <chrono>
+
+#ifndef CPU_ONLY
+#include "helper.h"
+#else
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <string>
+#include <cstring>
+#include <sstream>
+
+// parameter processing, as in helper.h
+template<typename T>
+bool getParam(std::string param, T &var, int argc, char **argv)
+{
+    const char *c_param = param.c_str();
+    for(int i=argc-1; i>=1; i--)
+    {
+        if (argv[i][0]!='-') continue;
+        if (strcmp(argv[i]+1, c_param)==0)
+        {
+            if (!(i+1<argc)) continue;
+            std::stringstream ss;
+            ss << argv[i+1];
+            ss >> var;
+            return (bool)ss;
+        }
+    }
+    return false;
+}
+template<>
+bool getParam<bool>(std::string param, bool &var, int argc, char **argv);
+
+// opencv helpers, as in helper.h
+void convert_mat_to_layered(float *aOut, const cv::Mat &mIn);
+void convert_layered_to_mat(cv::Mat &mOut, const float *aIn);
+void showImage(std::string title, const cv::Mat &mat, int x, int y);
+void showHistogram256(const char *windowTitle, int *histogram, int windowX, int windowY);
+
+// adding Gaussian noise, as in helper.h
+void addNoise(cv::Mat &m, float sigma);
+#endif
+
+/**
+ * Wall clock counterpart of the Timer of helper.h, with the same interface.
+ * Waits for the GPU too when built with CUDA.
+ */
+class WallTimer
+{
+    public:
+	WallTimer() : running(false), sec(0.f)
+	{
+	}
+	void start()
+	{
+		tStart = std::chrono::steady_clock::now();
+		running = true;
+	}
+	void end()
+	{
+		if (!running) { sec = 0; return; }
+#ifndef CPU_ONLY
+        cudaDeviceSynchronize();
+#endif
+		std::chrono::steady_clock::time_point tEnd = std::chrono::steady_clock::now();
+		sec = std::chrono::duration<float>(tEnd - tStart).count();
+		running = false;
+	}
+	float get()
+	{
+		if (running) end();
+		return sec;
+	}
+    private:
+	std::chrono::steady_clock::time_point tStart;
+	bool running;
+	float sec;
+};
+
+#endif  // HELPER_CPU_H
@@ -0,0 +1,168 @@
+/**
+ * \file
+ * \brief   Pitched host images with a replicated guard band, the storage of
+ *          every image of the CPU pyramids.
+ *
+ *          Rows are padded to a pitch of a multiple of IMAGE_PITCH_PIXELS
+ *          pixels and the allocation is aligned to IMAGE_ALIGNMENT bytes, so
+ *          every row starts on a cache line (and on a vector of any width up
+ *          to AVX-512) for pixels of 2 bytes or more, whatever the width of
+ *          the level.
+ *
+ *          Around the image, IMAGE_GUARD pixels on every side replicate the
+ *          nearest border pixel, which is what clamp addressing returns there.
+ *          Kernels that read at most IMAGE_GUARD pixels past the border (the
+ *          bilinear lookups, the centered derivatives) index the image with
+ *          negative or too large coordinates directly, without bounds checks.
+ *          The guard band has to be filled again (replicate_border) after
+ *          every write to the image.
+ *
+ *          All the images of a given width have the same pitch, so a pixel
+ *          index is valid for all the images of a pyramid level.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <algorithm>
+
+// Alignment of the allocations and of every row, in bytes
+#define IMAGE_ALIGNMENT 64
+// Row pitches are a multiple of this many pixels: whole IMAGE_ALIGNMENT bytes
+// for 2 byte pixels (half, fixed point), and thus for any larger pixel
+#define IMAGE_PITCH_PIXELS 32
+// Replicated pixels on every side of an image. A bilinear lookup inside the
+// image reads 1 pixel past the border, a lookup of centered derivatives 2
+#define IMAGE_GUARD 2
+
+// The tiled layout stores square tiles of 1 << TILE_SHIFT pixels side
+#define TILE_SHIFT 3
+
+/**
+ * Pixels per row of a w pixels wide image in the row-major layout, guard band
+ * and padding included.
+ */
+constexpr int image_pitch( int w ) {
+        return (w + 2 * IMAGE_GUARD + IMAGE_PITCH_PIXELS - 1) & ~(IMAGE_PITCH_PIXELS - 1);
+}
+
+/**
+ * Tiles per row of a w pixels wide image in the tiled layout, including a
+ * column of guard tiles on each side.
+ */
+constexpr int image_tiles_per_row( int w ) {
+        return ((w + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT) + 2;
+}
+
+/**
+ * Index of the pixel (x, y) of a w pixels wide image, relative to the pixel
+ * (0, 0). Valid from -IMAGE_GUARD to w-1+IMAGE_GUARD (the same vertically).
+ * The row-major layout is pitched. The tiled layout stores the tiles in
+ * row-major order, and the pixels of each tile in row-major order too, so the
+ * texels around a point are close in memory whatever the direction in which
+ * the lookups move: a warp that rotates the image walks along the tiles
+ * instead of jumping a whole row per step. With 8 byte texels a row of a tile
+ * is one cache line. Its guard band is a ring of whole tiles (the shifts of
+ * negative coordinates are arithmetic).
+ */
+inline int texel_index( int x, int y, int w, bool tiled ) {
+        if (!tiled) return x + y * image_pitch(w);
+        const int mask = (1 << TILE_SHIFT) - 1;
+        const int tile = (y >> TILE_SHIFT) * image_tiles_per_row(w) + (x >> TILE_SHIFT);
+        return tile * (1 << (2 * TILE_SHIFT)) + ((y & mask) << TILE_SHIFT) + (x & mask);
+}
+
+/**
+ * Number of pixels of the storage of a w x h image, guard band and padding
+ * included.
+ */
+constexpr int image_size( int w, int h, bool tiled ) {
+        return !tiled ? (h + 2 * IMAGE_GUARD + 1) * image_pitch(w)
+                      : image_tiles_per_row(w) * (((h + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT) + 2) << (2 * TILE_SHIFT);
+}
+
+/**
+ * Position of the pixel (0, 0) in the storage of a w pixels wide image. A
+ * whole row (a whole tile) in front of it, so that it is aligned like the
+ * storage.
+ */
+constexpr int image_origin( int w, bool tiled ) {
+        return !tiled ? (IMAGE_GUARD + 1) * image_pitch(w) : (image_tiles_per_row(w) + 1) << (2 * TILE_SHIFT);
+}
+
+/**
+ * Image of channels interleaved values of type T per pixel, in the pitched
+ * row-major or in the tiled layout, with a replicated guard band. A plain
+ * handle like the pointers it replaces: copies share the storage, which is
+ * allocated and released explicitly.
+ */
+template<typename T>
+struct PitchedImage {
+        T *data;        // pixel (0, 0). NULL if not allocated
+        T *buffer;      // allocation. NULL if not allocated or attached
+        int width;
+        int height;
+        int channels;   // values per pixel
+        bool tiled;     // layout, see texel_index
+
+        PitchedImage() : data(NULL), buffer(NULL), width(0), height(0), channels(1), tiled(false) {}
+
+        /**
+         * Allocates the storage, zero initialized.
+         */
+        void allocate( int w, int h, int c = 1, bool t = false ) {
+                const size_t align = IMAGE_ALIGNMENT / sizeof(T);
+                T *storage = new T[(size_t)c * image_size(w, h, t) + align]();
+                const size_t offset = (align - ((uintptr_t)storage / sizeof(T)) % align) % align;
+                attach(storage + offset, w, h, c, t);
+                buffer = storage;
+        }
+
+        /**
+         * Uses count() values at storage, e.g. part of an arena holding several
+         * images, instead of allocating them. storage should be aligned to
+         * IMAGE_ALIGNMENT bytes. release then only detaches the image.
+         */
+        void attach( T *storage, int w, int h, int c = 1, bool t = false ) {
+                width = w;
+                height = h;
+                channels = c;
+                tiled = t;
+                buffer = NULL;
+                data = storage + (size_t)channels * image_origin(w, t);
+        }
+
+        void release() {
+                delete[] buffer;
+                buffer = NULL;
+                data = NULL;
+        }
+
+        /**
+         * Start of the storage (the first pixel of the guard band) and its
+         * number of values, to process an image as a whole.
+         */
+        T *begin() const { return data - (size_t)channels * image_origin(width, tiled); }
+        size_t count() const { return (size_t)channels * image_size(width, height, tiled); }
+
+        T *pixel( int x, int y ) const { return data + (size_t)channels * texel_index(x, y, width, tiled); }
+
+        /**
+         * Fills the guard band with the nearest pixel of the image.
+         */
+        void replicate_border() const {
+                for (int y = -IMAGE_GUARD; y < height + IMAGE_GUARD; y++) {
+                        const int ys = std::min(std::max(y, 0), height - 1);
+                        for (int x = -IMAGE_GUARD; x < width + IMAGE_GUARD; x++) {
+                                // rows of the image only have the left and right bands
+                                if (y == ys && x == 0) x = width;
+                                const T *src = pixel(std::min(std::max(x, 0), width - 1), ys);
+                                T *dst = pixel(x, y);
+                                for (int c = 0; c < channels; c++) dst[c] = src[c];
+                        }
+                }
+        }
+};
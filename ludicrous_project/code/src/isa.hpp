@@ -0,0 +1,106 @@
+/**
+ * \file
+ * \brief   Instruction sets of the CPU backend, picked at run time.
+ *
+ *          The CPU backend (tracker_cpu.hpp and its kernels in half.hpp,
+ *          preprocessing_cpu.hpp and alignment_cpu.hpp) is compiled once per
+ *          instruction set, in its own namespace: isa_generic for the baseline
+ *          of the build, visible from the global namespace, and isa_sse42,
+ *          isa_avx2 and isa_avx512 for the others, see
+ *          tracker_cpu_dispatch.hpp. cpu_isa_best picks the best one the CPU
+ *          supports, reading CPUID.
+ *
+ *          The variants are only compiled with GCC on x86, and not by nvcc:
+ *          otherwise (and in the CUDA executables) there is only the baseline.
+ *          Building with -march=native makes all of them native.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#pragma once
+
+#include <string>
+
+#if defined(__GNUC__) && !defined(__clang__) && !defined(__CUDACC__) && (defined(__x86_64__) || defined(__i386__))
+        #define CPU_ISA_DISPATCH
+        #include <cpuid.h>
+#endif
+
+// the intrinsics of every instruction set, which the variants use inside
+// their target regions
+#if defined(CPU_ISA_DISPATCH) || defined(__F16C__)
+        #include <immintrin.h>
+#endif
+
+// Namespace of the variant being compiled, and whether it has the F16C half
+// precision conversions (the target regions of the variants do not define
+// __F16C__). Both set by tracker_cpu_dispatch.hpp for each variant
+#ifndef CPU_ISA_NAMESPACE
+        #define CPU_ISA_NAMESPACE isa_generic
+#endif
+#ifndef CPU_HAS_F16C
+        #ifdef __F16C__
+                #define CPU_HAS_F16C 1
+        #else
+                #define CPU_HAS_F16C 0
+        #endif
+#endif
+
+// the baseline variant is the one used everywhere else
+namespace isa_generic {}
+using namespace isa_generic;
+
+enum CpuIsa { CPU_ISA_GENERIC, CPU_ISA_SSE42, CPU_ISA_AVX2, CPU_ISA_AVX512, CPU_ISA_COUNT };
+
+inline const char *cpu_isa_name( CpuIsa isa ) {
+        static const char *names[CPU_ISA_COUNT] = { "generic", "sse4.2", "avx2", "avx512" };
+        return names[isa];
+}
+
+/**
+ * Instruction set of a name of cpu_isa_name. CPU_ISA_COUNT if unknown.
+ */
+inline CpuIsa cpu_isa_from_name( const std::string &name ) {
+        for (int isa = 0; isa < CPU_ISA_COUNT; isa++)
+                if (name == cpu_isa_name((CpuIsa)isa)) return (CpuIsa)isa;
+        return CPU_ISA_COUNT;
+}
+
+/**
+ * Whether the variant of an instruction set is compiled and the CPU (and the
+ * OS, for the AVX registers) supports it.
+ * SSE4.2: SSE4.2 and POPCNT (Nehalem)
+ * AVX2:   AVX2, FMA, F16C and BMI2 (Haswell)
+ * AVX512: AVX512F, BW, DQ and VL besides AVX2 (Skylake-SP)
+ */
+inline bool cpu_isa_supported( CpuIsa isa ) {
+        if (isa == CPU_ISA_GENERIC) return true;
+#ifdef CPU_ISA_DISPATCH
+        __builtin_cpu_init();
+        unsigned int eax, ebx, ecx, edx;
+        // F16C is not one of the features of __builtin_cpu_supports in older GCC
+        const bool f16c = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C);
+        const bool sse42 = __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+        const bool avx2 = sse42 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+                          && __builtin_cpu_supports("bmi2") && f16c;
+        const bool avx512 = avx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+                            && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+        switch (isa) {
+        case CPU_ISA_SSE42:  return sse42;
+        case CPU_ISA_AVX2:   return avx2;
+        case CPU_ISA_AVX512: return avx512;
+        default:             return false;
+        }
+#else
+        return false;
+#endif
+}
+
+/**
+ * Best supported instruction set, see cpu_isa_supported.
+ */
+inline CpuIsa cpu_isa_best() {
+        for (int isa = CPU_ISA_COUNT - 1; isa > 0; isa--)
+                if (cpu_isa_supported((CpuIsa)isa)) return (CpuIsa)isa;
+        return CPU_ISA_GENERIC;
+}
@@ -24,11 +24,17 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
-#include "helper.h"
+#include "helper_cpu.h"
 #include "tum_benchmark.hpp"
 #include "dataset.hpp"
+#ifndef CPU_ONLY
 #include "tracker.hpp"
+#endif
+#include "tracker_cpu_dispatch.hpp"
 #include "common.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 int main(int argc, char *argv[]) {
         //_______________________________________________________
@@ -70,6 +76,124 @@ int main(int argc, char *argv[]) {
         getParam("tDistWeights", tDistWeights, argc, argv);
         std::cout << "tDistWeights: " << tDistWeights << std::endl;
 
+        // weight function for the residuals: 0 Gaussian (no weights), 1 Huber,
+        // 2 Tukey, 3 T-Distribution. "-tDistWeights 1" is the same as "-weights 3"
+        // e.g. "-weights 1" for Huber
+        int weights = tDistWeights ? TDIST : GAUSSIAN;
+        getParam("weights", weights, argc, argv);
+        ResidualWeight weightType = (ResidualWeight)std::min(std::max(weights, 0), (int)TDIST);
+        std::cout << "weights: " << weightType << std::endl;
+
+        // set to true to run the alignment on the CPU instead of the GPU.
+        // A CPU_ONLY build always uses the CPU.
+        // e.g. "-cpu 1" for true
+        bool useCPU = false;
+        getParam("cpu", useCPU, argc, argv);
+#ifdef CPU_ONLY
+        useCPU = true;
+#endif
+        std::cout << "cpu: " << useCPU << std::endl;
+
+        // number of threads used by the CPU backend. 0 keeps the OpenMP default
+        // e.g. "-threads 4"
+        int numThreads = 0;
+        getParam("threads", numThreads, argc, argv);
+#ifdef _OPENMP
+        if (numThreads > 0) omp_set_num_threads(numThreads);
+        if (useCPU) std::cout << "threads: " << omp_get_max_threads() << std::endl;
+#endif
+
+        // instruction set of the CPU backend: generic, sse4.2, avx2 or avx512, see isa.hpp.
+        // The best one supported by the CPU by default
+        // e.g. "-isa avx2"
+        std::string isaName = "";
+        getParam("isa", isaName, argc, argv);
+        CpuIsa cpuIsa = cpu_isa_best();
+        if (!isaName.empty()) {
+                CpuIsa requested = cpu_isa_from_name(isaName);
+                if (requested != CPU_ISA_COUNT && cpu_isa_supported(requested))
+                        cpuIsa = requested;
+                else if (useCPU)
+                        std::cout << "isa " << isaName << " is not supported by this CPU or build" << std::endl;
+        }
+        if (useCPU) std::cout << "isa: " << cpu_isa_name(cpuIsa) << " (best supported: " << cpu_isa_name(cpu_isa_best()) << ")" << std::endl;
+
+        // type used by the CPU backend to sum up the normal equations:
+        // 0 float, 1 double, 2 compensated (Kahan) float
+        // e.g. "-accumulator 1" for double
+        int accumulator = ACCUMULATE_FLOAT;
+        getParam("accumulator", accumulator, argc, argv);
+        if (useCPU) std::cout << "accumulator: " << accumulator << std::endl;
+
+        // set to true to use the inverse compositional alignment, which computes
+        // the Jacobian once per level on the previous frame instead of every iteration
+        // e.g. "-inverseCompositional 1" for true
+        bool inverseCompositional = false;
+        getParam("inverseCompositional", inverseCompositional, argc, argv);
+        std::cout << "inverseCompositional: " << inverseCompositional << std::endl;
+        AlignmentMode alignmentMode = inverseCompositional ? INVERSE_COMPOSITIONAL : FORWARD_COMPOSITIONAL;
+
+        // method for the pose update, see solver.hpp: 0 Gauss-Newton, 1 Levenberg-Marquardt,
+        // 2 gradient descent, 3 ESM (efficient second-order minimization, always forward compositional)
+        // e.g. "-solvingMethod 1" for Levenberg-Marquardt
+        int solver = GAUSS_NEWTON;
+        getParam("solvingMethod", solver, argc, argv);
+        SolvingMethod solvingMethod = (SolvingMethod)std::min(std::max(solver, 0), (int)ESM);
+        std::cout << "solvingMethod: " << solvingMethod << std::endl;
+
+        // time budget of the alignment of each frame in microseconds, 0 for none.
+        // The finest levels and the last iterations are left out when it runs out, see budget.hpp
+        // e.g. "-budget 20000" for 20 ms
+        int budget = 0;
+        getParam("budget", budget, argc, argv);
+        std::cout << "budget: " << budget << std::endl;
+
+        // fraction of the pixels with depth aligned at each level (semi-dense alignment):
+        // the ones with the highest gradients in every image block. 1 for all of them
+        // e.g. "-density 0.25"
+        float density = 1.0f;
+        getParam("density", density, argc, argv);
+        std::cout << "density: " << density << std::endl;
+
+        // CPU only: set to true to sample the current frame from interleaved {I, dx, dy}
+        // texels (one lookup per corner) instead of three separate planes
+        // e.g. "-interleaved 1" for true
+        bool interleaved = false;
+        getParam("interleaved", interleaved, argc, argv);
+        if (useCPU) std::cout << "interleaved: " << interleaved << std::endl;
+
+        // set to true to sample the current frame from half precision copies of the gray
+        // image and its derivatives (halves the bandwidth of the lookups, see half.hpp)
+        // e.g. "-half 1" for true
+        bool half = false;
+        getParam("half", half, argc, argv);
+        std::cout << "half: " << half << std::endl;
+
+        // CPU only: set to true to sample the current frame from 16 bit fixed point gray planes,
+        // built from the 8 bit frame and downscaled in integer arithmetic, with integer bilinear
+        // interpolation. Replaces -interleaved, -half and -tiled
+        // e.g. "-fixedPoint 1" for true
+        bool fixedPoint = false;
+        getParam("fixedPoint", fixedPoint, argc, argv);
+        if (useCPU) std::cout << "fixedPoint: " << fixedPoint << std::endl;
+
+        // set to true to store the current frame for the lookups in tiles instead of rows,
+        // which keeps the lookups of a rotated warp in cache: 8x8 tiles of texels on the CPU
+        // (implies -interleaved), cudaArrays on the GPU
+        // e.g. "-tiled 1" for true
+        bool tiled = false;
+        getParam("tiled", tiled, argc, argv);
+        std::cout << "tiled: " << tiled << std::endl;
+
+        // CPU only: ratio of the sizes of consecutive pyramid levels, 0.5 for the usual factor 2.
+        // Smaller steps between levels (e.g. 0.7071 or 0.6667) need more levels for the same coarsest
+        // size but fewer iterations at each of them, see "./benchmark scales"
+        // e.g. "-pyramidScale 0.7071"
+        float pyramidScale = 0.5f;
+        getParam("pyramidScale", pyramidScale, argc, argv);
+        pyramidScale = useCPU ? std::min(std::max(pyramidScale, 0.25f), 0.9f) : 0.5f;
+        if (useCPU) std::cout << "pyramidScale: " << pyramidScale << std::endl;
+
         // ------- END OF PARAMETERS -------
 
 
@@ -93,16 +217,7 @@ int main(int argc, char *argv[]) {
         // Compute the number of scale levels, based on the image size, the
         // pyramid scale factor and the minimum image size at the coarsest level
         const int MIN_IMAGE_SIZE = 32;
-        int m_downscaleFactor = 2;
-        int m_nLevels = 1;
-        int w_tmp = w;
-        int h_tmp = h;
-        while( w_tmp/m_downscaleFactor >= MIN_IMAGE_SIZE
-               && h_tmp/m_downscaleFactor >= MIN_IMAGE_SIZE ) {
-                w_tmp = (int) (w_tmp / m_downscaleFactor);
-                h_tmp = (int) (h_tmp / m_downscaleFactor);
-                m_nLevels++;
-        }
+        int m_nLevels = pyramid_levels(w, h, pyramidScale, MIN_IMAGE_SIZE);
         numberOfLevels = std::max(1, std::min(m_nLevels, numberOfLevels));
         std::cout << "number of levels in pyramids: " << numberOfLevels << std::endl;
 
@@ -120,31 +235,50 @@ int main(int argc, char *argv[]) {
         convert_mat_to_layered(imgGray, mGray);
         convert_mat_to_layered(imgDepth, mDepth);
 
-        // initialize the tracker
-        Tracker tracker(imgGray, imgDepth, w, h, K, 0, numberOfLevels-1,tDistWeights);
+        // initialize the tracker on the chosen backend
+        TrackerBase *tracker = NULL;
+#ifndef CPU_ONLY
+        if (!useCPU) tracker = new Tracker(imgGray, imgDepth, w, h, K, 0, numberOfLevels-1, weightType, 20, solvingMethod, alignmentMode, density, half, tiled);
+#endif
+        if (useCPU) {
+                tracker = createTrackerCPU(cpuIsa, imgGray, imgDepth, w, h, K, 0, numberOfLevels-1, weightType, 20, solvingMethod, alignmentMode, (Accumulator)accumulator, density, interleaved, half, fixedPoint, tiled, pyramidScale);
+                std::cout << "pyramid compiled for the image size: " << static_pyramid_CPU(w, h, numberOfLevels, pyramidScale) << std::endl;
+        }
+
+        tracker->setTimeBudget(budget);
 
         // Store pose for frame 0
         poses.push_back(Matrix4f::Identity());
         timestamps.push_back(dataset.frames[0].timestamp);
 
         float total_time = 0.0f;
+        float max_align_time = 0.0f;    // longest latency of align alone, to check the budget
         std::cout << "\nStarting main loop, reading images and calculating trajectory. Take a chill pill, this may take a while!\n" << std::endl;
 
+        // iterations and valid (aligned) pixels per pyramid level, summed up over all frames
+        std::vector<int> total_iterations(numberOfLevels, 0);
+        std::vector<double> total_valid(numberOfLevels, 0);
+
         // main loop
         Vector6f xi_current;
         for (size_t i = 1; i < dataset.frames.size(); ++i) {
-                Timer timer; timer.start();
+                WallTimer timer; timer.start();
 
-                // Load in the images of the next frame
-                mGray = loadIntensity(dataset.frames[i].colorPath);
-                mDepth = loadDepth(dataset.frames[i].depthPath);
-
-                // convert opencv images to arrays
-                convert_mat_to_layered(imgGray, mGray);
-                convert_mat_to_layered(imgDepth, mDepth);
+                // Load in the images of the next frame, as decoded: the tracker converts them while building
+                // their pyramid (see TrackerBase::alignRaw)
+                mGray = loadIntensityRaw(dataset.frames[i].colorPath);
+                mDepth = loadDepthRaw(dataset.frames[i].depthPath);
+                RawFrame frame = { mGray.ptr<uint8_t>(), mDepth.ptr<uint16_t>(), w, h, mGray.step, mDepth.step };
 
                 // std::cout << "Image number: " << i << std::endl;
-                xi_current = tracker.align(imgGray, imgDepth);
+                WallTimer align_timer; align_timer.start();
+                xi_current = tracker->alignRaw(frame);
+                align_timer.end();
+                max_align_time = std::max(max_align_time, 1000 * align_timer.get());
+                for (int level = 0; level < numberOfLevels; level++) {
+                        total_iterations[level] += tracker->getIterations()[level];
+                        total_valid[level] += tracker->getValidPixels()[level];
+                }
 
                 timer.end();  float t = 1000 * timer.get(); // elapsed time in seconds
                 total_time += t;
@@ -169,18 +303,44 @@ int main(int argc, char *argv[]) {
                   << " ms.\nThis is an average of "
                   << total_time/dataset.frames.size()
                   << " ms per frame.\n" << std::endl;
+        std::cout << "Longest alignment of a frame: " << max_align_time << " ms\n" << std::endl;
+        std::cout << "Average iterations per frame at each level (0 is full resolution):" << std::endl;
+        for (int level = 0; level < numberOfLevels; level++)
+                std::cout << "  level " << level << ": "
+                          << (float)total_iterations[level] / (dataset.frames.size()-1) << std::endl;
+        std::cout << "Average valid pixels (pixels to align with depth) per frame at each level:" << std::endl;
+        for (int level = 0; level < numberOfLevels; level++)
+                std::cout << "  level " << level << ": "
+                          << total_valid[level] / (dataset.frames.size()-1) << std::endl;
 
         std::string options = "/";
-        if (tDistWeights) {
-                options += "tdist";
-        } else {
-                options += "gdist";
+        switch (weightType) {
+        case HUBER: options += "huber"; break;
+        case TUKEY: options += "tukey"; break;
+        case TDIST: options += "tdist"; break;
+        default:    options += "gdist";
         }
+        switch (solvingMethod) {
+        case LEVENBERG_MARQUARDT: options += "_lm"; break;
+        case GRADIENT_DESCENT:    options += "_gd"; break;
+        case ESM:                 options += "_esm"; break;
+        default: break;
+        }
+        if (inverseCompositional) options += "_ic";
+        if (density < 1.0f) options += "_density" + std::to_string((int)(100 * density));   // percentage
+        if (half) options += "_half";
+        if (fixedPoint && useCPU) options += "_fixed";
+        if (tiled) options += "_tiled";
+        if (pyramidScale != 0.5f) options += "_scale" + std::to_string((int)std::round(100 * pyramidScale));   // percentage
+        if (useCPU) {
+                options += "_cpu";
+        } else {
 #ifdef ENABLE_CUBLAS
-        options += "_cublas";
+                options += "_cublas";
 #else
-        options += "_nocublas";
+                options += "_nocublas";
 #endif
+        }
 
         savePoses( path +options+ "_trajectory.txt", poses, timestamps);
 
@@ -190,6 +350,10 @@ int main(int argc, char *argv[]) {
         //_______________________________________________________
         //_______________________________________________________
 
+        delete tracker;
+        delete[] imgGray;
+        delete[] imgDepth;
+
         cv::waitKey(0);
         cvDestroyAllWindows();
         std::cout << "All done! Check out the output file: " << path << options << "_trajectory.txt for the resulting trajectory!\n" << std::endl;
@@ -1,9 +1,12 @@
 /**
  * \file
  * \brief   Set of functions used for the preprocessing needed for each frame. Including:
- * 				* Downscaling camera intrinsic matrix K
+ * 				* Downscaling camera intrinsic matrix K (in preprocessing_cpu.hpp)
  * 				* Resizing of images (small modification of G.Kuschk's cvlib)
- *     			* Derivatives of gray images.
+ *     			* Derivatives of gray images
+ *     			* Semi-dense selection of pixels.
+ *     			* Half precision copies of images for the texture lookups
+ *     			* Back-projection of the pixels of the first frame
  *
  * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
  */
@@ -11,37 +14,42 @@
 #pragma once
 #include <Eigen/Dense>
 #include "Exception.h"
+#include "preprocessing_cpu.hpp" // downsampleK, invertKMat, SELECTION_*
 #include <cuda_runtime.h>
+#include <cuda_fp16.h>
 
 
-Matrix3f downsampleK(const Matrix3f K) {
-  Matrix3f K_d = K;
-  K_d(0, 2) += 0.5f; K_d(1, 2) += 0.5f;
-  K_d.topLeftCorner(2, 3) *= 0.5f;
-  K_d(0, 2) -= 0.5f; K_d(1, 2) -= 0.5f;
-  return K_d;
-}
-
+//############################################################################
 /**
- * Calculates the inverse of a 3x3 Matrix with the following 'shape'
- *
- *  | a   0   b |          | 1/a   0   -b/a |
- *  | 0   c   d |    =>    | 0    1/c  -d/c |
- *  | 0   0   1 |          | 0     0    1   |
- *
- * @param iKPy [description]
- * @param KPy  [description]
- * @param lvl  [description]
+ * Makes the taps of the Gaussian of (sigma, radius) the current ones in
+ * const_gauss, for the filters below: gaussian_coefficients, computed once
+ * and only uploaded when they change, so the kernels never evaluate the
+ * exponential.
  */
-Matrix3f invertKMat (const Eigen::Matrix3f K) {
-    Matrix3f K_inv = K;
-	K_inv <<   1.0f/K_inv(0,0)	, 0.0f				, -(K_inv(0,2)/K_inv(0,0)),
-			   0.0f				, 1.0f/K_inv(1,1)	, -(K_inv(1,2)/K_inv(1,1)),
-			   0.0f				, 0.0f				, 1.0f;
-   return K_inv;
+void  upload_gaussian_CUDA( float sigma, int radius )
+{
+  static float  uploadedSigma  = -1.0f;
+  static int    uploadedRadius = -1;
+
+  if ( radius > MAX_GAUSS_RADIUS )
+  {
+    throw Exception( "Error upload_gaussian_CUDA(): Gaussian radius %d "
+                     "is larger than MAX_GAUSS_RADIUS (%d)!\n",
+                     radius, MAX_GAUSS_RADIUS );
+  }
+  if ( ( sigma == uploadedSigma ) && ( radius == uploadedRadius ) )
+    return;
+
+  cudaMemcpyToSymbol( const_gauss, gaussian_coefficients( sigma, radius ),
+                      (2*radius+1)*sizeof(float) ); CUDA_CHECK;
+  uploadedSigma  = sigma;
+  uploadedRadius = radius;
 }
 
 
+
+
+
 //############################################################################
 __global__  void gaussFilter2D_horizontal_CUDA_kernel(
                                             const float  *data_in,
@@ -128,23 +136,18 @@ __global__  void gaussFilter2D_horizontal_CUDA_kernel(
 
 
   float   result = 0.0f;
-  float   ksum   = 0.0f;
 
   // Note that we do not need to check wether we are at an image border
   // because we already padded the surrounding data in the shared memory
-  // (qLocal = moving position in the sub-window)
+  // (qLocal = moving position in the sub-window). The taps are normalized
   for ( int dx=-radius; dx<=radius; dx++ )
   {
     int     qLocal   = (int)threadIdx.y * bWidthPadded +
                        (int)threadIdx.x + radius + dx;
 
-    float   exponent = -(dx*dx) / (2.0f*sigma*sigma);
-    float   kernel   = 1.0f / ( sqrtf( 2.0f * M_PI ) * sigma ) * __expf( exponent );
-
-    result += kernel * data[qLocal];
-    ksum   += kernel;
+    result += const_gauss[ dx + radius ] * data[qLocal];
   }
-  data_out[p] = result / ksum;
+  data_out[p] = result;
 }
 
 
@@ -237,23 +240,18 @@ __global__  void gaussFilter2D_vertical_CUDA_kernel(
 
 
   float   result = 0.0f;
-  float   ksum   = 0.0f;
 
   // Note that we do not need to check wether we are at an image border
   // because we already padded the surrounding data in the shared memory
-  // (qLocal = moving position in the sub-window)
+  // (qLocal = moving position in the sub-window). The taps are normalized
   for ( int dy=-radius; dy<=radius; dy++ )
   {
     int     qLocal   = (int)(threadIdx.y + radius + dy) * blockDim.x +
                        (int)threadIdx.x;
 
-    float   exponent = -(dy*dy) / (2.0f*sigma*sigma);
-    float   kernel   = 1.0f / ( sqrtf( 2.0f * M_PI ) * sigma ) * __expf( exponent );
-
-    result += kernel * data[qLocal];
-    ksum   += kernel;
+    result += const_gauss[ dy + radius ] * data[qLocal];
   }
-  data_out[p] = result / ksum;
+  data_out[p] = result;
 }
 
 
@@ -288,6 +286,9 @@ void  gaussFilter2D_CUDA( const float   *img_src,
                      sharedMemSize/1024, g_CUDA_maxSharedMemSize/1024 );
   }
 
+  // Taps of the kernels
+  upload_gaussian_CUDA( sigma, radius );
+
   // Block = 2D array of threads
   dim3  dimBlock( g_CUDA_blockSize2DX, g_CUDA_blockSize2DY, 1 );
 
@@ -443,6 +444,77 @@ __global__ void  scaleImage_CUDA_kernel( const T      *pImgSrc,
 
 
 
+//############################################################################
+/**
+* \brief  Gaussian blur (taps in const_gauss, replicated borders) followed by
+*         the bilinear downscaling of scaleImage_CUDA_kernel with pixel
+*         centers, evaluated only at the destination pixels: every thread
+*         computes the 2*radius+2 taps of its pixel along each axis (the
+*         polyphase filter of DownscaleAxis) and reads the source directly, so
+*         there is no blurred intermediate image.
+*
+* \param  pImgSrc     The source image
+* \param  pImgDst     The destination image, smaller along both axes
+* \param  radius      Radius of the Gaussian
+*/
+__global__ void  downscaleGauss_CUDA_kernel( const float  *pImgSrc,
+                                             float        *pImgDst,
+                                             int          src_width,
+                                             int          src_height,
+                                             int          dst_width,
+                                             int          dst_height,
+                                             int          nChannels,
+                                             int          radius )
+{
+  // Get the 2D-coordinate of the pixel of the current thread
+  const int   x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int   y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  // Do nothing for the pixels which are outside the image
+  if ( ( x >= dst_width) || ( y >= dst_height) )
+    return;
+
+  // Source coordinate (u,v) of the pixel center, as in scaleImage_CUDA_kernel
+  float    scaleX = (float)dst_width  / (float)src_width;
+  float    scaleY = (float)dst_height / (float)src_height;
+  float    u  = ( x + 0.5f ) / scaleX - 0.5f;
+  float    v  = ( y + 0.5f ) / scaleY - 0.5f;
+  int      iu = (int)u;
+  int      iv = (int)v;
+  float    du = u - iu;
+  float    dv = v - iv;
+  // the last source pixel is copied (never reached when downscaling)
+  if ( ( iu == src_width-1 ) || ( iv == src_height-1 ) )
+    du = dv = 0.0f;
+
+  const int   taps = 2*radius + 2;
+  for ( int ch=0; ch<nChannels; ch++ )
+  {
+    const float  *src    = &pImgSrc[ ch*src_width*src_height ];
+    float        result  = 0.0f;
+    for ( int j=0; j<taps; j++ )
+    {
+      // weight of tap j: the Gaussian around the two interpolated rows
+      float   wy  = ( j < taps-1 ? (1.0f - dv) * const_gauss[j] : 0.0f ) +
+                    ( j > 0      ? dv * const_gauss[j-1]          : 0.0f );
+      int     row = min( max( iv - radius + j, 0 ), src_height-1 ) * src_width;
+      float   sum = 0.0f;
+      for ( int i=0; i<taps; i++ )
+      {
+        float   wx  = ( i < taps-1 ? (1.0f - du) * const_gauss[i] : 0.0f ) +
+                      ( i > 0      ? du * const_gauss[i-1]          : 0.0f );
+        sum += wx * src[ row + min( max( iu - radius + i, 0 ), src_width-1 ) ];
+      }
+      result += wy * sum;
+    }
+    pImgDst[ ch*dst_width*dst_height + y*dst_width + x ] = result;
+  }
+}
+
+
+
+
+
 //############################################################################
 void  imresize_CUDA( const float   *pImgSrc,
                      float         *pImgDst,
@@ -489,13 +561,9 @@ void  imresize_CUDA( const float   *pImgSrc,
   bool    fUsePixCenter = true;
 
 
-  // Image Downscaling? => Apply Gaussian blur beforehand. Only if it is NOT a DEPTH image. Takes about an extra milisecond per frame
+  // Image Downscaling? => Apply Gaussian blur beforehand. Only if it is NOT a DEPTH image
   if ( ( dst_width  < src_width ) && ( dst_height < src_height ) && (!isDepthImage) )
   {
-    float   *I_gauss = NULL;
-    cudaMalloc( (void**) &I_gauss,
-                src_width*src_height*channels*sizeof(float) ); CUDA_CHECK;
-
     float     scaleFactorX = (float)dst_width  / (float)src_width;
     float     scaleFactorY = (float)dst_height / (float)src_height;
     float     scaleFactor  = std::min<float>( scaleFactorX, scaleFactorY );
@@ -522,25 +590,14 @@ void  imresize_CUDA( const float   *pImgSrc,
     //printf( "scaleFactor=%f -> sigma=%f, kernel-radius=%d\n",
     //        scaleFactor, sigma, radius );
 
-    // Run Gauss filtering
-    gaussFilter2D_CUDA( pImgSrc, I_gauss, src_width, src_height, channels,
-                        sigma, radius, BORDER_REPLICATE/*, stream*/ );
-    //cudaDeviceSynchronize();
-    //cudaStreamSynchronize(stream);
-
-    //DEBUG
-    //Image<float> *pImg_f = copyImageDeviceToHost<float,float>( I_gauss );
-    //saveImage( pImg_f->convertToUCharImage(), "dbg_imresizeGauss_gpu.ppm" );
-
-
-    // Run bilinear image scaling
-    scaleImage_CUDA_kernel<float><<< dimGrid, dimBlock, 0/*, stream*/ >>>(
-                               I_gauss, pImgDst,
+    // Gauss filtering and bilinear image scaling in one pass, with the taps
+    // cached in constant memory
+    upload_gaussian_CUDA( sigma, radius );
+    downscaleGauss_CUDA_kernel<<< dimGrid, dimBlock, 0/*, stream*/ >>>(
+                               pImgSrc, pImgDst,
                                src_width, src_height,
                                dst_width, dst_height,
-                               channels, fUsePixCenter );
-
-   cudaFree(I_gauss); CUDA_CHECK;
+                               channels, radius );
   }//if Gauss filter
   else
   {
@@ -556,6 +613,18 @@ void  imresize_CUDA( const float   *pImgSrc,
   //cudaStreamSynchronize(stream); // TODO: should this be here or not?
 }
 
+/**
+ * Derivatives of the pixel (x, y) of an image, centered in the inside and one
+ * sided on the edges: the formula of compute_image_derivatives_CUDA, also used
+ * to compute them on the fly where the derivative planes are not stored (see
+ * GRADIENTS_ON_THE_FLY in common.h).
+ */
+__device__ inline void d_central_differences(const float *input, int x, int y, int w, int h, float &dx, float &dy)
+{
+    dx = ( input[ min(x+1,w-1) + w*y  ] - input[ max(x-1, 0) + w*y ] )*0.5f;
+    dy = ( input[ x + w*min(y+1, h-1) ] - input[ x + w*max(y-1, 0) ] )*0.5f;
+}
+
 /**
  * CUDA function. Takes in an image and returns its derivatives along both axes. Derivatives are centered in the inside and respectively sided on the edges.
  * @param  input        input image 1D array with size w*h
@@ -573,8 +642,7 @@ __global__ void compute_image_derivatives_CUDA (const float *input, float *dX, f
     if (x<w && y<h) {
         // do centered derivatives where possible
         // else do left or right-sided derivatives (on the edges)
-        dX[ind] = ( input[ min(x+1,w-1) + w*y  ] - input[ max(x-1, 0) + w*y ] )*0.5f;
-        dY[ind] = ( input[ x + w*min(y+1, h-1) ] - input[ x + w*max(y-1, 0) ] )*0.5f;
+        d_central_differences(input, x, y, w, h, dX[ind], dY[ind]);
     }
 }
 
@@ -606,3 +674,243 @@ void  image_derivatives_CUDA( const float   *pImgSrc,
     compute_image_derivatives_CUDA <<<dimGrid, dimBlock, 0, 0 >>> (pImgSrc, pImgDX, pImgDY, width, height);
     // cudaDeviceSynchronize();
 }
+
+/**
+ * CUDA function. Converts an image to half precision.
+ * @param  input        input image 1D array with size w*h
+ * @param  output       output half precision image, rows of pitch elements
+ * @param  pitch        elements (not bytes) between two rows of output
+ * @param  w            image width
+ * @param  h            image height
+ */
+__global__ void float_to_half_CUDA_kernel (const float *input, __half *output, size_t pitch, int w, int h)
+{
+    int x = threadIdx.x + blockDim.x * blockIdx.x;
+    int y = threadIdx.y + blockDim.y * blockIdx.y;
+
+    if (x<w && y<h)
+        output[x + pitch*y] = __float2half_rn( input[x + w*y] );
+}
+
+/**
+ * Calls float_to_half_CUDA_kernel. The output is meant to be bound to a
+ * texture of floats with a cudaCreateChannelDescHalf channel, which converts
+ * it back to float on every lookup.
+ * @param  *pImgSrc     Input image array of length w*h
+ * @param  *pImgDst     Output half precision image
+ * @param  pitch        Bytes between two rows of pImgDst, as returned by cudaMallocPitch
+ * @param  width
+ * @param  height
+ */
+void  float_to_half_CUDA( const float   *pImgSrc,
+                          __half        *pImgDst,
+                          size_t        pitch,
+                          int           width,
+                          int           height)
+{
+    dim3  dimBlock( g_CUDA_blockSize2DX, g_CUDA_blockSize2DY, 1 );
+    dim3  dimGrid( (width  + dimBlock.x-1) / dimBlock.x, (height + dimBlock.y-1) / dimBlock.y, 1 );
+
+    float_to_half_CUDA_kernel <<<dimGrid, dimBlock, 0, 0 >>> (pImgSrc, pImgDst, pitch / sizeof(__half), width, height);
+}
+
+/**
+ * CUDA function. Derivatives of an image straight into half precision, for
+ * the half precision mode, which stores no float derivative planes. Same
+ * formula as compute_image_derivatives_CUDA.
+ * @param  input        input image 1D array with size w*h
+ * @param  dX           output horizontal derivatives in half precision, rows of pitch elements
+ * @param  dY           output vertical derivatives in half precision, rows of pitch elements
+ * @param  pitch        elements (not bytes) between two rows of dX and dY
+ * @param  w            image width
+ * @param  h            image height
+ */
+__global__ void compute_image_derivatives_half_CUDA (const float *input, __half *dX, __half *dY, size_t pitch, int w, int h)
+{
+    int x = threadIdx.x + blockDim.x * blockIdx.x;
+    int y = threadIdx.y + blockDim.y * blockIdx.y;
+
+    if (x<w && y<h) {
+        float dx, dy;
+        d_central_differences(input, x, y, w, h, dx, dy);
+        dX[x + pitch*y] = __float2half_rn( dx );
+        dY[x + pitch*y] = __float2half_rn( dy );
+    }
+}
+
+/**
+ * Calls compute_image_derivatives_half_CUDA. The outputs are meant to be
+ * bound to textures like those of float_to_half_CUDA.
+ * @param  *pImgSrc     Input image array of length w*h
+ * @param  *pImgDX      Output half precision horizontal derivatives
+ * @param  *pImgDY      Output half precision vertical derivatives
+ * @param  pitch        Bytes between two rows of pImgDX and pImgDY, as returned by cudaMallocPitch
+ * @param  width
+ * @param  height
+ */
+void  image_derivatives_half_CUDA( const float   *pImgSrc,
+                                   __half        *pImgDX,
+                                   __half        *pImgDY,
+                                   size_t        pitch,
+                                   int           width,
+                                   int           height)
+{
+    dim3  dimBlock( g_CUDA_blockSize2DX, g_CUDA_blockSize2DY, 1 );
+    dim3  dimGrid( (width  + dimBlock.x-1) / dimBlock.x, (height + dimBlock.y-1) / dimBlock.y, 1 );
+
+    compute_image_derivatives_half_CUDA <<<dimGrid, dimBlock, 0, 0 >>> (pImgSrc, pImgDX, pImgDY, pitch / sizeof(__half), width, height);
+}
+
+/**
+ * CUDA function. Semi-dense selection of pixels, same rule as select_pixels_CPU.
+ * Each block of SELECTION_BLOCK_SIZE x SELECTION_BLOCK_SIZE threads is a block
+ * of the selection: every candidate counts the candidates of the block ahead
+ * of it (larger magnitude, or same magnitude and smaller index) and is kept if
+ * there are less than ceil(density * m) of them.
+ * The kept pixels are appended to the list with an atomic counter, so their
+ * order is not defined.
+ * @param  pixels       output indices of the selected pixels
+ * @param  count        output number of selected pixels, to be set to 0 beforehand
+ * @param  depth        depth image 1D array with size w*h
+ * @param  gray         gray image. Only read without derivatives
+ * @param  dX           horizontal derivatives. NULL to compute them from gray, see d_central_differences
+ * @param  dY           vertical derivatives. NULL to compute them from gray
+ * @param  w            image width
+ * @param  h            image height
+ * @param  density      fraction of the pixels with depth to keep, see selection_density
+ */
+__global__ void select_pixels_CUDA_kernel (int *pixels, int *count, const float *depth, const float *gray, const float *dX, const float *dY,
+                                           int w, int h, float density)
+{
+    __shared__ float s_mag2[SELECTION_BLOCK_SIZE * SELECTION_BLOCK_SIZE];
+    int x = threadIdx.x + blockDim.x * blockIdx.x;
+    int y = threadIdx.y + blockDim.y * blockIdx.y;
+    int ind = x + y * w;
+    int tid = threadIdx.x + threadIdx.y * blockDim.x;
+
+    // squared magnitude of the candidates, -1 for the rest
+    bool valid = (x<w && y<h) && depth[ind] != 0;
+    float mag2 = -1.0f;
+    if (valid) {
+        float dx, dy;
+        if (dX) { dx = dX[ind]; dy = dY[ind]; }
+        else d_central_differences(gray, x, y, w, h, dx, dy);
+        mag2 = dx*dx + dy*dy;
+        if (mag2 < SELECTION_MIN_GRADIENT * SELECTION_MIN_GRADIENT) mag2 = -1.0f;
+    }
+    s_mag2[tid] = mag2;
+    int keep = (int)ceilf( density * __syncthreads_count(valid) );
+
+    if (mag2 < 0) return;
+    // within a block the thread index grows with the pixel index
+    int ahead = 0;
+    for (int i = 0; i < SELECTION_BLOCK_SIZE * SELECTION_BLOCK_SIZE; i++)
+        ahead += (s_mag2[i] > mag2) || (s_mag2[i] == mag2 && i < tid);
+    if (ahead < keep)
+        pixels[ atomicAdd(count, 1) ] = ind;
+}
+
+/**
+ * Calls select_pixels_CUDA_kernel
+ * @param  *pixels      Output array of up to width*height pixel indices
+ * @param  *d_count     Device scratch for one int
+ * @param  *pDepth      Depth image array of length w*h
+ * @param  *pGray       Gray image. Only read without derivatives
+ * @param  *pImgDX      Horizontal derivatives. NULL to compute them from pGray
+ * @param  *pImgDY      Vertical derivatives. NULL to compute them from pGray
+ * @param  width
+ * @param  height
+ * @param  density      See selection_density
+ * @return              Number of selected pixels
+ */
+int  select_pixels_CUDA( int           *pixels,
+                         int           *d_count,
+                         const float   *pDepth,
+                         const float   *pGray,
+                         const float   *pImgDX,
+                         const float   *pImgDY,
+                         int           width,
+                         int           height,
+                         float         density)
+{
+    // Block = 2D array of threads, a block of the selection
+    dim3  dimBlock( SELECTION_BLOCK_SIZE, SELECTION_BLOCK_SIZE, 1 );
+
+    // Grid = 2D array of blocks
+    int   gridSizeX = (width  + dimBlock.x-1) / dimBlock.x;
+    int   gridSizeY = (height + dimBlock.y-1) / dimBlock.y;
+    dim3  dimGrid( gridSizeX, gridSizeY, 1 );
+
+    cudaMemset(d_count, 0, sizeof(int));
+    select_pixels_CUDA_kernel <<<dimGrid, dimBlock, 0, 0 >>> (pixels, d_count, pDepth, pGray, pImgDX, pImgDY, width, height, density);
+    int count;
+    cudaMemcpy(&count, d_count, sizeof(int), cudaMemcpyDeviceToHost);
+    return count;
+}
+
+/**
+ * CUDA function. Back-projects the pixels to align into 3D points,
+ * K_inv * (x, y, 1) * d, like back_project_CPU: separate arrays of
+ * coordinates, compacted over valid depth. The points are appended with an
+ * atomic counter, so their order is not defined.
+ * @param  X, Y, Z      output coordinates of the points
+ * @param  pointPixels  output index of the pixel of every point
+ * @param  count        output number of points, to be set to 0 beforehand
+ * @param  pixels       indices of the pixels to back-project. NULL for all of them
+ * @param  n            entries of pixels, or w*h
+ * @param  depth        depth image 1D array with size w*h
+ * @param  w            image width
+ * @param  fx, fy, cx, cy  intrinsic parameters of the level
+ */
+__global__ void back_project_CUDA_kernel (float *X, float *Y, float *Z, int *pointPixels, int *count, const int *pixels, int n,
+                                          const float *depth, int w, float fx, float fy, float cx, float cy)
+{
+    int i = threadIdx.x + blockDim.x * blockIdx.x;
+    if (i >= n) return;
+
+    int ind = pixels ? pixels[i] : i;
+    float d = depth[ind];
+    if (d == 0) return;
+
+    int k = atomicAdd(count, 1);
+    X[k] = (ind % w - cx) / fx * d;
+    Y[k] = (ind / w - cy) / fy * d;
+    Z[k] = d;
+    pointPixels[k] = ind;
+}
+
+/**
+ * Calls back_project_CUDA_kernel
+ * @param  *X, *Y, *Z   Output arrays of up to n coordinates
+ * @param  *pointPixels Output array of up to n pixel indices
+ * @param  *d_count     Device scratch for one int
+ * @param  *pixels      Pixels to back-project, see select_pixels_CUDA. NULL for all of them
+ * @param  n            Entries of pixels, or width*height
+ * @param  *pDepth      Depth image array of length w*h
+ * @param  width
+ * @param  K            Intrinsic matrix of the level
+ * @return              Number of points
+ */
+int  back_project_CUDA( float         *X,
+                        float         *Y,
+                        float         *Z,
+                        int           *pointPixels,
+                        int           *d_count,
+                        const int     *pixels,
+                        int           n,
+                        const float   *pDepth,
+                        int           width,
+                        const Eigen::Matrix3f &K)
+{
+    // Block = 1D array of threads, one per pixel
+    dim3  dimBlock( g_CUDA_blockSize2DX * g_CUDA_blockSize2DY, 1, 1 );
+    dim3  dimGrid( (n + dimBlock.x-1) / dimBlock.x, 1, 1 );
+
+    cudaMemset(d_count, 0, sizeof(int));
+    if (n > 0)
+        back_project_CUDA_kernel <<<dimGrid, dimBlock, 0, 0 >>> (X, Y, Z, pointPixels, d_count, pixels, n, pDepth, width,
+                                                                 K(0,0), K(1,1), K(0,2), K(1,2));
+    int count;
+    cudaMemcpy(&count, d_count, sizeof(int), cudaMemcpyDeviceToHost);
+    return count;
+}
@@ -0,0 +1,1175 @@
+/**
+ * \file
+ * \brief   Host counterparts of the functions in preprocessing.cuh, used by the
+ *          CPU backend. Including:
+ * 				* Downscaling camera intrinsic matrix K
+ * 				* Resizing of images (same semantics as imresize_CUDA), and
+ * 				  its fused special case of the pyramid levels
+ *     			* Derivatives of gray images
+ *     			* Half precision copies of images, and the fixed point gray
+ *     			  planes of the current frame
+ *     			* Semi-dense selection of pixels
+ *     			* Back-projection of the pixels of the first frame.
+ *
+ *          The per-pixel loops are parallelized over rows with OpenMP. Without
+ *          -fopenmp the pragmas are ignored and everything runs single-threaded.
+ *
+ *          Images are pitched (see image.hpp): pointers are to the pixel
+ *          (0, 0), and rows are image_pitch(width) pixels apart. Outputs are
+ *          written without their guard band, see PitchedImage::replicate_border.
+ *
+ *          The functions with per-pixel loops are templated on the types of
+ *          the image sizes: int, or FixedSize (see pyramid.hpp) to compile
+ *          them for a given size, with constant trip counts and pitches.
+ *
+ *          Compiled once per instruction set, see isa.hpp.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#ifndef PREPROCESSING_CPU_HPP
+#define PREPROCESSING_CPU_HPP
+#include <Eigen/Dense>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "common.h"
+#include "half.hpp"
+#include "image.hpp"
+#include "pyramid.hpp"
+#include "isa.hpp"
+
+namespace CPU_ISA_NAMESPACE {
+
+/**
+ * Camera matrix of the next pyramid level, scaled by scaleX and scaleY about the
+ * pixel centers. 0.5 for the usual levels, the ratio of the level sizes otherwise
+ * (see imresize_CPU).
+ */
+Matrix3f downsampleK(const Matrix3f K, float scaleX = 0.5f, float scaleY = 0.5f) {
+  Matrix3f K_d = K;
+  K_d(0, 2) += 0.5f; K_d(1, 2) += 0.5f;
+  K_d.row(0) *= scaleX;
+  K_d.row(1) *= scaleY;
+  K_d(0, 2) -= 0.5f; K_d(1, 2) -= 0.5f;
+  return K_d;
+}
+
+/**
+ * Calculates the inverse of a 3x3 Matrix with the following 'shape'
+ *
+ *  | a   0   b |          | 1/a   0   -b/a |
+ *  | 0   c   d |    =>    | 0    1/c  -d/c |
+ *  | 0   0   1 |          | 0     0    1   |
+ *
+ * @param iKPy [description]
+ * @param KPy  [description]
+ * @param lvl  [description]
+ */
+Matrix3f invertKMat (const Eigen::Matrix3f K) {
+    // read from K, not from K_inv: the comma initializer may already have
+    // overwritten K_inv(0,0) when K_inv(0,2)/K_inv(0,0) gets evaluated
+    Matrix3f K_inv;
+	K_inv <<   1.0f/K(0,0)	, 0.0f			, -(K(0,2)/K(0,0)),
+			   0.0f			, 1.0f/K(1,1)	, -(K(1,2)/K(1,1)),
+			   0.0f			, 0.0f			, 1.0f;
+   return K_inv;
+}
+
+
+//############################################################################
+/**
+ * Normalized taps of the Gaussian of gaussFilter2D_CPU and imresize_CPU, the
+ * 2*radius+1 values of exp(-d^2 / (2 sigma^2)) for d in [-radius, radius],
+ * divided by their sum. Computed once per (sigma, radius) and cached, so the
+ * filters never evaluate the exponential per pixel. The pointer stays valid.
+ * Also the taps of the CUDA filters, see upload_gaussian_CUDA.
+ */
+inline const float *gaussian_coefficients( float sigma, int radius )
+{
+  static std::map< std::pair<float, int>, std::vector<float> >  cache;
+  static std::mutex  mutex;
+  std::lock_guard<std::mutex>  lock( mutex );
+
+  std::vector<float>  &kernel = cache[ std::make_pair( sigma, radius ) ];
+  if ( kernel.empty() )
+  {
+    float   ksum = 0.0f;
+    for ( int d=-radius; d<=radius; d++ )
+    {
+      kernel.push_back( expf( -(d*d) / (2.0f*sigma*sigma) ) );
+      ksum += kernel.back();
+    }
+    for ( size_t i=0; i<kernel.size(); i++ )
+      kernel[i] /= ksum;
+  }
+  return kernel.data();
+}
+
+/**
+ * \brief  Separable Gaussian filter with replicated borders. Same kernel and
+ *         normalization as gaussFilter2D_horizontal/vertical_CUDA_kernel.
+ *
+ * \param  img_src  Source image of channels planes of image_size(width, height) pixels
+ * \param  img_dst  Destination image of the same size
+ * \param  img_tmp  Intermediate image of one plane
+ */
+template<typename Width, typename Height>
+void  gaussFilter2D_CPU( const float   *img_src,
+                         float         *img_dst,
+                         float         *img_tmp,
+                         Width         width,
+                         Height        height,
+                         int           channels,
+                         float         sigma,
+                         int           radius )
+{
+  const int    pitch  = image_pitch( width );
+  const int    plane  = image_size( width, height, false );
+  const float  *kernel = gaussian_coefficients( sigma, radius ) + radius;
+
+  for ( int ch=0; ch<channels; ch++ )
+  {
+    const float  *src = &img_src[ plane * ch ];
+    float        *dst = &img_dst[ plane * ch ];
+
+    // Horizontal pass
+    #pragma omp parallel for
+    for ( int y=0; y<height; y++ )
+    {
+      for ( int x=0; x<width; x++ )
+      {
+        float   result = 0.0f;
+        for ( int dx=-radius; dx<=radius; dx++ )
+        {
+          int     xx       = std::min( std::max( x+dx, 0 ), width-1 );
+          result += kernel[dx] * src[ y*pitch + xx ];
+        }
+        img_tmp[ y*pitch + x ] = result;
+      }
+    }
+
+    // Vertical pass
+    #pragma omp parallel for
+    for ( int y=0; y<height; y++ )
+    {
+      for ( int x=0; x<width; x++ )
+      {
+        float   result = 0.0f;
+        for ( int dy=-radius; dy<=radius; dy++ )
+        {
+          int     yy       = std::min( std::max( y+dy, 0 ), height-1 );
+          result += kernel[dy] * img_tmp[ yy*pitch + x ];
+        }
+        dst[ y*pitch + x ] = result;
+      }
+    }
+  }
+}
+
+
+
+
+
+//############################################################################
+/**
+ * Polyphase filter of the downscaling of imresize_CPU along one axis: the
+ * Gaussian blur followed by the bilinear interpolation at the pixel centers,
+ * as one filter of 2*radius+2 taps per output pixel. Output pixel i is the sum
+ * of weight[k] * input pixel index[k], for the taps k of i.
+ */
+struct DownscaleAxis
+{
+  int                 taps;     // per output pixel
+  std::vector<int>    index;    // input pixels of the taps of every output pixel, clamped to the image
+  std::vector<float>  weight;   // their weights
+};
+
+/**
+ * Polyphase filter of imresize_CPU from src to dst pixels along an axis, with
+ * the Gaussian of (sigma, radius), see DownscaleAxis. Computed once per
+ * arguments and cached, like gaussian_coefficients.
+ */
+inline const DownscaleAxis  &downscale_axis( int src, int dst, float sigma, int radius )
+{
+  static std::map< std::tuple<int, int, float, int>, DownscaleAxis >  cache;
+  static std::mutex  mutex;
+  std::lock_guard<std::mutex>  lock( mutex );
+
+  DownscaleAxis  &axis = cache[ std::make_tuple( src, dst, sigma, radius ) ];
+  if ( axis.index.empty() )
+  {
+    const float  *gauss = gaussian_coefficients( sigma, radius );
+    axis.taps = 2*radius + 2;
+    // the coordinates of scaleImage_CPU with pixel centers
+    const float  scale = (float)dst / (float)src;
+    for ( int i=0; i<dst; i++ )
+    {
+      float  u  = ( i + 0.5f ) / scale - 0.5f;
+      int    iu = (int)u;
+      float  du = u - iu;
+      // the last input pixel is copied (never reached when downscaling)
+      if ( iu == src-1 )
+        du = 0.0f;
+      for ( int k=0; k<axis.taps; k++ )
+      {
+        axis.index.push_back( std::min( std::max( iu - radius + k, 0 ), src-1 ) );
+        axis.weight.push_back( ( k < axis.taps-1 ? (1.0f - du) * gauss[k] : 0.0f ) +
+                               ( k > 0           ? du * gauss[k-1]          : 0.0f ) );
+      }
+    }
+  }
+  return axis;
+}
+
+
+
+
+
+//############################################################################
+/**
+* \brief  Resize the image pImgSrc by bilinear interpolation to the size of
+*         pImgDst. Host version of scaleImage_CUDA_kernel.
+*/
+template<typename SrcWidth, typename SrcHeight, typename DstWidth, typename DstHeight>
+void  scaleImage_CPU( const float  *pImgSrc,
+                      float        *pImgDst,
+                      SrcWidth     src_width,
+                      SrcHeight    src_height,
+                      DstWidth     dst_width,
+                      DstHeight    dst_height,
+                      int          nChannels,
+                      bool         fUsePixelCenter=false,
+                      bool         isDepthImage=false )
+{
+  // Compute scaling factor and its inverse
+  float    scaleX = (float)dst_width  / (float)src_width;
+  float    scaleY = (float)dst_height / (float)src_height;
+
+  float   pixelCenterOffset = 0.0f;
+  if ( fUsePixelCenter )
+    pixelCenterOffset = 0.5f;
+
+  const int  src_pitch = image_pitch( src_width );
+  const int  dst_pitch = image_pitch( dst_width );
+  const int  src_plane = image_size( src_width, src_height, false );
+  const int  dst_plane = image_size( dst_width, dst_height, false );
+
+  #pragma omp parallel for
+  for ( int y=0; y<dst_height; y++ )
+  {
+    for ( int x=0; x<dst_width; x++ )
+    {
+      int       iPosDst = y * dst_pitch + x;
+
+      // Get src coordinate (u,v) = (x,y) and get integer pixel adress there
+      float    u = ( x + pixelCenterOffset ) / scaleX - pixelCenterOffset;
+      float    v = ( y + pixelCenterOffset ) / scaleY - pixelCenterOffset;
+      int      iu = (int)u;
+      int      iv = (int)v;
+      int      iPosSrc = iv * src_pitch + iu;
+
+      // At the right-border and lower-border of the image, where no
+      // interpolation is possible, just copy the integer pixel
+      if ( ( iu == src_width-1 ) || ( iv == src_height-1 ) )
+      {
+        for ( int ch=0; ch<nChannels; ch++ )
+        {
+          pImgDst[ ch*dst_plane + iPosDst ] =
+          pImgSrc[ ch*src_plane + iPosSrc ];
+        }
+        continue;
+      }
+
+      for ( int ch=0; ch<nChannels; ch++ )
+      {
+        const float   *ptr = &(pImgSrc[ ch*src_plane + iPosSrc ]);
+
+        //Interpolating between the pixels:
+        //.. p1 p2 ..
+        //.. p3 p4 ..
+        float     p1 = *(ptr);
+        float     p2 = *(ptr + 1);
+        float     p3 = *(ptr + src_pitch);
+        float     p4 = *(ptr + src_pitch + 1);
+
+        float   du = u - iu;
+        float   dv = v - iv;
+
+        float   du_inv = 1.0f - du;
+
+        float validPixels = 4.0f;
+        if (isDepthImage) {
+            validPixels = (p1 > 0) + (p2 > 0) + (p3 > 0) + (p4 > 0);
+        }
+        if ( validPixels > 0) {
+                pImgDst[ ch*dst_plane + iPosDst ] = 4.0f / validPixels
+                                                               * ( (1.0f - dv) * ( p1 * du_inv + p2 * du ) +
+                                                                           dv  * ( p3 * du_inv + p4 * du ) );
+        } else {
+                pImgDst[ ch*dst_plane + iPosDst ] = 0.0f;
+        }
+      }//for all channels
+    }
+  }
+}
+
+
+
+
+
+//############################################################################
+/**
+ * Host version of imresize_CUDA. Gray images get a Gaussian blur before the
+ * bilinear downscaling, depth images are averaged over their valid pixels.
+ * The blur and the interpolation are one polyphase filter (see DownscaleAxis),
+ * with no full resolution intermediate image.
+ * @param  pImgTmp  Scratch storage of at least
+ *                  src_height*image_pitch(dst_width) floats, so that no
+ *                  allocation happens per call.
+ */
+template<typename SrcWidth, typename SrcHeight, typename DstWidth, typename DstHeight>
+void  imresize_CPU( const float   *pImgSrc,
+                    float         *pImgDst,
+                    float         *pImgTmp,
+                    SrcWidth      src_width,
+                    SrcHeight     src_height,
+                    DstWidth      dst_width,
+                    DstHeight     dst_height,
+                    int           channels,
+                    bool          isDepthImage )
+{
+  // If the images are having exactly the same size, do no interpolation and
+  // just copy the image
+  if ( ( src_width == dst_width )  && ( src_height == dst_height ) )
+  {
+    const int  origin = image_origin( src_width, false );
+    memcpy( pImgDst - origin, pImgSrc - origin, image_size( src_width, src_height, false ) * channels * sizeof(float) );
+    return;
+  }
+
+  bool    fUsePixCenter = true;
+
+  // Image Downscaling? => Apply Gaussian blur beforehand. Only if it is NOT a DEPTH image.
+  if ( ( dst_width  < src_width ) && ( dst_height < src_height ) && (!isDepthImage) )
+  {
+    float     scaleFactorX = (float)dst_width  / (float)src_width;
+    float     scaleFactorY = (float)dst_height / (float)src_height;
+    float     scaleFactor  = std::min<float>( scaleFactorX, scaleFactorY );
+
+    // Same choice of Gaussian parameters as imresize_CUDA
+    float   sigma  = 0.5f * sqrt( (1/scaleFactor)*(1/scaleFactor) - 1.0f );
+    int     radius = (int)std::round( 3.0f * sigma );
+
+    // The blur is only evaluated where the bilinear interpolation reads it:
+    // a horizontal pass over every source row at the destination columns,
+    // then a vertical pass at the destination rows, see DownscaleAxis
+    const DownscaleAxis  &axis_x = downscale_axis( src_width,  dst_width,  sigma, radius );
+    const DownscaleAxis  &axis_y = downscale_axis( src_height, dst_height, sigma, radius );
+    const int    taps      = axis_x.taps;
+    const int    src_pitch = image_pitch( src_width );
+    const int    dst_pitch = image_pitch( dst_width );
+    const int    src_plane = image_size( src_width, src_height, false );
+    const int    dst_plane = image_size( dst_width, dst_height, false );
+    // dst_width x src_height, pitched as the destination
+    float   *I_tmp = pImgTmp;
+
+    for ( int ch=0; ch<channels; ch++ )
+    {
+      const float  *src = &pImgSrc[ src_plane * ch ];
+      float        *dst = &pImgDst[ dst_plane * ch ];
+
+      #pragma omp parallel for
+      for ( int y=0; y<src_height; y++ )
+      {
+        for ( int x=0; x<dst_width; x++ )
+        {
+          const int    *index  = &axis_x.index[ x*taps ];
+          const float  *weight = &axis_x.weight[ x*taps ];
+          float   result = 0.0f;
+          for ( int k=0; k<taps; k++ )
+            result += weight[k] * src[ y*src_pitch + index[k] ];
+          I_tmp[ y*dst_pitch + x ] = result;
+        }
+      }
+
+      #pragma omp parallel for
+      for ( int y=0; y<dst_height; y++ )
+      {
+        const int    *index  = &axis_y.index[ y*taps ];
+        const float  *weight = &axis_y.weight[ y*taps ];
+        float        *row    = &dst[ y*dst_pitch ];
+        for ( int x=0; x<dst_width; x++ )
+          row[x] = 0.0f;
+        for ( int k=0; k<taps; k++ )
+        {
+          const float  *tmp = &I_tmp[ index[k]*dst_pitch ];
+          for ( int x=0; x<dst_width; x++ )
+            row[x] += weight[k] * tmp[x];
+        }
+      }
+    }
+  }
+  else
+  {
+    scaleImage_CPU( pImgSrc, pImgDst,
+                    src_width, src_height,
+                    dst_width, dst_height,
+                    channels, fUsePixCenter, isDepthImage );
+  }
+}
+
+//############################################################################
+// Pyramid downscaling by exactly 2, the case of every pyramid level
+
+// Taps of the filter of downsample2x_gray_CPU: the 7 taps of the Gaussian of
+// imresize_CPU at scale 1/2 (sigma = sqrt(3)/2, radius 3) convolved with the
+// 2 taps of the bilinear interpolation at the pixel centers
+#define DOWNSAMPLE2X_TAPS 8
+
+/**
+ * Filter of downsample2x_gray_CPU. Output pixel x is the sum of
+ * filter[i] * input pixel 2x - 3 + i.
+ */
+inline void downsample2x_filter( float *filter ) {
+    // same choice of Gaussian parameters as imresize_CPU at scale 1/2
+    const float  sigma  = 0.5f * sqrt( 2.0f*2.0f - 1.0f );
+    const int    radius = (DOWNSAMPLE2X_TAPS - 2) / 2;
+    const float  *gauss = gaussian_coefficients( sigma, radius );
+    // output pixel x is the average of the blurred pixels 2x and 2x + 1
+    for (int i = 0; i < DOWNSAMPLE2X_TAPS; i++)
+        filter[i] = 0.5f * ( (i < DOWNSAMPLE2X_TAPS - 1 ? gauss[i] : 0.0f) + (i > 0 ? gauss[i - 1] : 0.0f) );
+}
+
+// sum of filter[i] * img[clamp(first + i) * stride], clamped to [0, n-1]
+inline float downsample2x_clamped( const float *img, int first, int n, int stride, const float *filter ) {
+    float result = 0.0f;
+    for (int i = 0; i < DOWNSAMPLE2X_TAPS; i++)
+        result += filter[i] * img[ std::min( std::max( first + i, 0 ), n-1 ) * stride ];
+    return result;
+}
+
+/**
+ * Horizontal pass of downsample2x_gray_CPU over an input row of
+ * 2*dst_width pixels, at its even columns.
+ */
+template<typename Width>
+inline void  downsample2x_row( const float *src, float *tmp, Width dst_width, const float *f )
+{
+    const int src_width = 2 * dst_width;
+    // the outputs whose taps are all inside the input
+    const int inner_begin = std::min<int>(2, dst_width);
+    const int inner_end = std::max<int>(inner_begin, dst_width - 2);
+    for (int x = 0; x < inner_begin; x++)
+        tmp[x] = downsample2x_clamped(src, 2*x - 3, src_width, 1, f);
+    for (int x = inner_begin; x < inner_end; x++) {
+        const float *s = &src[2*x - 3];
+        tmp[x] = f[0]*s[0] + f[1]*s[1] + f[2]*s[2] + f[3]*s[3] + f[4]*s[4] + f[5]*s[5] + f[6]*s[6] + f[7]*s[7];
+    }
+    for (int x = inner_end; x < dst_width; x++)
+        tmp[x] = downsample2x_clamped(src, 2*x - 3, src_width, 1, f);
+}
+
+/**
+ * Vertical pass of downsample2x_gray_CPU for output row y, from the horizontal
+ * passes of the input rows 2y - 3 to 2y + 4, clamped to the image.
+ */
+template<typename Width>
+inline void  downsample2x_column( const float *const *rows, float *dst, Width dst_width, const float *f )
+{
+    for (int x = 0; x < dst_width; x++)
+        dst[x] = f[0]*rows[0][x] + f[1]*rows[1][x] + f[2]*rows[2][x] + f[3]*rows[3][x]
+               + f[4]*rows[4][x] + f[5]*rows[5][x] + f[6]*rows[6][x] + f[7]*rows[7][x];
+}
+
+/**
+ * downsample2x_depth_CPU of the output row of the input rows src0 and src1.
+ */
+template<typename Width>
+inline void  downsample2x_depth_row( const float *src0, const float *src1, float *dst, Width dst_width )
+{
+    for (int x = 0; x < dst_width; x++) {
+        const float p1 = src0[2*x], p2 = src0[2*x + 1];
+        const float p3 = src1[2*x], p4 = src1[2*x + 1];
+        const float valid = (float)((p1 > 0) + (p2 > 0) + (p3 > 0) + (p4 > 0));
+        // the expression of scaleImage_CPU with weights 1/2, rounded the same way
+        dst[x] = valid > 0 ? 4.0f / valid * ( 0.25f * (p1 + p2) + 0.25f * (p3 + p4) ) : 0.0f;
+    }
+}
+
+/**
+ * Downscales a gray image by 2: imresize_CPU from (2*dst_width) x (2*dst_height),
+ * up to rounding. Its Gaussian blur and bilinear interpolation at the pixel
+ * centers are one separable filter of DOWNSAMPLE2X_TAPS taps (see
+ * downsample2x_filter), only evaluated at the output pixels: a horizontal pass
+ * over every input row at the even columns, then a vertical pass at the even
+ * rows. Both are parallelized over bands of rows and vectorize, and the borders
+ * are replicated.
+ * @param  pImgSrc    Input image, of which the first (2*dst_width) x (2*dst_height)
+ *                    pixels are read: the last column and row of odd sizes are left out
+ * @param  pImgDst    Output image
+ * @param  pImgTmp    Scratch storage of at least 2*dst_height*image_pitch(dst_width)
+ *                    floats, so that no allocation happens per call
+ * @param  src_width  Width of pImgSrc, 2*dst_width or 2*dst_width+1, which sets its pitch
+ */
+template<typename SrcWidth, typename Width, typename Height>
+void  downsample2x_gray_CPU( const float   *pImgSrc,
+                             float         *pImgDst,
+                             float         *pImgTmp,
+                             SrcWidth      src_width,
+                             Width         dst_width,
+                             Height        dst_height )
+{
+    const int src_height = 2 * dst_height;
+    const int src_pitch = image_pitch( src_width );
+    const int dst_pitch = image_pitch( dst_width );
+    float f[DOWNSAMPLE2X_TAPS];
+    downsample2x_filter(f);
+
+    // Horizontal pass, into pImgTmp of dst_width x src_height
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < src_height; y++)
+        downsample2x_row(&pImgSrc[y * src_pitch], &pImgTmp[y * dst_pitch], dst_width, f);
+
+    // Vertical pass
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < dst_height; y++) {
+        const float *rows[DOWNSAMPLE2X_TAPS];
+        for (int i = 0; i < DOWNSAMPLE2X_TAPS; i++)
+            rows[i] = &pImgTmp[ std::min( std::max( 2*y - 3 + i, 0 ), src_height-1 ) * dst_pitch ];
+        downsample2x_column(rows, &pImgDst[y * dst_pitch], dst_width, f);
+    }
+}
+
+/**
+ * Downscales a depth image by 2: imresize_CPU from (2*dst_width) x (2*dst_height),
+ * with the same results. Every output pixel is the average of the valid
+ * (nonzero) pixels of its 2x2 block, 0 if there are none. Parallelized over
+ * bands of rows.
+ * @param  pImgSrc    Input image, of which the first (2*dst_width) x (2*dst_height)
+ *                    pixels are read, see downsample2x_gray_CPU
+ * @param  pImgDst    Output image
+ * @param  src_width  Width of pImgSrc, 2*dst_width or 2*dst_width+1, which sets its pitch
+ */
+template<typename SrcWidth, typename Width, typename Height>
+void  downsample2x_depth_CPU( const float   *pImgSrc,
+                              float         *pImgDst,
+                              SrcWidth      src_width,
+                              Width         dst_width,
+                              Height        dst_height )
+{
+    const int src_pitch = image_pitch( src_width );
+    const int dst_pitch = image_pitch( dst_width );
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < dst_height; y++)
+        downsample2x_depth_row(&pImgSrc[2*y * src_pitch], &pImgSrc[(2*y + 1) * src_pitch], &pImgDst[y * dst_pitch], dst_width);
+}
+
+//############################################################################
+// Fixed point gray planes of the current frame, see h_sample_fixed
+
+// Fractional bits per gray level of the fixed point planes. A gray value in
+// [0, 1] is stored as gray * FIXED_SCALE, at most 255 << FIXED_SHIFT = 32640:
+// one bit short of 8.8, so that the values and their differences are valid
+// signed 16 bit operands of pmaddwd
+#define FIXED_SHIFT 7
+#define FIXED_SCALE (255.0f * (1 << FIXED_SHIFT))
+// Fractional bits of the taps of downsample2x_fixed_CPU
+#define FIXED_FILTER_BITS 14
+
+/**
+ * Converts an array of gray values to fixed point, rounded to nearest, e.g.
+ * the whole storage of an image with its guard band (see PitchedImage::begin),
+ * which needs no replicating afterwards.
+ * @param  *pSrc  Input array of n floats in [0, 1]
+ * @param  *pDst  Output array of n fixed point values, see FIXED_SHIFT
+ * @param  n      Number of values
+ */
+void  float_to_fixed_CPU( const float   *pSrc,
+                          uint16_t      *pDst,
+                          int           n)
+{
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++)
+        pDst[i] = (uint16_t)( std::min( std::max( pSrc[i], 0.0f ), 1.0f ) * FIXED_SCALE + 0.5f );
+}
+
+/**
+ * downsample2x_filter in FIXED_FILTER_BITS fixed point. The taps are rounded
+ * to nearest and the largest one takes the rounding error, so that they add
+ * up to exactly 1 and a constant image stays constant.
+ */
+inline void downsample2x_fixed_filter( int32_t *filter ) {
+    float f[DOWNSAMPLE2X_TAPS];
+    downsample2x_filter(f);
+    int32_t sum = 0;
+    for (int i = 0; i < DOWNSAMPLE2X_TAPS; i++) {
+        filter[i] = (int32_t)lrintf( f[i] * (1 << FIXED_FILTER_BITS) );
+        sum += filter[i];
+    }
+    filter[ std::max_element( filter, filter + DOWNSAMPLE2X_TAPS ) - filter ] += (1 << FIXED_FILTER_BITS) - sum;
+}
+
+// sum of filter[i] * img[i * stride], rounded back to the fixed point of img.
+// The taps are positive and add up to 1, so the result is within the range of img
+inline uint16_t downsample2x_fixed_taps( const uint16_t *img, int stride, const int32_t *filter ) {
+    int32_t result = 1 << (FIXED_FILTER_BITS - 1);
+    for (int i = 0; i < DOWNSAMPLE2X_TAPS; i++)
+        result += filter[i] * img[i * stride];
+    return (uint16_t)(result >> FIXED_FILTER_BITS);
+}
+
+// downsample2x_fixed_taps of img[clamp(first + i) * stride], clamped to [0, n-1]
+inline uint16_t downsample2x_fixed_clamped( const uint16_t *img, int first, int n, int stride, const int32_t *filter ) {
+    uint16_t s[DOWNSAMPLE2X_TAPS];
+    for (int i = 0; i < DOWNSAMPLE2X_TAPS; i++)
+        s[i] = img[ std::min( std::max( first + i, 0 ), n-1 ) * stride ];
+    return downsample2x_fixed_taps(s, 1, filter);
+}
+
+/**
+ * Horizontal pass of downsample2x_fixed_CPU over an input row of
+ * 2*dst_width pixels, at its even columns, see downsample2x_row.
+ */
+template<typename Width>
+inline void  downsample2x_fixed_row( const uint16_t *src, uint16_t *tmp, Width dst_width, const int32_t *f )
+{
+    const int src_width = 2 * dst_width;
+    const int inner_begin = std::min<int>(2, dst_width);
+    const int inner_end = std::max<int>(inner_begin, dst_width - 2);
+    for (int x = 0; x < inner_begin; x++)
+        tmp[x] = downsample2x_fixed_clamped(src, 2*x - 3, src_width, 1, f);
+    for (int x = inner_begin; x < inner_end; x++)
+        tmp[x] = downsample2x_fixed_taps(&src[2*x - 3], 1, f);
+    for (int x = inner_end; x < dst_width; x++)
+        tmp[x] = downsample2x_fixed_clamped(src, 2*x - 3, src_width, 1, f);
+}
+
+/**
+ * Downscales a fixed point gray image by 2: downsample2x_gray_CPU in integer
+ * arithmetic, with the taps of downsample2x_fixed_filter. Each pass rounds
+ * back to the fixed point of the image, so the result is within half a unit
+ * (1/FIXED_SCALE) per pass of downsample2x_gray_CPU of the same image, and the
+ * levels of a pyramid can be downscaled from each other without going
+ * through float.
+ * @param  pImgSrc    Input image, of which the first (2*dst_width) x (2*dst_height)
+ *                    pixels are read, see downsample2x_gray_CPU
+ * @param  pImgDst    Output image
+ * @param  pImgTmp    Scratch storage of at least 2*dst_height*image_pitch(dst_width) values
+ * @param  src_width  Width of pImgSrc, 2*dst_width or 2*dst_width+1, which sets its pitch
+ */
+template<typename SrcWidth, typename Width, typename Height>
+void  downsample2x_fixed_CPU( const uint16_t  *pImgSrc,
+                              uint16_t        *pImgDst,
+                              uint16_t        *pImgTmp,
+                              SrcWidth        src_width,
+                              Width           dst_width,
+                              Height          dst_height )
+{
+    const int src_height = 2 * dst_height;
+    const int src_pitch = image_pitch( src_width );
+    const int dst_pitch = image_pitch( dst_width );
+    int32_t f[DOWNSAMPLE2X_TAPS];
+    downsample2x_fixed_filter(f);
+
+    // Horizontal pass, into pImgTmp of dst_width x src_height
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < src_height; y++)
+        downsample2x_fixed_row(&pImgSrc[y * src_pitch], &pImgTmp[y * dst_pitch], dst_width, f);
+
+    // Vertical pass
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < dst_height; y++) {
+        uint16_t *dst = &pImgDst[y * dst_pitch];
+        if (2*y - 3 >= 0 && 2*y + 4 < src_height) {
+            const uint16_t *taps = &pImgTmp[(2*y - 3) * dst_pitch];
+            for (int x = 0; x < dst_width; x++)
+                dst[x] = downsample2x_fixed_taps(&taps[x], dst_pitch, f);
+        } else {
+            for (int x = 0; x < dst_width; x++)
+                dst[x] = downsample2x_fixed_clamped(&pImgTmp[x], 2*y - 3, src_height, dst_pitch, f);
+        }
+    }
+}
+
+// Floats per texel of the interleaved layout: gray, horizontal and vertical
+// derivatives and padding, so that a texel is 16 bytes and never straddles
+// two cache lines
+#define TEXEL_SIZE 4
+
+/**
+ * Derivatives of the pixel at position ind of a pitched image, centered in the
+ * inside and one sided on the edges: the formula of image_derivatives_CPU,
+ * also used to compute them on the fly where the derivative planes are not
+ * stored (see GRADIENTS_ON_THE_FLY in common.h). Reads the guard band at the
+ * edges, which replicates them.
+ */
+inline void central_differences( const float *img, int ind, int pitch, float &dx, float &dy ) {
+    dx = ( img[ind + 1]     - img[ind - 1] )*0.5f;
+    dy = ( img[ind + pitch] - img[ind - pitch] )*0.5f;
+}
+
+/**
+ * Host version of compute_image_derivatives_CUDA. Derivatives are centered in
+ * the inside and respectively sided on the edges. The one sided differences
+ * come from the guard band of pImgSrc, which replicates the edge, so the loop
+ * has no special case for them.
+ * @param  *pImgSrc     Input image with its guard band filled
+ * @param  *pImgDX      Output image of horizontal derivatives. NULL to only fill pTexels
+ * @param  *pImgDY      Output image of vertical derivatives. NULL to only fill pTexels
+ * @param  width
+ * @param  height
+ * @param  *pTexels     Optional output image of TEXEL_SIZE floats per pixel,
+ *                      the image and both derivatives interleaved as
+ *                      {I, dx, dy, 0}, see h_sample_texels. NULL to skip it
+ * @param  tiled        Layout of pTexels, see texel_index
+ */
+template<typename Width, typename Height>
+void  image_derivatives_CPU( const float   *pImgSrc,
+                             float         *pImgDX,
+                             float         *pImgDY,
+                             Width         w,
+                             Height        h,
+                             float         *pTexels = NULL,
+                             bool          tiled = false)
+{
+    const int pitch = image_pitch(w);
+    #pragma omp parallel for
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int ind = x + y * pitch;
+            float dx, dy;
+            central_differences(pImgSrc, ind, pitch, dx, dy);
+            if (pImgDX) {
+                pImgDX[ind] = dx;
+                pImgDY[ind] = dy;
+            }
+            if (pTexels) {
+                float *texel = &pTexels[TEXEL_SIZE * texel_index(x, y, w, tiled)];
+                texel[0] = pImgSrc[ind];
+                texel[1] = dx;
+                texel[2] = dy;
+                texel[3] = 0.0f;
+            }
+        }
+    }
+}
+
+//############################################################################
+// Ingestion of decoded frames
+
+// rows of level 0 per band of ingest_CPU. Every band is streamed by one thread
+#define INGEST_BAND_ROWS 64
+
+/**
+ * Converts row y of a decoded frame into rows of floats (see GRAY_SCALE and
+ * DEPTH_SCALE), and fills the left and right guard band of the gray one.
+ * The fixed point row, if any, is the 8 bit gray shifted by FIXED_SHIFT,
+ * which is exactly gray * FIXED_SCALE.
+ */
+template<typename Width>
+inline void  ingest_row( const RawFrame &frame, int y, float *gray, float *depth, uint16_t *fixed, Width w )
+{
+    const uint8_t   *gray8   = frame.grayRow(y);
+    const uint16_t  *depth16 = frame.depthRow(y);
+    for (int x = 0; x < w; x++) {
+        gray[x]  = gray8[x] * GRAY_SCALE;
+        depth[x] = depth16[x] * DEPTH_SCALE;
+    }
+    for (int g = 1; g <= IMAGE_GUARD; g++) {
+        gray[-g] = gray[0];
+        gray[w - 1 + g] = gray[w - 1];
+    }
+    if (fixed) {
+        for (int x = 0; x < w; x++)
+            fixed[x] = (uint16_t)(gray8[x] << FIXED_SHIFT);
+    }
+}
+
+/**
+ * Derivatives of row y of a gray image whose rows are filled with their left
+ * and right guard band, as image_derivatives_CPU.
+ */
+template<typename Width>
+inline void  ingest_derivatives( const float *gray, float *dX, float *dY, int y, Width w, int h )
+{
+    const int    pitch = image_pitch(w);
+    const float  *up   = &gray[ std::max(y - 1, 0) * pitch ];
+    const float  *row  = &gray[ y * pitch ];
+    const float  *down = &gray[ std::min(y + 1, h - 1) * pitch ];
+    float  *dx = &dX[ y * pitch ];
+    float  *dy = &dY[ y * pitch ];
+    for (int x = 0; x < w; x++) {
+        dx[x] = ( row[x + 1] - row[x - 1] )*0.5f;
+        dy[x] = ( down[x]    - up[x] )*0.5f;
+    }
+}
+
+/**
+ * Row y of the gray image of level 1, from the horizontal passes of the rows of level 0, see downsample2x_column.
+ */
+template<typename Width>
+inline void  ingest_level1( const float *tmp, float *gray1, int y, Width w1, int rows, const float *f )
+{
+    const int    pitch1 = image_pitch(w1);
+    const float  *taps[DOWNSAMPLE2X_TAPS];
+    for (int i = 0; i < DOWNSAMPLE2X_TAPS; i++)
+        taps[i] = &tmp[ std::min( std::max( 2*y - 3 + i, 0 ), rows - 1 ) * pitch1 ];
+    downsample2x_column(taps, &gray1[y * pitch1], w1, f);
+}
+
+/**
+ * Fills level 0 of a pyramid (gray, depth, derivatives and fixed point gray)
+ * and the gray and depth of level 1 from a frame as decoded, in one pass over it instead of
+ * converting the frame, copying it into level 0 and then computing the
+ * derivatives and level 1 in passes of their own. Same results as those:
+ * image_derivatives_CPU, downsample2x_gray_CPU and downsample2x_depth_CPU.
+ *
+ * Every band of INGEST_BAND_ROWS rows is streamed by one thread, which
+ * converts a row and its horizontal pass of level 1, and a few rows behind
+ * it, while they are still in cache, the derivatives and the rows of level 1
+ * that only read rows of the band. The few rows next to the other bands are
+ * left for a second pass.
+ *
+ * Outputs are written without their guard band, see PitchedImage::replicate_border.
+ * @param  frame     Decoded frame of w x h pixels
+ * @param  pGray     Output image. Gray of level 0
+ * @param  pDepth    Output image. Depth of level 0
+ * @param  pGrayDX   Output image. Horizontal derivatives of level 0. NULL to skip the derivatives
+ * @param  pGrayDY   Output image. Vertical derivatives of level 0
+ * @param  pGrayFixed  Output image. Gray of level 0 in fixed point, see FIXED_SHIFT. NULL to skip it
+ * @param  pGray1    Output image. Gray of level 1, of (w/2) x (h/2) pixels. NULL to skip level 1
+ * @param  pDepth1   Output image. Depth of level 1
+ * @param  pImgTmp   Scratch storage of at least h*image_pitch(w/2) floats
+ */
+template<typename Width, typename Height>
+void  ingest_CPU( const RawFrame  &frame,
+                  float           *pGray,
+                  float           *pDepth,
+                  float           *pGrayDX,
+                  float           *pGrayDY,
+                  uint16_t        *pGrayFixed,
+                  float           *pGray1,
+                  float           *pDepth1,
+                  float           *pImgTmp,
+                  Width           w,
+                  Height          h )
+{
+    const int pitch = image_pitch(w);
+    const int w1 = w / 2, h1 = h / 2;
+    const int pitch1 = image_pitch(w1);
+    // rows of level 0 read by level 1
+    const int rows1 = 2 * h1;
+    float f[DOWNSAMPLE2X_TAPS];
+    downsample2x_filter(f);
+    const int bands = (h + INGEST_BAND_ROWS - 1) / INGEST_BAND_ROWS;
+
+    #pragma omp parallel
+    {
+        // Streaming pass
+        #pragma omp for schedule(static)
+        for (int band = 0; band < bands; band++) {
+            const int r0 = band * INGEST_BAND_ROWS;
+            const int r1 = std::min<int>(r0 + INGEST_BAND_ROWS, h);
+            // next row of level 1 of the band, those of the rows 2y in [r0, r1)
+            int y = (r0 + 1) / 2;
+            const int y_end = std::min((r1 + 1) / 2, h1);
+            for (int r = r0; r < r1; r++) {
+                ingest_row(frame, r, &pGray[r * pitch], &pDepth[r * pitch], pGrayFixed ? &pGrayFixed[r * pitch] : NULL, w);
+                if (pGray1 && r < rows1)
+                    downsample2x_row(&pGray[r * pitch], &pImgTmp[r * pitch1], w1, f);
+                if (pDepth1 && (r & 1) && r < rows1)
+                    downsample2x_depth_row(&pDepth[(r - 1) * pitch], &pDepth[r * pitch], &pDepth1[(r / 2) * pitch1], w1);
+                // the rows whose last row read is r
+                if (pGrayDX) {
+                    for (int q = std::max(r - 1, r0); q <= r; q++)
+                        if (std::min(q + 1, h - 1) == r && std::max(q - 1, 0) >= r0)
+                            ingest_derivatives(pGray, pGrayDX, pGrayDY, q, w, h);
+                }
+                for (; pGray1 && y < y_end && std::min(2*y + 4, rows1 - 1) <= r; y++)
+                    if (std::max(2*y - 3, 0) >= r0)
+                        ingest_level1(pImgTmp, pGray1, y, w1, rows1, f);
+            }
+        }
+
+        // Rows that read the rows of the neighbouring bands
+        #pragma omp for schedule(static)
+        for (int band = 0; band < bands; band++) {
+            const int r0 = band * INGEST_BAND_ROWS;
+            const int r1 = std::min<int>(r0 + INGEST_BAND_ROWS, h);
+            for (int q = r0; q < r1 && pGrayDX; q++)
+                if (std::max(q - 1, 0) < r0 || std::min(q + 1, h - 1) >= r1)
+                    ingest_derivatives(pGray, pGrayDX, pGrayDY, q, w, h);
+            for (int y = (r0 + 1) / 2; y < std::min((r1 + 1) / 2, h1) && pGray1; y++)
+                if (std::max(2*y - 3, 0) < r0 || std::min(2*y + 4, rows1 - 1) >= r1)
+                    ingest_level1(pImgTmp, pGray1, y, w1, rows1, f);
+        }
+    }
+}
+
+//############################################################################
+// Half precision storage, see half.hpp
+
+/**
+ * Converts an array to half precision, e.g. the whole storage of an image
+ * with its guard band (see PitchedImage::begin), which needs no replicating
+ * afterwards.
+ * @param  *pSrc  Input array of n floats
+ * @param  *pDst  Output array of n halves
+ * @param  n      Number of values
+ */
+void  float_to_half_CPU( const float   *pSrc,
+                         half_t        *pDst,
+                         int           n)
+{
+#if CPU_HAS_F16C
+    const int n8 = n & ~7;
+    #pragma omp parallel for
+    for (int i = 0; i < n8; i += 8)
+        _mm_storeu_si128( (__m128i *)&pDst[i], _mm256_cvtps_ph( _mm256_loadu_ps(&pSrc[i]), 0 ) );
+    for (int i = n8; i < n; i++)
+        pDst[i] = h_float_to_half( pSrc[i] );
+#else
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++)
+        pDst[i] = h_float_to_half( pSrc[i] );
+#endif
+}
+
+/**
+ * Derivatives of an image straight to half precision planes, the formula of
+ * image_derivatives_CPU without float planes in between. Only the inside is
+ * written, the guard band has to be replicated afterwards.
+ * @param  *pImgSrc   Input image with its guard band filled
+ * @param  *pImgDX    Output image of horizontal derivatives in half precision
+ * @param  *pImgDY    Output image of vertical derivatives in half precision
+ * @param  w          Image width
+ * @param  h          Image height
+ */
+template<typename Width, typename Height>
+void  image_derivatives_half_CPU( const float   *pImgSrc,
+                                  half_t        *pImgDX,
+                                  half_t        *pImgDY,
+                                  Width         w,
+                                  Height        h)
+{
+    const int pitch = image_pitch(w);
+    #pragma omp parallel for
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int ind = x + y * pitch;
+            float dx, dy;
+            central_differences(pImgSrc, ind, pitch, dx, dy);
+            pImgDX[ind] = h_float_to_half( dx );
+            pImgDY[ind] = h_float_to_half( dy );
+        }
+    }
+}
+
+/**
+ * Interleaves an image and its derivatives into half precision texels of
+ * TEXEL_SIZE halves {I, dx, dy, 0}, the half counterpart of the pTexels output
+ * of image_derivatives_CPU.
+ * @param  *pImg      Input image, with its guard band filled if there are no derivatives
+ * @param  *pImgDX    Input horizontal derivatives. NULL to compute them from pImg, see central_differences
+ * @param  *pImgDY    Input vertical derivatives. NULL to compute them from pImg
+ * @param  *pTexels   Output image of TEXEL_SIZE halves per pixel
+ * @param  w          Image width
+ * @param  h          Image height
+ * @param  tiled      Layout of pTexels, see texel_index
+ */
+template<typename Width, typename Height>
+void  interleave_half_CPU( const float   *pImg,
+                           const float   *pImgDX,
+                           const float   *pImgDY,
+                           half_t        *pTexels,
+                           Width         w,
+                           Height        h,
+                           bool          tiled = false)
+{
+    const int pitch = image_pitch(w);
+    #pragma omp parallel for
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int i = x + y * pitch;
+            float dx, dy;
+            if (pImgDX) { dx = pImgDX[i]; dy = pImgDY[i]; }
+            else central_differences(pImg, i, pitch, dx, dy);
+            half_t *texel = &pTexels[TEXEL_SIZE * texel_index(x, y, w, tiled)];
+            texel[0] = h_float_to_half( pImg[i] );
+            texel[1] = h_float_to_half( dx );
+            texel[2] = h_float_to_half( dy );
+            texel[3] = 0;
+        }
+    }
+}
+
+//############################################################################
+// Semi-dense pixel selection
+
+// side of the square blocks of the selection, in pixels
+#define SELECTION_BLOCK_SIZE 16
+// levels with less pixels than this are kept dense, and the levels above it
+// keep at least this many pixels, whatever the density
+#define SELECTION_MIN_PIXELS 3000
+// pixels with a smaller gradient magnitude are never selected (intensities in [0, 1])
+#define SELECTION_MIN_GRADIENT (2.0f / 255.0f)
+
+/**
+ * Density (fraction of the pixels with depth kept) of a level of n pixels for
+ * the requested density. 1 means the level is aligned dense, without a pixel
+ * list.
+ */
+inline float selection_density( float density, int n ) {
+        return std::min(1.0f, std::max(density, (float)SELECTION_MIN_PIXELS / n));
+}
+
+/**
+ * Semi-dense selection of the pixels of a reference level. In every block of
+ * SELECTION_BLOCK_SIZE x SELECTION_BLOCK_SIZE pixels it keeps the
+ * ceil(density * m) pixels with the largest gradient magnitude, where m is
+ * the number of pixels with depth in the block. Pixels without depth or with
+ * a gradient magnitude below SELECTION_MIN_GRADIENT are never kept. Working
+ * per block spreads the pixels over the whole image: a textured area cannot
+ * take all of them, and weakly textured areas keep their strongest edges.
+ * Ties are broken by pixel index, as in select_pixels_CUDA, so both
+ * backends select the same pixels.
+ * @param  pixels   Output. Indices x + y*w of the selected pixels in row-major order
+ *                  (not pitched), up to w*h.
+ * @param  depth    Depth image
+ * @param  gray     Gray image, with its guard band filled. Only read without derivatives
+ * @param  dX       Horizontal derivatives of gray. NULL to compute them from gray, see central_differences
+ * @param  dY       Vertical derivatives of gray. NULL to compute them from gray
+ * @param  density  Fraction of the pixels with depth to keep, see selection_density
+ * @return          Number of selected pixels
+ */
+template<typename Width, typename Height>
+int  select_pixels_CPU( int           *pixels,
+                        const float   *depth,
+                        const float   *gray,
+                        const float   *dX,
+                        const float   *dY,
+                        Width         w,
+                        Height        h,
+                        float         density)
+{
+    const float min_mag2 = SELECTION_MIN_GRADIENT * SELECTION_MIN_GRADIENT;
+    const int pitch = image_pitch(w);
+    const int blocks_x = (w + SELECTION_BLOCK_SIZE - 1) / SELECTION_BLOCK_SIZE;
+    const int blocks_y = (h + SELECTION_BLOCK_SIZE - 1) / SELECTION_BLOCK_SIZE;
+
+    // per block, the worst selected (squared magnitude, index). Nothing is selected below it
+    std::vector< std::pair<float, int> > threshold(blocks_x * blocks_y);
+
+    #pragma omp parallel
+    {
+        std::vector< std::pair<float, int> > candidates;
+        candidates.reserve(SELECTION_BLOCK_SIZE * SELECTION_BLOCK_SIZE);
+
+        #pragma omp for
+        for (int block = 0; block < blocks_x * blocks_y; block++) {
+            const int x0 = (block % blocks_x) * SELECTION_BLOCK_SIZE;
+            const int y0 = (block / blocks_x) * SELECTION_BLOCK_SIZE;
+            int valid = 0;
+            candidates.clear();
+            for (int y = y0; y < std::min<int>(y0 + SELECTION_BLOCK_SIZE, h); y++) {
+                for (int x = x0; x < std::min<int>(x0 + SELECTION_BLOCK_SIZE, w); x++) {
+                    int p = x + y * pitch;
+                    if (depth[p] == 0) continue;
+                    valid++;
+                    float dx, dy;
+                    if (dX) { dx = dX[p]; dy = dY[p]; }
+                    else central_differences(gray, p, pitch, dx, dy);
+                    float mag2 = dx*dx + dy*dy;
+                    if (mag2 >= min_mag2) candidates.push_back(std::make_pair(-mag2, x + y * w));
+                }
+            }
+            int keep = std::min( (int)std::ceil(density * valid), (int)candidates.size() );
+            if (keep == 0) {
+                threshold[block] = std::make_pair(std::numeric_limits<float>::infinity(), -1);   // nothing
+                continue;
+            }
+            // ascending (-magnitude, index) is the selection order
+            std::nth_element(candidates.begin(), candidates.begin() + keep-1, candidates.end());
+            threshold[block] = std::make_pair(-candidates[keep-1].first, candidates[keep-1].second);
+        }
+    }
+
+    // keep the row-major order of the pixels, for the locality of the alignment
+    int n = 0;
+    for (int y = 0; y < h; y++) {
+        const std::pair<float, int> *row_threshold = &threshold[(y / SELECTION_BLOCK_SIZE) * blocks_x];
+        for (int x = 0; x < w; x++) {
+            int ind = x + y * w;
+            int p = x + y * pitch;
+            if (depth[p] == 0) continue;
+            const std::pair<float, int> &thr = row_threshold[x / SELECTION_BLOCK_SIZE];
+            float dx, dy;
+            if (dX) { dx = dX[p]; dy = dY[p]; }
+            else central_differences(gray, p, pitch, dx, dy);
+            float mag2 = dx*dx + dy*dy;
+            if (mag2 > thr.first || (mag2 == thr.first && ind <= thr.second))
+                pixels[n++] = ind;
+        }
+    }
+    return n;
+}
+
+//############################################################################
+// Point cloud of the first frame
+
+/**
+ * Back-projects the pixels to align of a level into 3D points,
+ * K_inv * (x, y, 1) * d, stored as separate arrays of coordinates (SoA) and
+ * compacted over valid depth: pixels without depth get no point. The points
+ * keep the order of the pixels. Built once per frame, when it becomes the
+ * first one, so that the iterations only rotate and translate them.
+ * @param  X, Y, Z      Output. Coordinates of up to n points
+ * @param  pointPixels  Output. Pitched position (see image.hpp) of the pixel of
+ *                      every point, to read the images of the first frame
+ * @param  pixels       Indices x + y*w of the pixels to back-project, see
+ *                      select_pixels_CPU. NULL for all of them
+ * @param  n            Entries of pixels, or w*h
+ * @param  depth        Depth image
+ * @param  K_inv        Inverse intrinsic matrix of the level, stored column-wise
+ * @param  w            Image width
+ * @return              Number of points
+ */
+template<typename Width>
+int  back_project_CPU( float         *X,
+                       float         *Y,
+                       float         *Z,
+                       int           *pointPixels,
+                       const int     *pixels,
+                       int           n,
+                       const float   *depth,
+                       const float   *K_inv,
+                       Width         w)
+{
+    const int pitch = image_pitch(w);
+    int points = 0;
+    for (int i = 0; i < n; i++) {
+        const int pixel = pixels ? pixels[i] : i;
+        const int x = pixel % w;
+        const int y = pixel / w;
+        const int pos = x + y * pitch;
+        const float d = depth[pos];
+        if (d == 0) continue;
+        X[points] = x*d * K_inv[0] + y*d * K_inv[3] + d * K_inv[6];
+        Y[points] = x*d * K_inv[1] + y*d * K_inv[4] + d * K_inv[7];
+        Z[points] = x*d * K_inv[2] + y*d * K_inv[5] + d * K_inv[8];
+        pointPixels[points] = pos;
+        points++;
+    }
+    return points;
+}
+
+}   // namespace CPU_ISA_NAMESPACE
+
+#endif
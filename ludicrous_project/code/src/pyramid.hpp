@@ -0,0 +1,148 @@
+/**
+ * \file
+ * \brief   Sizes of the levels of an image pyramid, known at run time
+ *          (PyramidGeometry) or at compile time (StaticPyramidGeometry).
+ *
+ *          Level l of a w x h image is (w >> l) x (h >> l), or, with a scale
+ *          other than the usual 0.5 between levels (PyramidGeometry only),
+ *          the sizes of pyramid_level_size. The pitched storage of all the
+ *          levels of a plane (see image.hpp) is laid out one level after the
+ *          other, starting at level_offset(l), in an arena of storage_size()
+ *          pixels.
+ *
+ *          With a static geometry these are all constant expressions, and
+ *          with_level passes the sizes of a level as FixedSize values, so the
+ *          per-pixel loops of preprocessing_cpu.hpp are compiled for each
+ *          level with constant trip counts and pitches. PyramidGeometry is the
+ *          fallback for any other size, with the same interface.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "image.hpp"
+
+/**
+ * Image size known at compile time. Converts to int wherever a size is
+ * expected, so functions templated on the type of their sizes take both.
+ */
+template<int N>
+struct FixedSize {
+        constexpr operator int() const { return N; }
+};
+
+/**
+ * Size of the level above by 2 (half as large, rounded down), of the same kind
+ * as size.
+ */
+inline int halved( int size ) { return size >> 1; }
+template<int N>
+inline FixedSize<(N >> 1)> halved( FixedSize<N> ) { return FixedSize<(N >> 1)>(); }
+
+/**
+ * Size of a level of a pyramid with a scale between consecutive levels:
+ * size*scale^level rounded down, so size >> level for the usual scale 0.5.
+ */
+inline int pyramid_level_size( int size, float scale, int level ) {
+        if (scale == 0.5f) return size >> level;
+        // the margin keeps exact sizes exact with the rounding of scale^level
+        return (int)std::floor(size * std::pow((double)scale, level) + 1e-3);
+}
+
+/**
+ * Number of levels of the pyramid of a w x h image with a scale between
+ * levels whose sizes are all at least min_size (at least one level).
+ */
+inline int pyramid_levels( int w, int h, float scale, int min_size ) {
+        int levels = 1;
+        while (pyramid_level_size(w, scale, levels) >= min_size && pyramid_level_size(h, scale, levels) >= min_size)
+                levels++;
+        return levels;
+}
+
+/**
+ * Pixels of the storage of the levels of a w x h pyramid below level.
+ */
+constexpr int pyramid_offset( int w, int h, int level ) {
+        return level == 0 ? 0 : pyramid_offset(w, h, level - 1) + image_size((w >> (level - 1)), (h >> (level - 1)), false);
+}
+
+/**
+ * Geometry of the pyramid of a w x h image with levels levels (the full
+ * resolution image included) and a scale between consecutive levels, known
+ * at run time.
+ */
+class PyramidGeometry {
+public:
+        PyramidGeometry( int w, int h, int levels, float scale = 0.5f ) : n(levels), s(scale), widths(levels), heights(levels), offsets(levels + 1, 0) {
+                for (int level = 0; level < levels; level++) {
+                        widths[level] = pyramid_level_size(w, scale, level);
+                        heights[level] = pyramid_level_size(h, scale, level);
+                        offsets[level + 1] = offsets[level] + image_size(widths[level], heights[level], false);
+                }
+        }
+
+        int width( int level = 0 ) const { return widths[level]; }
+        int height( int level = 0 ) const { return heights[level]; }
+        int levels() const { return n; }
+        // ratio of the sizes of a level and the level below
+        float scale() const { return s; }
+        // start of a level in the storage of a plane, in pixels
+        int level_offset( int level ) const { return offsets[level]; }
+        // pixels of the storage of all the levels of a plane
+        int storage_size() const { return offsets[n]; }
+
+        /**
+         * Calls f(width, height) with the size of a level.
+         */
+        template<class F>
+        void with_level( int level, F &f ) const { f(width(level), height(level)); }
+
+private:
+        int n;
+        float s;
+        // sizes of the levels, and their starts in the storage with the end of the last one
+        std::vector<int> widths, heights, offsets;
+};
+
+template<int W, int H, int Level, int Levels>
+struct StaticLevel {
+        template<class F>
+        static void call( int level, F &f ) {
+                if (level == Level) f(FixedSize<(W >> Level)>(), FixedSize<(H >> Level)>());
+                else StaticLevel<W, H, Level + 1, Levels>::call(level, f);
+        }
+};
+
+template<int W, int H, int Levels>
+struct StaticLevel<W, H, Levels, Levels> {
+        template<class F>
+        static void call( int, F & ) {}
+};
+
+/**
+ * Geometry of the pyramid of a W x H image with Levels levels and the usual
+ * scale 0.5, known at compile time. Constructed like PyramidGeometry, whose
+ * arguments have to match (see createTrackerCPU).
+ */
+template<int W, int H, int Levels>
+class StaticPyramidGeometry {
+public:
+        StaticPyramidGeometry( int, int, int, float = 0.5f ) {}
+
+        static constexpr int width( int level = 0 ) { return W >> level; }
+        static constexpr int height( int level = 0 ) { return H >> level; }
+        static constexpr int levels() { return Levels; }
+        static constexpr float scale() { return 0.5f; }
+        static constexpr int level_offset( int level ) { return pyramid_offset(W, H, level); }
+        static constexpr int storage_size() { return pyramid_offset(W, H, Levels); }
+
+        /**
+         * Calls f(width, height) with the size of a level, as FixedSize values.
+         */
+        template<class F>
+        void with_level( int level, F &f ) const { StaticLevel<W, H, 0, Levels>::call(level, f); }
+};
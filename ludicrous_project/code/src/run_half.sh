@@ -0,0 +1,56 @@
+#!/bin/sh
+# Script for comparing the accuracy of the half precision storage of the
+# current frame (-half 1) against the float one, with Gaussian and
+# T-Distribution weights, on the same executable.
+#
+# Give in as first positional argument the name of the dataset to run and
+# optionally the executable as second one (default ./ludicrous_non_cublas)
+# e.g.:    ./run_half.sh rgbd_dataset_freiburg1_desk ./ludicrous_cpu
+#
+# Before the corresponding dataset has to be downloaded and uncompressed in the ../data folder
+# The corresponding K.txt with the intrinsic parameters has to be manually included too
+# All of this can be found on the TUM Benchmark website
+#
+# Measured on the first 10 frames of rgbd_dataset_freiburg1_xyz
+# (../data/freiburg1_xyz_first_10) with the CPU tracker, Gauss-Newton, forward
+# compositional, all levels. RPE rmse over the 9 frame pairs:
+#
+#   weights          -half 0                     -half 1
+#   Gaussian         0.004584 m  0.42795 deg     0.004584 m  0.42793 deg
+#   T-Distribution   0.004802 m  0.43536 deg     0.004802 m  0.43530 deg
+#
+# The poses move by at most 2.3e-7 m (Gaussian) and 1.6e-6 m
+# (T-Distribution), far below the error against the ground truth, with the
+# same number of iterations. The CUDA tracker stores the same half copies but
+# was not measured for this table.
+
+DATAPATH="../data/"$1 &&
+OUTPATH="../../results/"$1 &&
+EXE=${2:-./ludicrous_non_cublas} &&
+mkdir -p $OUTPATH &&
+OUTFILE=$OUTPATH"/run_half_output.txt" &&
+: > $OUTFILE &&
+
+for WEIGHTS in 0 3; do
+        for HALF in 0 1; do
+                echo "Running $EXE with -weights $WEIGHTS -half $HALF" &&
+                $EXE -path $DATAPATH -weights $WEIGHTS -half $HALF >> $OUTFILE || exit 1
+        done
+done &&
+
+cp "$DATAPATH"/*_trajectory.txt "$OUTPATH" &&
+
+echo "Running python evaluation" &&
+for WEIGHTS in gdist tdist; do
+        for TRAJECTORY in "$OUTPATH"/${WEIGHTS}_*_trajectory.txt; do
+                [ -f "$TRAJECTORY" ] || continue
+                case `basename $TRAJECTORY` in
+                *_lm_*|*_gd_*|*_esm_*|*_ic_*|*_density*) continue ;;   # left over from other scripts
+                esac
+                echo "*******************************************************" >> $OUTFILE
+                echo `basename $TRAJECTORY` "RPE:" >> $OUTFILE
+                python ../../benchmark_tools/evaluate_rpe.py --verbose --fixed_delta $DATAPATH"/groundtruth.txt" $TRAJECTORY >> $OUTFILE
+                echo `basename $TRAJECTORY` "ATE:" >> $OUTFILE
+                python ../../benchmark_tools/evaluate_ate.py --verbose $DATAPATH"/groundtruth.txt" $TRAJECTORY >> $OUTFILE
+        done
+done
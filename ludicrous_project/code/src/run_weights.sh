@@ -0,0 +1,38 @@
+#!/bin/sh
+# Script for comparing the weight functions of the residuals
+# (Gaussian, Huber, Tukey and T-Distribution) on the same executable, each of
+# them with forward and inverse compositional alignment.
+#
+# Give in as first positional argument the name of the dataset to run and
+# optionally the executable as second one (default ./ludicrous_non_cublas)
+# e.g.:    ./run_weights.sh rgbd_dataset_freiburg1_desk ./ludicrous_cpu
+#
+# Before the corresponding dataset has to be downloaded and uncompressed in the ../data folder
+# The corresponding K.txt with the intrinsic parameters has to be manually included too
+# All of this can be found on the TUM Benchmark website
+
+DATAPATH="../data/"$1 &&
+OUTPATH="../../results/"$1 &&
+EXE=${2:-./ludicrous_non_cublas} &&
+mkdir -p $OUTPATH &&
+OUTFILE=$OUTPATH"/run_weights_output.txt" &&
+: > $OUTFILE &&
+
+for WEIGHTS in 0 1 2 3; do
+        for IC in 0 1; do
+                echo "Running $EXE with -weights $WEIGHTS -inverseCompositional $IC" &&
+                $EXE -path $DATAPATH -weights $WEIGHTS -inverseCompositional $IC >> $OUTFILE || exit 1
+        done
+done &&
+
+cp "$DATAPATH"/*_trajectory.txt "$OUTPATH" &&
+
+echo "Running python evaluation" &&
+for TRAJECTORY in "$OUTPATH"/*dist_*_trajectory.txt "$OUTPATH"/huber_*_trajectory.txt "$OUTPATH"/tukey_*_trajectory.txt; do
+        [ -f "$TRAJECTORY" ] || continue
+        echo "*******************************************************" >> $OUTFILE
+        echo `basename $TRAJECTORY` "RPE:" >> $OUTFILE
+        python ../../benchmark_tools/evaluate_rpe.py --verbose --fixed_delta $DATAPATH"/groundtruth.txt" $TRAJECTORY >> $OUTFILE
+        echo `basename $TRAJECTORY` "ATE:" >> $OUTFILE
+        python ../../benchmark_tools/evaluate_ate.py --verbose $DATAPATH"/groundtruth.txt" $TRAJECTORY >> $OUTFILE
+done
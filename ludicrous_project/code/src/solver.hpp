@@ -0,0 +1,66 @@
+/**
+ * \file
+ * \brief   Pose increment of each SolvingMethod from the normal equations
+ *          A * delta_xi = -b, shared by the CUDA and the CPU tracker.
+ *
+ *          Levenberg-Marquardt and gradient descent are damped methods: a step
+ *          that does not decrease the error is rejected, the tracker rolls back
+ *          to the last accepted pose (and its A, b and variance, so nothing is
+ *          recomputed) and lambda grows. Accepted steps shrink lambda again.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#pragma once
+
+#include <Eigen/Dense>
+#include "common.h"
+
+// lambda at the start of each pyramid level
+#define LM_LAMBDA_INITIAL 0.1f
+// factor for lambda after a rejected step
+#define LM_LAMBDA_UP 5.0f
+// divisor for lambda after an accepted step
+#define LM_LAMBDA_DOWN 1.5f
+// the level is finished when lambda grows beyond this
+#define LM_LAMBDA_MAX 5.0f
+// With a time budget, Gauss-Newton and ESM finish a level when the decrement
+// b'*A^-1*b, the decrease of the error predicted by the linear model, is below
+// this fraction of the (weighted) error. Without one they stop when an
+// iteration decreases the error by less than 0.5%, as they always did
+#define DECREMENT_RATIO 0.005f
+
+/**
+ * Whether the method rejects steps that do not decrease the error.
+ */
+inline bool is_damped( SolvingMethod solvingMethod ) {
+        return solvingMethod == LEVENBERG_MARQUARDT || solvingMethod == GRADIENT_DESCENT;
+}
+
+/**
+ * Pose increment for the normal equations A, b.
+ *      GAUSS_NEWTON, ESM    solve A * delta_xi = -b
+ *      LEVENBERG_MARQUARDT  solve (A + lambda * diag(A)) * delta_xi = -b
+ *      GRADIENT_DESCENT     -b times the step length that minimizes the
+ *                           quadratic model along -b, divided by (1 + lambda)
+ * @param lambda  Damping. Not used by the undamped methods.
+ */
+Vector6f solve_step( SolvingMethod solvingMethod,
+                     const Matrix6f &A,
+                     const Vector6f &b,
+                     float lambda ) {
+        switch (solvingMethod) {
+        case LEVENBERG_MARQUARDT: {
+                Matrix6f A_damped = A;
+                A_damped.diagonal() *= 1.0f + lambda;
+                return -(A_damped.ldlt().solve(b));
+        }
+        case GRADIENT_DESCENT: {
+                float bAb = b.dot(A * b);
+                if (!(bAb > 0)) return Vector6f::Zero();
+                return -( b.squaredNorm() / bAb / (1.0f + lambda) ) * b;
+        }
+        default:
+                return -(A.ldlt().solve(b)); // Solve using Cholesky LDLT decomposition
+        }
+}
@@ -14,7 +14,10 @@
 #include "preprocessing.cuh"
 #include "lieAlgebra.hpp"
 #include "alignment.cuh"
+#include "alignment_cpu.hpp"    // h_unpack_A
+#include "solver.hpp"
 #include "common.h"
+#include "pyramid.hpp"
 // cuBLAS
 #define CUDA_API_PER_THREAD_DEFAULT_STREAM
 #include <cuda_runtime.h>
@@ -24,23 +27,26 @@
 #endif
 // #include <string> // for 'debugging'
 
-enum SolvingMethod { GAUSS_NEWTON, LEVENBERG_MARQUARDT, GRADIENT_DESCENT };
-// enum ResidualWeight { NONE, HUBER, TDIST };
-
-class Tracker {
+class Tracker : public TrackerBase {
 
 public:
 
+EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
 /**
  * Tracker constructor
  * @param grayFirstFrame        gray image array of floats (not uchar)
  * @param depthFirstFrame       depth image array of floats
  * @param K                     Eigen 3x3 matrix with camera projection parameters
  * @param solvingMethod         Method for solving the linear system for delta ksi
- * @param weightType            Weight shape for the residuals // TODO? guillermo: not sure how far this is implemented
+ * @param weightType            Weight function for the residuals, see weights.hpp
  * @param minLevel              Lowest level index in the pyramid to be used for alignment. Default is 0 (full resolution).
  * @param maxLevel              Highest level index of the pyramid above the full resolution image
  * @param maxIterationsPerLevel Maximum number of iterations per pyramid level
+ * @param alignmentMode         Forward or inverse compositional, see common.h
+ * @param density               Fraction of the pixels with depth aligned at each level, see select_pixels_CPU. 1 for dense alignment
+ * @param half                  Bind half precision copies of the current frame to the textures, see float_to_half_CUDA
+ * @param tiled                 Bind copies of the current frame in cudaArrays (tiled layout of the texture unit) to the textures
  */
 Tracker(
         float* grayFirstFrame,
@@ -50,14 +56,22 @@ Tracker(
         Eigen::Matrix3f K,
         int minLevel = 0,
         int maxLevel = 4,
-        bool useTDistWeights = true,
+        ResidualWeight weightType = TDIST,
         int maxIterationsPerLevel = 20,
-        SolvingMethod solvingMethod = GAUSS_NEWTON
-        // ResidualWeight weightType = NONE,
+        SolvingMethod solvingMethod = GAUSS_NEWTON,
+        AlignmentMode alignmentMode = FORWARD_COMPOSITIONAL,
+        float density = 1.0f,
+        bool half = false,
+        bool tiled = false
         ) :
         width(width),
         height(height),
+        geometry(width, height, maxLevel+1),
         solvingMethod(solvingMethod),
+        alignmentMode(alignmentMode),
+        density(density),
+        half(half),
+        tiled(tiled),
         minLevel(minLevel),
         maxLevel(maxLevel),
         maxIterationsPerLevel(maxIterationsPerLevel),
@@ -65,9 +79,12 @@ Tracker(
         xi_total(Vector6f::Zero()),
         A(Matrix6f::Zero()),
         b(Vector6f::Zero()),
-        useTDistWeights(useTDistWeights)
-        // weightType(weightType)
+        weightType(weightType)
 {
+        // ESM needs the Jacobian at the current warp
+        if (solvingMethod == ESM)
+                this->alignmentMode = FORWARD_COMPOSITIONAL;
+
         cudaDeviceSynchronize();  CUDA_CHECK;
 
         // Get information about the GPU
@@ -106,6 +123,7 @@ Tracker(
         load_K_to_device();
 
         // Fill image pyramid of the first frame. Already as previous frame since align fills the current frame d_cur and only swaps at the end.
+        // Its levels are built and back-projected when the first alignment asks for them
         fill_pyramid(d_prev, grayFirstFrame, depthFirstFrame);
 
         define_texture_parameters();
@@ -128,6 +146,10 @@ Tracker(
  * @return          Minimal transformation representation in twist coordinates. Optimal warp of the previous gray and depth onto the new (current) image.
  */
 Vector6f align(float *grayCur, float *depthCur) {
+        // the budget includes the pyramid of the new frame
+        if (budget.enabled()) budget.start_frame(level_pixels());
+        bool out_of_time = false;
+
         fill_pyramid(d_cur, grayCur, depthCur);
 
 
@@ -135,74 +157,180 @@ Vector6f align(float *grayCur, float *depthCur) {
         // other option, initialize as 0:
         // xi = Vector6f::Zero();
 
+        // T distribution variance, (initial)
+        // declared even if not needed (no weights). Carried over between
+        // iterations and levels as the starting point of the next estimation
+        float variance = VARIANCE_INITIAL;
+
+        iterations.assign(maxLevel+1, 0);
+        validPixels.assign(maxLevel+1, 0);
+
+        // with a budget, the finest levels may be left out
+        int finestLevel = budget.enabled() ? budget.plan(minLevel, maxLevel) : minLevel;
+
         // from the highest level to the minimum level set
-        for (int level = maxLevel; level >= minLevel; level--) {
+        for (int level = maxLevel; level >= finestLevel && !out_of_time; level--) {
                 // std::cout << "Level: " << level << std::endl;
 
                 // calculate size of image in current level
-                int level_width = width / (1 << level); // calculating bitwise the succesive powers of 2
-                int level_height = height / (1 << level);
+                int level_width = geometry.width(level);
+                int level_height = geometry.height(level);
 
                 // set d_prev_err to big float number
                 float error_prev = BIG_FLOAT; // initialize as a great value to make sure loop continues for at least one iteration below
 
+                // damped methods: last accepted state, restored when a step is rejected
+                float lambda = LM_LAMBDA_INITIAL;
+                Vector6f xi_accepted = xi;
+                Matrix6f A_accepted = Matrix6f::Zero();
+                Vector6f b_accepted = Vector6f::Zero();
+                float variance_accepted = variance;
+
+                // lowest error evaluated at this level, returned if the budget runs out
+                Vector6f xi_best = xi;
+                float error_best = BIG_FLOAT;
+
+                // with a budget, the level is not even touched unless its setup (everything up to the first
+                // iteration) and one iteration fit: the pose of the coarser levels is returned otherwise
+                if (budget.enabled()) {
+                        if (!budget.fits_setup(level)) {
+                                out_of_time = true;
+                                break;
+                        }
+                        budget.start_setup();
+                }
+                // the levels are built the first time they are aligned, see ensure_level
+                ensure_reference(level);
+                ensure_level(d_cur, level);
+
+                validPixels[level] = d_prev[level].n_points;
+                // no pixel with depth, nothing to align at this level
+                if (validPixels[level] == 0) {
+                        if (budget.enabled()) budget.end_setup(level);
+                        continue;
+                }
+
                 bind_textures(level, level_width, level_height); // used for interpolation in the current image
 
-                // T distribution variance, (initial)
-                // declared even if not needed (no weights)
-                float variance = VARIANCE_INITIAL;
+                // inverse compositional: the Jacobian only depends on the first frame
+                if (alignmentMode == INVERSE_COMPOSITIONAL)
+                        calculate_reference_jacobian(level, level_width, level_height);
+                if (budget.enabled()) {
+                        cudaDeviceSynchronize();
+                        budget.end_setup(level);
+                }
 
                 //cudaMemcpy(d_sigma, &SIGMA_INITIAL, sizeof(float), cudaMemcpyHostToDevice ); CUDA_CHECK;
 
                 // for a maximum number of iterations per level
                 for (int i = 0; i < maxIterationsPerLevel; i++) {
                         // std::cout << "Iteration #" << i ;
+                        if (budget.enabled()) {
+                                // no time left: stop with the best pose so far
+                                if (!budget.fits(level, false)) {
+                                        xi = xi_best;
+                                        out_of_time = true;
+                                        break;
+                                }
+                                // leave the rest of the budget to the finer levels
+                                if (!budget.fits(level, true)) break;
+                                budget.start_iteration();
+                        }
+                        iterations[level] = i + 1;
 
                         // Calculate Rotation matrix and translation vector: CPU operation
                         convertSE3ToT(xi, R, t);
 
-                        // calculate RK_inv = R*K_inv in CPU and copy to constant memory (both rotation and translation)
-                        RK_inv = R * K_inv_pyr[level];
-                        cudaMemcpyToSymbol (const_RK_inv, RK_inv.data(), 9*sizeof(float)); CUDA_CHECK;
+                        // copy to constant memory (both rotation and translation), applied to the cached points
+                        cudaMemcpyToSymbol (const_R, R.data(), 9*sizeof(float)); CUDA_CHECK;
                         cudaMemcpyToSymbol (const_translation, t.data(), 3*sizeof(float)); CUDA_CHECK;
 
                         // transform_points: CUDA operation
                         transform_points(level, level_width, level_height);
 
                         // parallel CUDA kernels: two streams
-                                // calculate_jacobian J(n,6)  // calculate_residuals r_xi(n,1) and error (mean squares of r_xi)
-                                                              // calculate_weights W(n,1)
+                                // calculate_jacobian J(n,6)  // calculate_residuals r_xi(n,1) and error (sum of squares of r_xi)
+                                                              // calculate_weights W(n,1) and weighted error
                         calculate_residuals(level, level_width, level_height); //, stream2); // +3ms
-                        calculate_jacobian(level, level_width, level_height); //, stream1);  // +7ms
-                        calculate_error(level, level_width, level_height); //, stream2); // +6m      // cudamalloc is synchronous, so this does not work fine with parallel?
+                        if (alignmentMode == FORWARD_COMPOSITIONAL)
+                                calculate_jacobian(level, level_width, level_height); //, stream1);  // +7ms
 
                         // variance is actually not used, but has to be passed by reference to keep
                         // its value for next iteration, and referenced variables cannot get set to a default valu
-                        calculate_weights(level, level_width, level_height, variance, useTDistWeights); //, stream2);   // +1ms
+                        calculate_weights(level, level_width, level_height, variance); //, stream2);   // +1ms
 
                         // parallel CUDA kernels: two streams
                                 // calculate A(6,6) = J.T * W * J   // calculate B(6,1) = -J.T * W * r
                                 // TODO: best order to calculate the previous multiplications. J.T * W first? (used by both) or all together avoiding reads?
                                 // probably A and be separated are better. Less R&W. Less code.
-                        calculate_A ( level, level_width, level_height ); //, stream1 );
+                        if (alignmentMode == FORWARD_COMPOSITIONAL) {
+                                calculate_A ( level, level_width, level_height ); //, stream1 );
+                        } else {
+                                // even with uniform weights, A changes with the points warped outside
+                                calculate_A_reference ( level, level_width, level_height );
+#ifdef ENABLE_CUBLAS
+                                if (weightType != GAUSSIAN)
+                                        calculate_jtw(level, level_width, level_height); // used by calculate_b
+#endif
+                        }
                         calculate_b ( level, level_width, level_height ); //, stream1 );
 
                         cudaDeviceSynchronize();
-                        // solve linear system: A * delta_xi = b; with solver of Eigen library: CPU operation.      TODO: Faster to solve directly in GPU?
-                        xi_delta = -(A.ldlt().solve(b)); // Solve using Cholesky LDLT decomposition
 
-                        // Convert the twist coordinates in xi & xi_delta to transformation matrices using Lie algebra
-                        // Convert the combined transformation matrix back to twist coordinates
-                        xi = lieLog(lieExp(xi_delta) * lieExp(xi));
-
-                        // error is the sum of the squared residuals
+                        // error is the sum of the squared residuals, added up by the residuals and weights kernels
                         cudaMemcpy(&error, d_error, sizeof(float), cudaMemcpyDeviceToHost); CUDA_CHECK;
                         // error /= n; // not needed because n is always the same
+                        float error_weighted = error;
+                        if (weightType != GAUSSIAN) {
+                                cudaMemcpy(&error_weighted, d_error_weighted, sizeof(float), cudaMemcpyDeviceToHost); CUDA_CHECK;
+                        }
+                        if (budget.enabled()) budget.end_iteration(level);
+
+                        if (error < error_best) {
+                                error_best = error;
+                                xi_best = xi;
+                        }
 
-                        // if the change in error is very small, break iterations loop and go to higher resolution in pyramid
-                        if (error / error_prev > 0.995 || error == 0) break;
+                        if (is_damped(solvingMethod)) {
+                                if (error >= error_prev) {
+                                        // rejected: back to the last accepted pose, with a smaller step
+                                        xi = xi_accepted; A = A_accepted; b = b_accepted;
+                                        variance = variance_accepted;
+                                        lambda *= LM_LAMBDA_UP;
+                                        if (lambda > LM_LAMBDA_MAX) break;
+                                } else {
+                                        // accepted. Stop on a very small change in error, like Gauss-Newton
+                                        if (error / error_prev > 0.995 || error == 0) break;
+                                        lambda /= LM_LAMBDA_DOWN;
+                                        xi_accepted = xi; A_accepted = A; b_accepted = b;
+                                        variance_accepted = variance;
+                                        error_prev = error;
+                                }
+                        }
+
+                        // solve linear system: A * delta_xi = b; with solver of Eigen library: CPU operation, see solver.hpp.      TODO: Faster to solve directly in GPU?
+                        xi_delta = solve_step(solvingMethod, A, b, lambda);
 
-                        error_prev = error;
+                        // Convert the twist coordinates in xi & xi_delta to transformation matrices using Lie algebra
+                        // Convert the combined transformation matrix back to twist coordinates
+                        // inverse compositional: the increment belongs to the first frame and gets inverted
+                        if (alignmentMode == FORWARD_COMPOSITIONAL)
+                                xi = lieLog(lieExp(xi_delta) * lieExp(xi));
+                        else
+                                xi = lieLog(lieExp(xi) * lieExp(xi_delta).inverse());
+
+                        if (is_damped(solvingMethod)) continue;
+
+                        if (budget.enabled()) {
+                                // if the decrease of the error predicted by the step, b'*A^-1*b, is very small, break
+                                // iterations loop and go to higher resolution in pyramid. Unlike comparing with the
+                                // error of the next pass, this does not spend an iteration of the budget on it
+                                if (-b.dot(xi_delta) < DECREMENT_RATIO * error_weighted || error == 0) break;
+                        } else {
+                                // if the change in error is very small, break iterations loop and go to higher resolution in pyramid
+                                if (error / error_prev > 0.995 || error == 0) break;
+                                error_prev = error;
+                        }
 
                         // DEBUG BLOCK
                         {
@@ -254,7 +382,8 @@ Vector6f align(float *grayCur, float *depthCur) {
                 unbind_textures();  // leave texture references free for binding at level below
         }
 
-        // swap the pointers so we place image in the correct buffer next time this function is called
+        // swap the pointers so we place image in the correct buffer next time this function is called.
+        // The new first frame is back-projected level by level by the next call, see ensure_reference
         temp_swap = d_cur; d_cur = d_prev; d_prev = temp_swap;
 
         // accumulate total_xi: total_xi = log(exp(xi)*exp(total_xi))
@@ -267,17 +396,44 @@ Vector6f align(float *grayCur, float *depthCur) {
 
 
 private:
-// structure saving image data for each level of a pyramid: gray & depth images, and derivatives of gray
-struct PyramidLevel { float *gray, *depth, *gray_dx, *gray_dy; };
+// pixels of every level, see TimeBudget::start_frame
+std::vector<int> level_pixels() const {
+        std::vector<int> pixels(maxLevel+1);
+        for (int level = 0; level <= maxLevel; level++)
+                pixels[level] = geometry.width(level) * geometry.height(level);
+        return pixels;
+}
+
+// structure saving image data for each level of a pyramid: gray & depth images, and derivatives of gray.
+// pixels lists the n_pixels pixels aligned when the frame is the first one, see select_pixels_CUDA. NULL if all of them
+// points_* are the n_points back-projected pixels of those with depth, and point_pixels their indices, see back_project_CUDA.
+// Only valid when the frame is the first one.
+// The *_half copies of gray and its derivatives are bound to the textures instead of them in the half precision mode, with
+// rows of pitch_half bytes (the texture unit needs aligned rows). NULL if not used.
+// The *_array copies (float, or half in the half precision mode) are bound instead in the tiled mode. NULL if not used
+// gray_dx, gray_dy and their copies are NULL with GRADIENTS_ON_THE_FLY (see common.h). gray_dx and gray_dy are NULL in the half
+// precision mode too: the half copies are computed from gray, and the first frame computes its derivatives from gray where needed.
+// Only gray and depth are allocated up front, everything else the first time the level is aligned (allocated), so never below
+// minLevel nor at the levels the time budget always drops.
+// The levels are built on demand, see ensure_level: has_image once gray and depth are, filled once everything else is, and
+// projected once points_* are.
+struct PyramidLevel { float *gray, *depth, *gray_dx, *gray_dy; __half *gray_half, *gray_dx_half, *gray_dy_half; size_t pitch_half;
+                      cudaArray *gray_array, *gray_dx_array, *gray_dy_array; int *pixels; int n_pixels;
+                      float *points_x, *points_y, *points_z; int *point_pixels; int n_points;
+                      bool allocated, has_image, filled, projected; };
 // host parameters
 SolvingMethod solvingMethod;   // enum type of possible solving methods
+AlignmentMode alignmentMode;   // forward or inverse compositional. Defined in common.h
+float density;   // fraction of the pixels with depth aligned (semi-dense), 1 for all of them
+bool half;   // textures read half precision copies of the current frame
+bool tiled;   // textures read cudaArray copies of the current frame
 int maxIterationsPerLevel;
 int maxLevel;
 int minLevel;   // For speed. Used if the highest precision is not required
 int width;   // width of the first frame (and all frames)
 int height;   // height of the first frame (and all frames)
-// ResidualWeight weightType;   // enum type of possible residual weighting. Defined in *_jacobian.cuh
-bool useTDistWeights;  // Whether or not weighting by student t-distribution should be used
+PyramidGeometry geometry;   // sizes of the pyramid levels, see pyramid.hpp
+ResidualWeight weightType;   // enum type of possible residual weighting. Defined in weights.hpp
 Matrix6f A; // A = J' * W * J
 Vector6f b; // b = J' * W * r
 float error;
@@ -301,18 +457,22 @@ float *d_z_prime; // 3D z position in the second frame
 float *d_u_warped;  // warped x position of every pixel in the first image onto the second image
 float *d_v_warped;  // warped y position of every pixel in the first image onto the second image
 float *d_J;   // device Jacobian array for ALL residuals
+float *d_H_ref;   // inverse compositional: upper triangle of J'*J of every pixel, 21 components. NULL otherwise
 float *d_JTW; // device Jacobian transpose * weighting function array
 float *d_W;   // device Weight array
 float *d_r;   // device residuals array
 float *d_b;   // device linear system inhomogeneous term array
 float *d_A;   // device linear system matrix array
-float *d_error;   // mean squares error of residual
+float *d_error;   // sum of the squared residuals
+float *d_error_weighted;   // sum of the weighted squared residuals
+unsigned int *d_hist;   // histogram of the absolute residuals, for the T-Distribution variance
+unsigned int h_hist[TDIST_HIST_BINS];   // host copy of d_hist
+int *d_count;   // number of pixels of select_pixels_CUDA and of points of back_project_CUDA
 //float *d_sigma;
 std::vector<PyramidLevel> d_cur;   // current vector of pointers to device pyramid level structures
 std::vector<PyramidLevel> d_prev;   // previous vector of pointers to device pyramid level structures
 std::vector<PyramidLevel> temp_swap;
 Matrix3f R;
-Matrix3f RK_inv;
 Vector3f t;
 #ifndef ENABLE_CUBLAS
 // these shouldn't be declared if CUBLAS is used
@@ -360,34 +520,112 @@ void load_K_to_device() {
 }
 
 /**
- * Copies the input image as the first pyramid level into the device and calculates the remaining levels upwards. Not to be used without access to private variables.
+ * Starts a new frame in a pyramid: marks all its levels as not built, see ensure_level.
+ */
+void reset_pyramid(std::vector<PyramidLevel>& d_img) {
+        for (int level = 0; level <= maxLevel; level++) {
+                PyramidLevel &l = d_img[level];
+                l.has_image = l.filled = l.projected = false;
+        }
+}
+
+/**
+ * Copies the input image as the first pyramid level into the device. The remaining levels are calculated upwards
+ * when the alignment first asks for them, see ensure_level. Not to be used without access to private variables.
  * @param d_img    Vector of pointers to PyramidLevel structures allocated in device
  * @param grayImg  Gray image of full resolution (first level size) as an array of floats
  * @param depthImg Depth image of full resolution (first level size) as an array of floats
  */
 void fill_pyramid(std::vector<PyramidLevel>& d_img, float *grayImg, float *depthImg) {
+        reset_pyramid(d_img);
         // copy image into the basis of the pyramid
         cudaMemcpy(d_img[0].gray, grayImg, width*height*sizeof(float), cudaMemcpyHostToDevice); CUDA_CHECK;
         cudaMemcpy(d_img[0].depth, depthImg, width*height*sizeof(float), cudaMemcpyHostToDevice); CUDA_CHECK;
-        //cudaDeviceSynchronize(); // TODO: 2 instances of imresize can't be run in parallel atm, because of some cudaMalloc & cudaFree in that scope
-        int level_width, level_height; // width and height of downsampled images
-        for (int level = 1; level <= maxLevel; level++) {
-                level_width = width / (1 << level); // bitwise operator to divide by 2**level
-                level_height = height / (1 << level);
-                imresize_CUDA(d_img[level-1].gray, d_img[level].gray, 2*level_width, 2*level_height, level_width, level_height, 1, false/*,0*/); CUDA_CHECK;
-                imresize_CUDA(d_img[level-1].depth, d_img[level].depth, 2*level_width, 2*level_height, level_width, level_height, 1, true/*,0*/); CUDA_CHECK; // TODO: Check properly if isDepthImage is working. Looks like it does
+        d_img[0].has_image = true;
+}
+
+/**
+ * Builds a level of a pyramid if it is not built yet in this frame: the gray and depth of the levels below it
+ * that are missing, only as the sources of their downscaling, then the derivatives, copies and pixel selection
+ * of the level itself.
+ * @param d_img    Vector of PyramidLevel structures allocated in device memory, started by fill_pyramid
+ * @param level    Level to build, not below minLevel
+ */
+void ensure_level(std::vector<PyramidLevel>& d_img, int level) {
+        if (d_img[level].filled) return;
+        allocate_level(d_img, level);
+        int first = level;
+        while (!d_img[first].has_image) first--;
+        for (int l = first + 1; l <= level; l++) {
+                int level_width = geometry.width(l);
+                int level_height = geometry.height(l);
+                imresize_CUDA(d_img[l-1].gray, d_img[l].gray, 2*level_width, 2*level_height, level_width, level_height, 1, false/*,0*/); CUDA_CHECK;
+                imresize_CUDA(d_img[l-1].depth, d_img[l].depth, 2*level_width, 2*level_height, level_width, level_height, 1, true/*,0*/); CUDA_CHECK; // TODO: Check properly if isDepthImage is working. Looks like it does
+                d_img[l].has_image = true;
         }
         cudaDeviceSynchronize(); // TODO: 2 instances of imresize can't be run in parallel atm, because of some cudaMalloc & cudaFree in that scope
-        for (int level = 0; level <= maxLevel; level++) {
-                level_width = width / (1 << level); // bitwise operator to divide by 2**level
-                level_height = height / (1 << level);
-                // compute derivatives!!
+        fill_level(d_img, level);
+}
+
+/**
+ * ensure_level of the first frame, d_prev, which also back-projects its pixels to align, once for all the
+ * iterations of the level.
+ * @param level    Level to build, not below minLevel
+ */
+void ensure_reference(int level) {
+        ensure_level(d_prev, level);
+        PyramidLevel &l = d_prev[level];
+        if (l.projected) return;
+        l.n_points = back_project_CUDA(l.points_x, l.points_y, l.points_z, l.point_pixels, d_count, l.pixels, l.n_pixels,
+                                       l.depth, geometry.width(level), K_pyr[level]); CUDA_CHECK;
+        l.projected = true;
+}
+
+/**
+ * Computes the derivatives, the copies and the selection of a level whose gray and depth are built.
+ * @param d_img    Vector of PyramidLevel structures allocated in device memory
+ * @param level    Level to fill, not below minLevel
+ */
+void fill_level(std::vector<PyramidLevel>& d_img, int level) {
+        int level_width = geometry.width(level);
+        int level_height = geometry.height(level);
+        // compute derivatives!! Unless computed on the fly, or straight into the half copies
+        if (d_img[level].gray_dx) {
                 image_derivatives_CUDA(d_img[level].gray,d_img[level].gray_dx,d_img[level].gray_dy,level_width,level_height); CUDA_CHECK;
         }
+        // semi-dense: pixels with the highest gradients, used when this frame becomes the first one
+        if (d_img[level].pixels) {
+                d_img[level].n_pixels = select_pixels_CUDA(d_img[level].pixels, d_count, d_img[level].depth, d_img[level].gray, d_img[level].gray_dx, d_img[level].gray_dy,
+                                                           level_width, level_height, selection_density(density, level_width*level_height)); CUDA_CHECK;
+        }
+        // half precision copies for the textures when this frame is the second one
+        if (d_img[level].gray_half) {
+                float_to_half_CUDA(d_img[level].gray, d_img[level].gray_half, d_img[level].pitch_half, level_width, level_height); CUDA_CHECK;
+        }
+        if (d_img[level].gray_dx_half) {
+                image_derivatives_half_CUDA(d_img[level].gray, d_img[level].gray_dx_half, d_img[level].gray_dy_half, d_img[level].pitch_half,
+                                            level_width, level_height); CUDA_CHECK;
+        }
+        // tiled copies for the textures, from the half precision ones if any
+        if (d_img[level].gray_array) {
+                size_t row = level_width * (half ? sizeof(__half) : sizeof(float));
+                size_t pitch = half ? d_img[level].pitch_half : row;
+                cudaMemcpy2DToArray(d_img[level].gray_array, 0, 0, half ? (void *)d_img[level].gray_half : d_img[level].gray,
+                                    pitch, row, level_height, cudaMemcpyDeviceToDevice); CUDA_CHECK;
+        }
+        if (d_img[level].gray_dx_array) {
+                size_t row = level_width * (half ? sizeof(__half) : sizeof(float));
+                size_t pitch = half ? d_img[level].pitch_half : row;
+                cudaMemcpy2DToArray(d_img[level].gray_dx_array, 0, 0, half ? (void *)d_img[level].gray_dx_half : d_img[level].gray_dx,
+                                    pitch, row, level_height, cudaMemcpyDeviceToDevice); CUDA_CHECK;
+                cudaMemcpy2DToArray(d_img[level].gray_dy_array, 0, 0, half ? (void *)d_img[level].gray_dy_half : d_img[level].gray_dy,
+                                    pitch, row, level_height, cudaMemcpyDeviceToDevice); CUDA_CHECK;
+        }
+        d_img[level].filled = true;
         // //Debug
         // for (int level = 0; level < maxLevel; level++) {
-        //         int level_width = width / (1 << level); // bitwise operator to divide by 2**level
-        //         int level_height = height / (1 << level);
+        //         int level_width = geometry.width(level);
+        //         int level_height = geometry.height(level);
         //         cv::Mat mTest(level_height, level_width, CV_32FC1);
         //         float *prev = new float[level_width*level_height];
         //         //DEPTH
@@ -410,7 +648,6 @@ void fill_pyramid(std::vector<PyramidLevel>& d_img, float *grayImg, float *depth
         //         showImage( "DY: " + std::to_string(level), mTest, 300, 100); cv::waitKey(0);
         //         //cvDestroyAllWindows();
         // }
-
 }
 
 //_______________________________________________________
@@ -423,171 +660,133 @@ void fill_pyramid(std::vector<PyramidLevel>& d_img, float *grayImg, float *depth
  * Calculates the transformed positions on the second frame for every pixel in the first
  */
 void transform_points(int level, int level_width, int level_height) {
-          // Block = 2D array of threads
-          dim3  dimBlock( g_CUDA_blockSize2DX, g_CUDA_blockSize2DY, 1 );
+          // points of the pixels to align with depth
+          int   n = d_prev[level].n_points;
+
+          // Block = 1D array of threads, one per point
+          dim3  dimBlock( g_CUDA_blockSize2DX * g_CUDA_blockSize2DY, 1, 1 );
 
-          // Grid = 2D array of blocks
-            // gridSizeX = ceil( width / nBlocksX )
-          int   gridSizeX = (level_width  + dimBlock.x-1) / dimBlock.x;
-            // gridSizeY = ceil( height / nBlocksX )
-          int   gridSizeY = (level_height + dimBlock.y-1) / dimBlock.y;
-          dim3  dimGrid( gridSizeX, gridSizeY, 1 );
+          // Grid = 1D array of blocks
+            // gridSizeX = ceil( n / nBlocksX )
+          int   gridSizeX = (n + dimBlock.x-1) / dimBlock.x;
+          dim3  dimGrid( gridSizeX, 1, 1 );
 
-          d_transform_points <<< dimGrid, dimBlock >>> (d_x_prime, d_y_prime, d_z_prime, d_u_warped, d_v_warped, d_prev[level].depth, level_width, level_height, level); CUDA_CHECK;
+          d_transform_points <<< dimGrid, dimBlock >>> (d_x_prime, d_y_prime, d_z_prime, d_u_warped, d_v_warped, d_prev[level].points_x, d_prev[level].points_y, d_prev[level].points_z, n, level_width, level_height, level); CUDA_CHECK;
 }
 
 /**
  * Calculates the jacobian at each pixel
  */
 void calculate_jacobian(int level, int level_width, int level_height, cudaStream_t stream=0) {
-          // Block = 2D array of threads
-          dim3  dimBlock( g_CUDA_blockSize2DX, g_CUDA_blockSize2DY, 1 );
-
-          // Grid = 2D array of blocks
-            // gridSizeX = ceil( width / nBlocksX )
-          int   gridSizeX = (level_width  + dimBlock.x-1) / dimBlock.x;
-            // gridSizeY = ceil( height / nBlocksX )
-          int   gridSizeY = (level_height + dimBlock.y-1) / dimBlock.y;
-          dim3  dimGrid( gridSizeX, gridSizeY, 1 );
-
-          d_calculate_jacobian <<< dimGrid, dimBlock, 0, 0 >>> (d_J, d_x_prime, d_y_prime, d_z_prime, d_u_warped, d_v_warped, level_width, level_height, level); // texture is accessed directly. No argument needed
+          // points of the pixels to align with depth, and their pixels
+          const int *pixels = d_prev[level].point_pixels;
+          int   n = d_prev[level].n_points;
+
+          // Block = 1D array of threads, one per point
+          dim3  dimBlock( g_CUDA_blockSize2DX * g_CUDA_blockSize2DY, 1, 1 );
+
+          // Grid = 1D array of blocks
+            // gridSizeX = ceil( n / nBlocksX )
+          int   gridSizeX = (n + dimBlock.x-1) / dimBlock.x;
+          dim3  dimGrid( gridSizeX, 1, 1 );
+
+          // ESM also needs the gradients of the first frame
+          if (solvingMethod == ESM)
+                  d_calculate_jacobian<true> <<< dimGrid, dimBlock, 0, 0 >>> (d_J, d_x_prime, d_y_prime, d_z_prime, d_u_warped, d_v_warped, d_prev[level].gray, d_prev[level].gray_dx, d_prev[level].gray_dy,
+                                                                              pixels, n, level_width, level_height, level);
+          else
+                  d_calculate_jacobian<false> <<< dimGrid, dimBlock, 0, 0 >>> (d_J, d_x_prime, d_y_prime, d_z_prime, d_u_warped, d_v_warped, NULL, NULL, NULL, NULL, n, level_width, level_height, level); // texture is accessed directly. No argument needed
         //   CUDA_CHECK;
 }
 
 /**
- * Calculates the residual at each pixel
+ * Inverse compositional mode. Calculates the Jacobian of the first frame at
+ * each pixel into d_J, and the per pixel J'*J into d_H_ref. Once per level.
  */
-void calculate_residuals(int level, int level_width, int level_height, cudaStream_t stream=0) {
-          // Block = 2D array of threads
-          dim3  dimBlock( g_CUDA_blockSize2DX, g_CUDA_blockSize2DY, 1 );
+void calculate_reference_jacobian(int level, int level_width, int level_height) {
+          // points of the pixels to align with depth, and their pixels
+          const int *pixels = d_prev[level].point_pixels;
+          int   n = d_prev[level].n_points;
 
-          // Grid = 2D array of blocks
-            // gridSizeX = ceil( width / nBlocksX )
-          int   gridSizeX = (level_width  + dimBlock.x-1) / dimBlock.x;
-            // gridSizeY = ceil( height / nBlocksX )
-          int   gridSizeY = (level_height + dimBlock.y-1) / dimBlock.y;
-          dim3  dimGrid( gridSizeX, gridSizeY, 1 );
+          // Block = 1D array of threads, one per point
+          dim3  dimBlock( g_CUDA_blockSize2DX * g_CUDA_blockSize2DY, 1, 1 );
 
-          d_calculate_residuals <<< dimGrid, dimBlock, 0, 0 >>> (d_r, d_prev[level].gray, d_u_warped, d_v_warped, level_width, level_height, level); // texture is accessed directly. No argument needed
-        //   CUDA_CHECK;
+          // Grid = 1D array of blocks
+            // gridSizeX = ceil( n / nBlocksX )
+          int   gridSizeX = (n + dimBlock.x-1) / dimBlock.x;
+          dim3  dimGrid( gridSizeX, 1, 1 );
+
+          d_calculate_reference_jacobian <<< dimGrid, dimBlock, 0, 0 >>> (d_J, d_H_ref, d_prev[level].points_x, d_prev[level].points_y, d_prev[level].points_z, d_prev[level].gray,
+                                                                          d_prev[level].gray_dx, d_prev[level].gray_dy, pixels, n, level_width, level_height, level); CUDA_CHECK;
 }
 
 /**
- * Calculates the error
+ * Calculates the residual at each pixel
  */
-void calculate_error(int level, int level_width, int level_height, cudaStream_t stream=0) {
-#ifdef ENABLE_CUBLAS
-        int n = level_width*level_height;
-        // Calculate the error from the residuals. sum(errors) = r' * r
-        cublasSetStream(handle, 0);
-        cublasSgemm(handle, CUBLAS_OP_T, CUBLAS_OP_N, 1, 1, n, &alpha, d_r, n, d_r, n, &beta, d_error, 1);
-#else
-        int size = level_width * level_height;
-        // threads per block equals maximum possible
-        int blocklength = 1024;
-        // number of needed blocsk is ceil(l_w * l_h / blocklength)
-        int nblocks = (size + blocklength -1)/blocklength;
-
-        // alloc auxiliar array
-        float *d_aux = NULL;
-        cudaMalloc(&d_aux, nblocks*sizeof(float));// CUDA_CHECK;  // to avoid overwriting the residuals array
-        // alloc pointer for swapping
-        float *d_swap;
-
-        dim3 block = dim3(blocklength,1,1);
-        dim3 grid = dim3(nblocks, 1, 1 );
-
-        // first reduction. Return reduction by 1024 in aux
-        d_squares_sum <<< grid, block, blocklength*sizeof(float), 0 >>> (d_r, d_aux, size);// CUDA_CHECK;
-
-        // now aux is the input, and size is its size
-        size = nblocks;
-        // nblocks is the output of the next reduction
-        nblocks = (size + blocklength -1)/blocklength;
-        grid = dim3(nblocks, 1, 1 );
-
-        // alloc another auxiliar array
-        float *d_aux2 = NULL;
-        cudaMalloc(&d_aux2, nblocks*sizeof(float));// CUDA_CHECK;  // to avoid overwriting the residuals array
-
-        // reductions until size 1
-        while (true) {
-                d_sum <<< grid, block, blocklength*sizeof(float), 0 >>> (d_aux, d_aux2, size);// CUDA_CHECK;
-                // if no more reductions are needed, break. Result is in d_aux2
-                if (nblocks == 1) break;
-
-                // // copy d_aux2 to the beginning of d_aux
-                // cudaMemcpy( d_aux, d_aux2, nblocks*sizeof(float), cudaMemcpyDeviceToDevice ); CUDA_CHECK;
-                // swap pointers of aux and aux2
-                d_swap = d_aux; d_aux = d_aux2; d_aux2 = d_swap;
-                // now aux2 is the input, copied into d_aux, and size is its size
-                size = nblocks;
-                // nblocks is the output of the next reduction
-                nblocks = (size + blocklength -1)/blocklength;
-                grid = dim3(nblocks, 1, 1 );
-        }
-
-        // d_check_error <<< dimGrid, dimBlock, 0, stream >>> (d_error, d_error_prev, d_error_ratio, d_r, level_width, level_height, level);
-        cudaMemcpy(d_error, d_aux2, sizeof(float), cudaMemcpyDeviceToDevice); CUDA_CHECK;
-
-        cudaFree(d_aux); cudaFree(d_aux2);
-
-        // // DEBUG
-        // float test;
-        // cudaMemcpy( &test, d_error, sizeof(float), cudaMemcpyDeviceToHost );
-        // std::cout << "elegant: " << test << std::endl;
-#endif
+void calculate_residuals(int level, int level_width, int level_height, cudaStream_t stream=0) {
+          // points of the pixels to align with depth, and their pixels
+          const int *pixels = d_prev[level].point_pixels;
+          int   n = d_prev[level].n_points;
+
+          // Block = 1D array of threads, one per point
+          dim3  dimBlock( g_CUDA_blockSize2DX * g_CUDA_blockSize2DY, 1, 1 );
+
+          // Grid = 1D array of blocks
+            // gridSizeX = ceil( n / nBlocksX )
+          int   gridSizeX = (n + dimBlock.x-1) / dimBlock.x;
+          dim3  dimGrid( gridSizeX, 1, 1 );
+
+          // the error is added up by the kernel
+          cudaMemset(d_error, 0, sizeof(float));
+          // the T-Distribution variance is estimated from a histogram of the residuals
+          if (weightType == TDIST) {
+                  cudaMemset(d_hist, 0, TDIST_HIST_BINS*sizeof(unsigned int));
+                  d_calculate_residuals<true> <<< dimGrid, dimBlock, 0, 0 >>> (d_r, d_error, d_hist, d_prev[level].gray, d_u_warped, d_v_warped, pixels, n, level); // texture is accessed directly. No argument needed
+          } else {
+                  d_calculate_residuals<false> <<< dimGrid, dimBlock, 0, 0 >>> (d_r, d_error, d_hist, d_prev[level].gray, d_u_warped, d_v_warped, pixels, n, level);
+          }
+        //   CUDA_CHECK;
 }
 
 /**
- * Calculates the weights
+ * Calculates the weights. Uniform (Gaussian) weights are never read by the
+ * products, so nothing is done for them, except in the inverse compositional
+ * mode: there they mask the points warped outside out of A, whose Jacobian
+ * rows are not 0 (see calculate_A_reference).
  */
 void calculate_weights( int level,
                         int level_width,
                         int level_height,
                         float &variance_init,
-                        bool useTDist,
                         cudaStream_t stream=0) {
-        // Block = 2D array of threads
-        dim3  dimBlock( g_CUDA_blockSize2DX, g_CUDA_blockSize2DY, 1 );
-
-        // Grid = 2D array of blocks
-            // gridSizeX = ceil( width / nBlocksX )
-        int   gridSizeX = (level_width  + dimBlock.x-1) / dimBlock.x;
-            // gridSizeY = ceil( height / nBlocksX )
-        int   gridSizeY = (level_height + dimBlock.y-1) / dimBlock.y;
-        dim3  dimGrid( gridSizeX, gridSizeY, 1 );
-
-        if ( ! useTDist ) {    // use uniform weights
-                d_set_uniform_weights <<< dimGrid, dimBlock, 0, 0 >>> (d_W, level_width, level_height); //CUDA_CHECK;
-        } else {    // use T-Distribution weights
-                int   n = level_width * level_height;
-
-                float variance = variance_init;
-                //float sigma = sigma_init;
-                int iterations = 0;
-                do {
-                      variance_init = variance;
-                      // here d_W is used just as an auxiliar variable
-                      // this returns the squared weighed residuals in d_W, which have to be reduced to get the variance
-                      d_calculate_tdist_variance <<< dimGrid, dimBlock, 0, 0 >>> (d_W, d_r, level_width, level_height, variance_init); CUDA_CHECK;
-
-                      //compute new variance:
-#ifdef ENABLE_CUBLAS
-                      cublasSasum(handle, n , d_W, 1 , &variance);
-#else
-                      reduce_array_GPU( &variance, d_W, n );
-#endif
-                      variance /= n;
-                      iterations ++;
-                } while( (std::abs( 1/(variance) -  1/(variance_init) ) > 1e-3)
-                      && (iterations < 5) );
+        // points of the pixels to align with depth
+        int   n = d_prev[level].n_points;
+
+        // Block = 1D array of threads, one per point
+        dim3  dimBlock( g_CUDA_blockSize2DX * g_CUDA_blockSize2DY, 1, 1 );
+
+        // Grid = 1D array of blocks
+            // gridSizeX = ceil( n / nBlocksX )
+        int   gridSizeX = (n + dimBlock.x-1) / dimBlock.x;
+        dim3  dimGrid( gridSizeX, 1, 1 );
+
+        // the weighted error is added up by the kernel
+        cudaMemset(d_error_weighted, 0, sizeof(float));
+        if ( weightType == HUBER ) {
+                d_calculate_weights<HuberWeights> <<< dimGrid, dimBlock, 0, 0 >>> (d_W, d_error_weighted, d_r, d_u_warped, n, 0.0f); CUDA_CHECK;
+        } else if ( weightType == TUKEY ) {
+                d_calculate_weights<TukeyWeights> <<< dimGrid, dimBlock, 0, 0 >>> (d_W, d_error_weighted, d_r, d_u_warped, n, 0.0f); CUDA_CHECK;
+        } else if ( weightType == TDIST ) {    // use T-Distribution weights
+                // the fixed point iteration runs on the histogram built by calculate_residuals,
+                // starting from the variance of the previous iteration or level
+                cudaMemcpy(h_hist, d_hist, TDIST_HIST_BINS*sizeof(unsigned int), cudaMemcpyDeviceToHost); CUDA_CHECK;
+                float variance = tdist_variance_from_histogram(h_hist, d_prev[level].n_pixels, variance_init);
 
                 variance_init = variance;
-                d_calculate_tdist_weights <<< dimGrid, dimBlock, 0, 0 >>> (d_W, d_r, level_width, level_height, variance); CUDA_CHECK;
-
-                //cout << "Tdist estimate scale in  " << iterations << " iterations" << endl;
+                d_calculate_weights<TDistWeights> <<< dimGrid, dimBlock, 0, 0 >>> (d_W, d_error_weighted, d_r, d_u_warped, n, variance); CUDA_CHECK;
 
+        } else if ( alignmentMode == INVERSE_COMPOSITIONAL ) {
+                d_calculate_weights<GaussianWeights> <<< dimGrid, dimBlock, 0, 0 >>> (d_W, d_error_weighted, d_r, d_u_warped, n, 0.0f); CUDA_CHECK;
         }
 }
 
@@ -596,7 +795,7 @@ void calculate_weights( int level,
 void calculate_jtw(int level, int level_width, int level_height) {
         // calculate_weights( level, level_width, level_height, true );
 
-        int   lev_size = level_width * level_height;
+        int   lev_size = d_prev[level].n_points;
 
         dim3 dimBlockJ(g_CUDA_blockSize2DX, 6,1);
         int gridSizeX = (lev_size + dimBlockJ.x-1) / dimBlockJ.x;
@@ -676,7 +875,7 @@ void reduce_array_GPU ( float *p_out, float *d_arr, int size, cudaStream_t strea
  */
 void calculate_A (int level, int level_width, int level_height, cudaStream_t stream=0) {
 #ifdef ENABLE_CUBLAS
-        int n = level_width*level_height;
+        int n = d_prev[level].n_points;
         cublasSetStream(handle, 0);
 
         // Use nVidia's cuBLAS library for linear algebra calculations
@@ -692,7 +891,7 @@ void calculate_A (int level, int level_width, int level_height, cudaStream_t str
         // We want to calculate A = J' * W * J : (6x6) matrix
         //      W = IdentityMatrix => A = J' * J : (6x6) matrix
         //          using cuBLAS: A = alpha * J' * J + beta * A
-        if(!useTDistWeights) {
+        if(weightType == GAUSSIAN) {
                 stat = cublasSgemm(handle, CUBLAS_OP_T, CUBLAS_OP_N, 6, 6, n, &alpha, d_J, n, d_J, n, &beta, d_A, 6);
         } else {
                 // JTW = J' * W, that is the transpose of the jacobian multiplied by the diagonal matrix W, storing weights calculated using the residuals
@@ -716,7 +915,7 @@ void calculate_A (int level, int level_width, int level_height, cudaStream_t str
         cudaMemcpy ( A.data(), d_A, 6*6*sizeof(float), cudaMemcpyDeviceToHost);
         //std::cout << "Matrix A: \n" << A << std::endl;
 #else
-        int size = level_width * level_height;
+        int size = d_prev[level].n_points;
         // threads per block equals maximum possible
         int blocklength = 1024;
         // number of needed blocks in 3D
@@ -738,7 +937,11 @@ void calculate_A (int level, int level_width, int level_height, cudaStream_t str
 
         // J'*W*J pre-calculation, yet to be reduced. Gets stored into d_pre_A (previous to A)
         cudaDeviceSynchronize(); //Both streams[0] and streams[1] must be 0 before next call
-        d_product_JacT_W_Jac <<< grid, block, blocklength*sizeof(float), 0 >>> (d_pre_A, d_J, d_W, size); CUDA_CHECK;
+        if (weightType == GAUSSIAN)
+                d_product_JacT_W_Jac<false> <<< grid, block, blocklength*sizeof(float), 0 >>> (d_pre_A, d_J, d_W, size);
+        else
+                d_product_JacT_W_Jac<true> <<< grid, block, blocklength*sizeof(float), 0 >>> (d_pre_A, d_J, d_W, size);
+        CUDA_CHECK;
 
         // now d_pre_A is the input, and size is its size per column to be reduced
         size = numblocksZ;
@@ -777,6 +980,65 @@ void calculate_A (int level, int level_width, int level_height, cudaStream_t str
 #endif
 }
 
+/**
+ * Calculate matrix A of the linear system in the inverse compositional mode.
+ * A = sum of W * J'*J, with W 0 for the points warped outside, also with
+ * uniform weights, where the per pixel J'*J is constant
+ * (d_H_ref), so this is a weighted sum of 21 components instead of a product
+ * with the Jacobian.
+ */
+void calculate_A_reference (int level, int level_width, int level_height) {
+        float A_upper[NE_A_SIZE];
+#ifdef ENABLE_CUBLAS
+        int n = d_prev[level].n_points;
+        cublasSetStream(handle, 0);
+
+        // A_upper = H' * W : (21x1) vector
+        stat = cublasSgemv(handle, CUBLAS_OP_T, n, NE_A_SIZE, &alpha, d_H_ref, n, d_W, 1, &beta, d_A, 1);
+        if (stat != CUBLAS_STATUS_SUCCESS) {
+                printf ("\n\n!----------cuBLAS matrix multiplication: A = H'*W FAILED!----------!\n\n");
+        }
+
+        cudaDeviceSynchronize();
+        cudaMemcpy ( A_upper, d_A, NE_A_SIZE*sizeof(float), cudaMemcpyDeviceToHost);
+#else
+        int size = d_prev[level].n_points;
+        // threads per block equals maximum possible
+        int blocklength = 1024;
+        // same scheme as calculate_b, with the 21 components of H instead of
+        // the 6 of J and the weights instead of the residuals
+        int numblocksX = NE_A_SIZE;
+        int numblocksY = 1;
+        int numblocksZ = (size + blocklength -1)/blocklength;
+        float *d_swap;
+
+        dim3 block = dim3(blocklength,1,1);
+        dim3 grid = dim3( numblocksX, numblocksY, numblocksZ );
+
+        cudaDeviceSynchronize();
+        d_product_JacT_W_res<false> <<< grid, block, blocklength*sizeof(float), 0 >>> (d_pre_A, d_H_ref, NULL, d_W, size); CUDA_CHECK;
+
+        size = numblocksZ;
+        numblocksZ = (size + blocklength -1)/blocklength;
+
+        while (true) {
+                grid = dim3( numblocksX, numblocksY, numblocksZ );
+                d_reduce_pre_M_towards_M <<< grid, block, blocklength*sizeof(float), 0 >>> (d_pre_A_aux, d_pre_A, size); CUDA_CHECK;
+
+                d_swap = d_pre_A; d_pre_A = d_pre_A_aux; d_pre_A_aux = d_swap;
+
+                if (numblocksZ == 1) break;
+
+                size = numblocksZ;
+                numblocksZ = (size + blocklength -1)/blocklength;
+        }
+
+        cudaDeviceSynchronize();
+        cudaMemcpy ( A_upper, d_pre_A, NE_A_SIZE*sizeof(float), cudaMemcpyDeviceToHost);
+#endif
+        h_unpack_A(A.data(), A_upper);
+}
+
 /**
  * Calculate array b of the linear system.
  *
@@ -788,7 +1050,7 @@ void calculate_A (int level, int level_width, int level_height, cudaStream_t str
  */
 void calculate_b (int level, int level_width, int level_height, cudaStream_t stream=0) {
 #ifdef ENABLE_CUBLAS
-        int n = level_width*level_height;
+        int n = d_prev[level].n_points;
         cublasSetStream(handle, 0);
         // Use nVidia's cuBLAS library for linear algebra calculations
 
@@ -803,7 +1065,7 @@ void calculate_b (int level, int level_width, int level_height, cudaStream_t str
         // We want to calculate b = J' * W * r : (6x1) vector
         //      W = IdentityMatrix => b = J' * r : (6x1) vector
         //          using cuBLAS: b = alpha * J' * r + beta * b
-        if(!useTDistWeights)
+        if(weightType == GAUSSIAN)
                 stat = cublasSgemm(handle, CUBLAS_OP_T, CUBLAS_OP_N, 6, 1, n, &alpha, d_J, n, d_r, n, &beta, d_b, 6);
         else
                 stat = cublasSgemm(handle, CUBLAS_OP_T, CUBLAS_OP_N, 6, 1, n, &alpha, d_JTW, n, d_r, n, &beta, d_b, 6);
@@ -821,7 +1083,7 @@ void calculate_b (int level, int level_width, int level_height, cudaStream_t str
         cudaDeviceSynchronize();
         cudaMemcpy ( b.data(), d_b, 6*sizeof(float), cudaMemcpyDeviceToHost);
 #else
-        int size = level_width * level_height;
+        int size = d_prev[level].n_points;
         // threads per block equals maximum possible
         int blocklength = 1024;
         // number of needed blocks in 3D. Now it is actually 2D becaus numblocksY=1, but it keeps the structure of calculate_A, so it is 3D.
@@ -842,7 +1104,11 @@ void calculate_b (int level, int level_width, int level_height, cudaStream_t str
         dim3 grid = dim3( numblocksX, numblocksY, numblocksZ );
 
         // J'*W*J pre-calculation, yet to be reduced. Gets stored into d_pre_b (previous to A)
-        d_product_JacT_W_res <<< grid, block, blocklength*sizeof(float), 0 >>> (d_pre_b, d_J, d_W, d_r, size); CUDA_CHECK;
+        if (weightType == GAUSSIAN)
+                d_product_JacT_W_res<false> <<< grid, block, blocklength*sizeof(float), 0 >>> (d_pre_b, d_J, d_W, d_r, size);
+        else
+                d_product_JacT_W_res<true> <<< grid, block, blocklength*sizeof(float), 0 >>> (d_pre_b, d_J, d_W, d_r, size);
+        CUDA_CHECK;
 
         // now aux is the input, and size is its size
         size = numblocksZ;
@@ -899,17 +1165,41 @@ void define_texture_parameters() {
 }
 
 void bind_textures(int level, int level_width, int level_height) {
+        if (tiled) {
+                // the channel format (float or half) comes with the arrays
+                cudaBindTextureToArray(texRef_grayImg, d_cur[level].gray_array); CUDA_CHECK;
+                if (g_storeGradients) {
+                        cudaBindTextureToArray(texRef_gray_dx, d_cur[level].gray_dx_array); CUDA_CHECK;
+                        cudaBindTextureToArray(texRef_gray_dy, d_cur[level].gray_dy_array); CUDA_CHECK;
+                }
+                return;
+        }
+        if (half) {
+                // the texture unit converts to float on every lookup, before the interpolation
+                cudaChannelFormatDesc desc = cudaCreateChannelDescHalf();
+                size_t pitch = d_cur[level].pitch_half;
+                cudaBindTexture2D(NULL, &texRef_grayImg, d_cur[level].gray_half, &desc, level_width, level_height, pitch); CUDA_CHECK;
+                if (g_storeGradients) {
+                        cudaBindTexture2D(NULL, &texRef_gray_dx, d_cur[level].gray_dx_half, &desc, level_width, level_height, pitch); CUDA_CHECK;
+                        cudaBindTexture2D(NULL, &texRef_gray_dy, d_cur[level].gray_dy_half, &desc, level_width, level_height, pitch); CUDA_CHECK;
+                }
+                return;
+        }
         cudaChannelFormatDesc desc = cudaCreateChannelDesc<float>(); // number of bits for each texture
         int pitch = level_width * sizeof(float);
         cudaBindTexture2D(NULL, &texRef_grayImg, d_cur[level].gray, &desc, level_width, level_height, pitch); CUDA_CHECK;
-        cudaBindTexture2D(NULL, &texRef_gray_dx, d_cur[level].gray_dx, &desc, level_width, level_height, pitch); CUDA_CHECK;
-        cudaBindTexture2D(NULL, &texRef_gray_dy, d_cur[level].gray_dy, &desc, level_width, level_height, pitch); CUDA_CHECK;
+        if (g_storeGradients) {
+                cudaBindTexture2D(NULL, &texRef_gray_dx, d_cur[level].gray_dx, &desc, level_width, level_height, pitch); CUDA_CHECK;
+                cudaBindTexture2D(NULL, &texRef_gray_dy, d_cur[level].gray_dy, &desc, level_width, level_height, pitch); CUDA_CHECK;
+        }
 }
 
 void unbind_textures() {
         cudaUnbindTexture(texRef_grayImg); CUDA_CHECK;
-        cudaUnbindTexture(texRef_gray_dx); CUDA_CHECK;
-        cudaUnbindTexture(texRef_gray_dy); CUDA_CHECK;
+        if (g_storeGradients) {
+                cudaUnbindTexture(texRef_gray_dx); CUDA_CHECK;
+                cudaUnbindTexture(texRef_gray_dy); CUDA_CHECK;
+        }
 }
 
 void allocateGPUMemory() {
@@ -924,23 +1214,39 @@ void allocateGPUMemory() {
         cudaMalloc(&d_v_warped, width*height*sizeof(float)); CUDA_CHECK;
         cudaMalloc(&d_b,                   6*sizeof(float)); CUDA_CHECK;
         cudaMalloc(&d_A,                 6*6*sizeof(float)); CUDA_CHECK;
+        d_H_ref = NULL;
+        if (alignmentMode == INVERSE_COMPOSITIONAL) {
+                cudaMalloc(&d_H_ref, NE_A_SIZE*width*height*sizeof(float)); CUDA_CHECK;
+        }
         cudaMalloc(&d_error,                 sizeof(float)); CUDA_CHECK;
+        cudaMalloc(&d_error_weighted,        sizeof(float)); CUDA_CHECK;
+        cudaMalloc(&d_hist, TDIST_HIST_BINS*sizeof(unsigned int)); CUDA_CHECK;
+        cudaMalloc(&d_count,                 sizeof(int)); CUDA_CHECK;
         //cudaMalloc(&d_sigma,                 sizeof(float)); CUDA_CHECK;
         // cudaMalloc(&d_visualResidual, width*height*sizeof(float)); CUDA_CHECK;
         // cudaMalloc(&d_n, sizeof(int)); CUDA_CHECK;
 
         // allocate pyramid vector levels in device memory
         for (int level = 0; level <= maxLevel; level++) {
-                int level_width = width / (1 << level); // calculating bitwise the succesive powers of 2
-                int level_height = height / (1 << level);
+                int level_width = geometry.width(level);
+                int level_height = geometry.height(level);
                 cudaMalloc(&d_cur [level].gray,    level_width*level_height*sizeof(float)); CUDA_CHECK;
                 cudaMalloc(&d_prev[level].gray,    level_width*level_height*sizeof(float)); CUDA_CHECK;
                 cudaMalloc(&d_cur [level].depth,   level_width*level_height*sizeof(float)); CUDA_CHECK;
                 cudaMalloc(&d_prev[level].depth,   level_width*level_height*sizeof(float)); CUDA_CHECK;
-                cudaMalloc(&d_cur [level].gray_dx, level_width*level_height*sizeof(float)); CUDA_CHECK;
-                cudaMalloc(&d_prev[level].gray_dx, level_width*level_height*sizeof(float)); CUDA_CHECK;
-                cudaMalloc(&d_cur [level].gray_dy, level_width*level_height*sizeof(float)); CUDA_CHECK;
-                cudaMalloc(&d_prev[level].gray_dy, level_width*level_height*sizeof(float)); CUDA_CHECK;
+                // everything else is allocated by allocate_level
+                for (int p = 0; p < 2; p++) {
+                        PyramidLevel &l = p ? d_prev[level] : d_cur[level];
+                        l.gray_dx = l.gray_dy = NULL;
+                        l.pixels = NULL;
+                        l.n_pixels = level_width*level_height;
+                        l.points_x = l.points_y = l.points_z = NULL;
+                        l.point_pixels = NULL;
+                        l.n_points = 0;
+                        l.gray_half = l.gray_dx_half = l.gray_dy_half = NULL;
+                        l.gray_array = l.gray_dx_array = l.gray_dy_array = NULL;
+                        l.allocated = l.has_image = l.filled = l.projected = false;
+                }
         }
 
 #ifndef ENABLE_CUBLAS
@@ -954,6 +1260,52 @@ void allocateGPUMemory() {
 
 }
 
+/**
+ * Allocates the buffers of a level of a pyramid other than gray and depth, the first time it is aligned. Both
+ * pyramids get the points and the copies for the textures since they swap roles every frame.
+ * @param d_img    Vector of PyramidLevel structures allocated in device memory
+ * @param level    Level to allocate, not below minLevel
+ */
+void allocate_level(std::vector<PyramidLevel>& d_img, int level) {
+        PyramidLevel &l = d_img[level];
+        if (l.allocated) return;
+        int level_width = geometry.width(level);
+        int level_height = geometry.height(level);
+        // the derivative planes, unless computed on the fly (see GRADIENTS_ON_THE_FLY in common.h).
+        // The half precision mode replaces them with its half copies
+        if (g_storeGradients && !half) {
+                cudaMalloc(&l.gray_dx, level_width*level_height*sizeof(float)); CUDA_CHECK;
+                cudaMalloc(&l.gray_dy, level_width*level_height*sizeof(float)); CUDA_CHECK;
+        }
+        // the pixel lists are only needed at the semi-dense levels
+        if (selection_density(density, level_width*level_height) < 1.0f) {
+                cudaMalloc(&l.pixels, level_width*level_height*sizeof(int)); CUDA_CHECK;
+        }
+        cudaMalloc(&l.points_x,     level_width*level_height*sizeof(float)); CUDA_CHECK;
+        cudaMalloc(&l.points_y,     level_width*level_height*sizeof(float)); CUDA_CHECK;
+        cudaMalloc(&l.points_z,     level_width*level_height*sizeof(float)); CUDA_CHECK;
+        cudaMalloc(&l.point_pixels, level_width*level_height*sizeof(int)); CUDA_CHECK;
+        if (half) {
+                size_t row = level_width*sizeof(__half);
+                cudaMallocPitch(&l.gray_half,    &l.pitch_half, row, level_height); CUDA_CHECK;
+        }
+        if (half && g_storeGradients) {
+                size_t row = level_width*sizeof(__half);
+                cudaMallocPitch(&l.gray_dx_half, &l.pitch_half, row, level_height); CUDA_CHECK;
+                cudaMallocPitch(&l.gray_dy_half, &l.pitch_half, row, level_height); CUDA_CHECK;
+        }
+        if (tiled) {
+                cudaChannelFormatDesc desc = half ? cudaCreateChannelDescHalf() : cudaCreateChannelDesc<float>();
+                cudaMallocArray(&l.gray_array,    &desc, level_width, level_height); CUDA_CHECK;
+        }
+        if (tiled && g_storeGradients) {
+                cudaChannelFormatDesc desc = half ? cudaCreateChannelDescHalf() : cudaCreateChannelDesc<float>();
+                cudaMallocArray(&l.gray_dx_array, &desc, level_width, level_height); CUDA_CHECK;
+                cudaMallocArray(&l.gray_dy_array, &desc, level_width, level_height); CUDA_CHECK;
+        }
+        l.allocated = true;
+}
+
 void deallocateGPUMemory() {
         cudaFree(d_J);        CUDA_CHECK;
         cudaFree(d_JTW);      CUDA_CHECK;
@@ -966,7 +1318,11 @@ void deallocateGPUMemory() {
         cudaFree(d_v_warped); CUDA_CHECK;
         cudaFree(d_b);        CUDA_CHECK;
         cudaFree(d_A);        CUDA_CHECK;
+        if (d_H_ref) cudaFree(d_H_ref); CUDA_CHECK;
         cudaFree(d_error);    CUDA_CHECK;
+        cudaFree(d_error_weighted); CUDA_CHECK;
+        cudaFree(d_hist);     CUDA_CHECK;
+        cudaFree(d_count);    CUDA_CHECK;
         //cudaFree(d_sigma);    CUDA_CHECK;
         // cudaFree(d_visualResidual); CUDA_CHECK;
         // cudaFree(d_n); CUDA_CHECK;
@@ -976,10 +1332,32 @@ void deallocateGPUMemory() {
                 cudaFree(d_prev[level].gray); CUDA_CHECK;
                 cudaFree(d_cur [level].depth); CUDA_CHECK;
                 cudaFree(d_prev[level].depth); CUDA_CHECK;
-                cudaFree(d_cur [level].gray_dx); CUDA_CHECK;
+                cudaFree(d_cur [level].gray_dx); CUDA_CHECK;   // NULL with GRADIENTS_ON_THE_FLY, and all of them if never allocated
                 cudaFree(d_prev[level].gray_dx); CUDA_CHECK;
                 cudaFree(d_cur [level].gray_dy); CUDA_CHECK;
                 cudaFree(d_prev[level].gray_dy); CUDA_CHECK;
+                cudaFree(d_cur [level].pixels); CUDA_CHECK;   // NULL at the dense levels
+                cudaFree(d_prev[level].pixels); CUDA_CHECK;
+                cudaFree(d_cur [level].points_x); CUDA_CHECK;
+                cudaFree(d_prev[level].points_x); CUDA_CHECK;
+                cudaFree(d_cur [level].points_y); CUDA_CHECK;
+                cudaFree(d_prev[level].points_y); CUDA_CHECK;
+                cudaFree(d_cur [level].points_z); CUDA_CHECK;
+                cudaFree(d_prev[level].points_z); CUDA_CHECK;
+                cudaFree(d_cur [level].point_pixels); CUDA_CHECK;
+                cudaFree(d_prev[level].point_pixels); CUDA_CHECK;
+                cudaFree(d_cur [level].gray_half); CUDA_CHECK;   // NULL if not half
+                cudaFree(d_prev[level].gray_half); CUDA_CHECK;
+                cudaFree(d_cur [level].gray_dx_half); CUDA_CHECK;
+                cudaFree(d_prev[level].gray_dx_half); CUDA_CHECK;
+                cudaFree(d_cur [level].gray_dy_half); CUDA_CHECK;
+                cudaFree(d_prev[level].gray_dy_half); CUDA_CHECK;
+                cudaFreeArray(d_cur [level].gray_array); CUDA_CHECK;   // NULL if not tiled
+                cudaFreeArray(d_prev[level].gray_array); CUDA_CHECK;
+                cudaFreeArray(d_cur [level].gray_dx_array); CUDA_CHECK;
+                cudaFreeArray(d_prev[level].gray_dx_array); CUDA_CHECK;
+                cudaFreeArray(d_cur [level].gray_dy_array); CUDA_CHECK;
+                cudaFreeArray(d_prev[level].gray_dy_array); CUDA_CHECK;
         }
 
 
@@ -0,0 +1,900 @@
+/**
+ * \file
+ * \brief   CPU backend of the tracker. Same algorithm and interface as the
+ *          Tracker class in tracker.hpp, running on host memory.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk
+ * \date    April 2016
+ *
+ * A class instance is created passing the first frame. Subsequent calls to the
+ * align function, providing each time a new frame, return the transformation from
+ * the last frame to the starting frame.
+ *
+ * The preprocessing has a host counterpart in preprocessing_cpu.hpp. The
+ * alignment stages are fused into a single pass per iteration, see
+ * alignment_cpu.hpp. Both are multi-threaded with OpenMP, so compile with
+ * -fopenmp (the number of threads is taken from OMP_NUM_THREADS or set with
+ * omp_set_num_threads). This header does not depend on CUDA and can be used in
+ * a CPU_ONLY build.
+ *
+ * The class is templated on the geometry of the pyramids, see pyramid.hpp.
+ * TrackerCPU takes any image size, number of levels and scale between
+ * levels. createTrackerCPU returns a tracker compiled for the size and number
+ * of levels when they are one of the common ones (see static_pyramid_CPU),
+ * whose preprocessing loops run with constant sizes, and TrackerCPU otherwise.
+ *
+ * Everything is compiled once per instruction set, see isa.hpp. The
+ * createTrackerCPU of tracker_cpu_dispatch.hpp picks the variant at run time.
+ */
+
+#ifndef TRACKER_CPU_HPP
+#define TRACKER_CPU_HPP
+
+#include <Eigen/Dense>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+#include "preprocessing_cpu.hpp"
+#include "lieAlgebra.hpp"
+#include "alignment_cpu.hpp"
+#include "solver.hpp"
+#include "common.h"
+#include "pyramid.hpp"
+#include "isa.hpp"
+
+namespace CPU_ISA_NAMESPACE {
+
+template<class Geometry>
+class TrackerCPUCore : public TrackerBase {
+
+public:
+
+EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+/**
+ * TrackerCPUCore constructor. Same parameters as the Tracker constructor.
+ * @param grayFirstFrame        gray image array of floats (not uchar)
+ * @param depthFirstFrame       depth image array of floats
+ * @param K                     Eigen 3x3 matrix with camera projection parameters
+ * @param minLevel              Lowest level index in the pyramid to be used for alignment. Default is 0 (full resolution).
+ * @param maxLevel              Highest level index of the pyramid above the full resolution image
+ * @param weightType            Weight function for the residuals, see weights.hpp
+ * @param maxIterationsPerLevel Maximum number of iterations per pyramid level
+ * @param solvingMethod         Method for solving the linear system for delta ksi
+ * @param alignmentMode         Forward or inverse compositional alignment
+ * @param accumulator           Type used to sum up the normal equations, see alignment_cpu.hpp
+ * @param density               Fraction of the pixels with depth aligned at each level, see select_pixels_CPU. 1 for dense alignment
+ * @param interleaved           Sample the current frame from interleaved {I, dx, dy} texels instead of three planes, see h_sample_texels
+ * @param half                  Sample the current frame from half precision copies, see half.hpp
+ * @param fixedPoint            Sample the current frame from fixed point gray planes in integer arithmetic, see h_sample_fixed.
+ *                              Replaces interleaved, half and tiled
+ * @param tiled                 Store the texels of the current frame in tiles, see texel_index. Implies interleaved
+ * @param scale                 Ratio of the sizes of consecutive pyramid levels, 0.5 for the usual factor 2, see pyramid.hpp.
+ *                              Other scales are resampled with imresize_CPU
+ */
+TrackerCPUCore(
+        float* grayFirstFrame,
+        float* depthFirstFrame,
+        int width,
+        int height,
+        Eigen::Matrix3f K,
+        int minLevel = 0,
+        int maxLevel = 4,
+        ResidualWeight weightType = TDIST,
+        int maxIterationsPerLevel = 20,
+        SolvingMethod solvingMethod = GAUSS_NEWTON,
+        AlignmentMode alignmentMode = FORWARD_COMPOSITIONAL,
+        Accumulator accumulator = ACCUMULATE_FLOAT,
+        float density = 1.0f,
+        bool interleaved = false,
+        bool half = false,
+        bool fixedPoint = false,
+        bool tiled = false,
+        float scale = 0.5f
+        ) :
+        solvingMethod(solvingMethod),
+        alignmentMode(alignmentMode),
+        accumulator(accumulator),
+        density(density),
+        interleaved(interleaved),
+        half(half),
+        fixedPoint(fixedPoint),
+        tiled(tiled),
+        maxIterationsPerLevel(maxIterationsPerLevel),
+        maxLevel(maxLevel),
+        minLevel(minLevel),
+        width(width),
+        height(height),
+        geometry(width, height, maxLevel+1, scale),
+        weightType(weightType),
+        A(Matrix6f::Zero()),
+        b(Vector6f::Zero()),
+        xi(Vector6f::Zero()),
+        xi_total(Vector6f::Zero())
+{
+        // ESM needs the Jacobian at the current warp
+        if (solvingMethod == ESM)
+                this->alignmentMode = FORWARD_COMPOSITIONAL;
+
+        // the fixed point planes replace the other copies for the lookups
+        if (fixedPoint)
+                this->interleaved = this->half = this->tiled = false;
+        // only the texels can be tiled
+        else if (tiled)
+                this->interleaved = true;
+
+        // make pyramid vector large enough to hold all levels
+        h_cur.resize(maxLevel+1);
+        h_prev.resize(maxLevel+1);
+
+        // Create Buffers
+        allocateHostMemory();
+
+        // allocate intrinisc matrix (camera projection) for all pyramid levels
+        K_pyr.resize(maxLevel+1);
+        K_inv_pyr.resize(maxLevel+1);
+
+        fill_K_levels(K);
+
+        // Fill image pyramid of the first frame. Already as previous frame since align fills the current frame h_cur and only swaps at the end.
+        // Its levels are built and back-projected when the first alignment asks for them
+        fill_pyramid(h_prev, grayFirstFrame, depthFirstFrame);
+}
+
+/**
+ * destructor
+ */
+~TrackerCPUCore() {
+        deallocateHostMemory();
+}
+
+/**
+ * Provide a new frame to the tracker and calculate the transition from the previous
+ * @param  grayCur  New (current) gray image of floats. Used as second frame.
+ * @param  depthCur New (current) depth image of floats. It gets processed into a pyramid but its values are not actually used until the next call to align.
+ * @return          Minimal transformation representation in twist coordinates. Optimal warp of the previous gray and depth onto the new (current) image.
+ */
+Vector6f align(float *grayCur, float *depthCur) {
+        // the budget includes the pyramid of the new frame
+        if (budget.enabled()) budget.start_frame(level_pixels());
+        fill_pyramid(h_cur, grayCur, depthCur);
+        return align_current();
+}
+
+/**
+ * align of a frame as decoded, converted while building its pyramid, see ingest_CPU.
+ * @param  frame    New (current) frame, of the size of the first one
+ * @return          See align
+ */
+Vector6f alignRaw(const RawFrame &frame) {
+        if (budget.enabled()) budget.start_frame(level_pixels());
+        fill_pyramid_raw(h_cur, frame);
+        return align_current();
+}
+
+/**
+ * Second half of align: aligns the first frame with the pyramid of the current frame in h_cur.
+ */
+Vector6f align_current() {
+        bool out_of_time = false;
+
+        // T distribution variance, (initial). Carried over between iterations
+        // and levels as the starting point of the next estimation
+        float variance = VARIANCE_INITIAL;
+
+        iterations.assign(maxLevel+1, 0);
+        validPixels.assign(maxLevel+1, 0);
+
+        // with a budget, the finest levels may be left out
+        int finestLevel = budget.enabled() ? budget.plan(minLevel, maxLevel) : minLevel;
+
+        // from the highest level to the minimum level set
+        for (int level = maxLevel; level >= finestLevel && !out_of_time; level--) {
+                // calculate size of image in current level
+                int level_width = geometry.width(level);
+                int level_height = geometry.height(level);
+                // with a budget, the level is not even touched unless its setup (everything up to the first
+                // iteration) and one iteration fit: the pose of the coarser levels is returned otherwise
+                if (budget.enabled()) {
+                        if (!budget.fits_setup(level)) {
+                                out_of_time = true;
+                                break;
+                        }
+                        budget.start_setup();
+                }
+                // the levels are built the first time they are aligned, see ensure_level
+                ensure_reference(level);
+                ensure_level(h_cur, level);
+                ensure_fixed(h_cur, level);
+                // pixels aligned at this level, all of them unless semi-dense, and the points of those with depth
+                int n = h_prev[level].n_pixels;
+                int n_points = h_prev[level].n_points;
+                validPixels[level] = n_points;
+
+                float error_prev = BIG_FLOAT;
+
+                // damped methods: last accepted state, restored when a step is rejected
+                float lambda = LM_LAMBDA_INITIAL;
+                Vector6f xi_accepted = xi;
+                Matrix6f A_accepted = Matrix6f::Zero();
+                Vector6f b_accepted = Vector6f::Zero();
+
+                // lowest error evaluated at this level, returned if the budget runs out
+                Vector6f xi_best = xi;
+                float error_best = BIG_FLOAT;
+
+                bool inverse = (alignmentMode == INVERSE_COMPOSITIONAL);
+                Linearization lin = inverse ? LINEARIZE_INVERSE
+                                  : (solvingMethod == ESM ? LINEARIZE_ESM : LINEARIZE_FORWARD);
+                if (inverse) {
+                        // Jacobian and J'*J from the first frame, fixed for the whole level
+                        h_calculate_reference_jacobian(h_J_ref, h_H_ref, h_prev[level].points_x, h_prev[level].points_y, h_prev[level].points_z,
+                                                       h_prev[level].point_pixels, n_points, h_prev[level].gray.data,
+                                                       h_prev[level].gray_dx.data, h_prev[level].gray_dy.data, K_pyr[level].data(), level_width);
+                        // with uniform weights, the sum of J'*J over all the points, see h_calculate_normal_equations
+                        if (weightType == GAUSSIAN) {
+                                h_sum_reference_hessian(accumulator, ne, h_partials, h_H_ref, n_points);
+                                h_unpack_A(A_ref.data(), ne);
+                        }
+                }
+                if (budget.enabled()) budget.end_setup(level);
+
+                NormalEquationsInput in;
+                in.grayPrev = h_prev[level].gray.data;
+                in.X = h_prev[level].points_x;
+                in.Y = h_prev[level].points_y;
+                in.Z = h_prev[level].points_z;
+                in.pointPixels = h_prev[level].point_pixels;
+                in.n = n_points;
+                in.grayCur = h_cur[level].gray.data;
+                in.gray_dx = h_cur[level].gray_dx.data;
+                in.gray_dy = h_cur[level].gray_dy.data;
+                in.texels = h_cur[level].texels.data;
+                in.grayCur_half = h_cur[level].gray_half.data;
+                in.gray_dx_half = h_cur[level].gray_dx_half.data;
+                in.gray_dy_half = h_cur[level].gray_dy_half.data;
+                in.texels_half = h_cur[level].texels_half.data;
+                in.grayCur_fixed = h_cur[level].gray_fixed.data;
+                in.tiled = tiled;
+                in.gray_dx_ref = h_prev[level].gray_dx.data;
+                in.gray_dy_ref = h_prev[level].gray_dy.data;
+                in.J_ref = h_J_ref;
+                in.H_ref = h_H_ref;
+                in.R = R.data();
+                in.translation = t.data();
+                in.K = K_pyr[level].data();
+                in.width = level_width;
+                in.height = level_height;
+
+                for (int i = 0; i < maxIterationsPerLevel; i++) {
+                        if (budget.enabled()) {
+                                // no time left: stop with the best pose so far
+                                if (!budget.fits(level, false)) {
+                                        xi = xi_best;
+                                        out_of_time = true;
+                                        break;
+                                }
+                                // leave the rest of the budget to the finer levels
+                                if (!budget.fits(level, true)) break;
+                                budget.start_iteration();
+                        }
+                        iterations[level] = i + 1;
+
+                        // Calculate Rotation matrix and translation vector, applied to the cached points
+                        convertSE3ToT(xi, R, t);
+
+                        // T-Distribution variance of the residuals at this pose, like the CUDA tracker.
+                        // Carried over as the starting point of the next estimation
+                        if (weightType == TDIST) {
+                                h_residual_histogram(hist, in);
+                                variance = tdist_variance_from_histogram(hist, n, variance);
+                        }
+
+                        // warp, residuals, weights, jacobian, A, b and error in a single pass
+                        in.variance = variance;
+                        h_calculate_normal_equations(weightType, accumulator, lin, ne, h_partials, in);
+                        h_unpack_A(A.data(), ne);
+                        // uniform weights: ne only has the J'*J of the points warped outside
+                        if (inverse && weightType == GAUSSIAN)
+                                A = A_ref - A;
+                        for (int j = 0; j < 6; j++) b(j) = ne[NE_B_OFFSET + j];
+                        error = ne[NE_ERROR_OFFSET];
+                        float error_weighted = (weightType == GAUSSIAN) ? error : ne[NE_WERROR_OFFSET];
+                        if (budget.enabled()) budget.end_iteration(level);
+
+                        if (error < error_best) {
+                                error_best = error;
+                                xi_best = xi;
+                        }
+
+                        if (is_damped(solvingMethod)) {
+                                if (error >= error_prev) {
+                                        // rejected: back to the last accepted pose, with a smaller step
+                                        xi = xi_accepted; A = A_accepted; b = b_accepted;
+                                        lambda *= LM_LAMBDA_UP;
+                                        if (lambda > LM_LAMBDA_MAX) break;
+                                } else {
+                                        // accepted. Stop on a very small change in error, like Gauss-Newton
+                                        if (error / error_prev > 0.995 || error == 0) break;
+                                        lambda /= LM_LAMBDA_DOWN;
+                                        xi_accepted = xi; A_accepted = A; b_accepted = b;
+                                        error_prev = error;
+                                }
+                        }
+
+                        // solve linear system: A * delta_xi = b, see solver.hpp
+                        xi_delta = solve_step(solvingMethod, A, b, lambda);
+
+                        // forward: apply the increment to the warp of the first frame, exp(xi_delta)*exp(xi)
+                        // inverse: the increment warped the first frame, so undo it, exp(xi)*exp(xi_delta)^-1
+                        if (inverse)
+                                xi = lieLog(lieExp(xi) * lieExp(xi_delta).inverse());
+                        else
+                                xi = lieLog(lieExp(xi_delta) * lieExp(xi));
+
+                        if (is_damped(solvingMethod)) continue;
+
+                        if (budget.enabled()) {
+                                // if the decrease of the error predicted by the step, b'*A^-1*b, is very small, break
+                                // iterations loop and go to higher resolution in pyramid. Unlike comparing with the
+                                // error of the next pass, this does not spend an iteration of the budget on it
+                                if (-b.dot(xi_delta) < DECREMENT_RATIO * error_weighted || error == 0) break;
+                        } else {
+                                // if the change in error is very small, break iterations loop and go to higher resolution in pyramid
+                                if (error / error_prev > 0.995 || error == 0) break;
+                                error_prev = error;
+                        }
+                }
+        }
+
+        // swap the pointers so we place image in the correct buffer next time this function is called.
+        // The new first frame is back-projected once per level, when the next call first aligns it
+        h_cur.swap(h_prev);
+
+        // accumulate total_xi: total_xi = log(exp(xi)*exp(total_xi))
+        xi_total = lieLog(lieExp(xi_total)*lieExp(xi).inverse());
+        return xi_total;
+}
+
+
+
+
+private:
+// pixels of every level, see TimeBudget::start_frame
+std::vector<int> level_pixels() const {
+        std::vector<int> pixels(maxLevel+1);
+        for (int level = 0; level <= maxLevel; level++)
+                pixels[level] = geometry.width(level) * geometry.height(level);
+        return pixels;
+}
+
+// structure saving image data for each level of a pyramid: gray & depth images, and derivatives of gray.
+// All of them are pitched with a replicated guard band, see image.hpp. gray and depth are part of the arena of
+// the pyramid, see allocateHostMemory, the rest is allocated by allocate_level.
+// pixels lists the n_pixels pixels aligned when the frame is the first one, see select_pixels_CPU. NULL if all of them.
+// points_* are the n_points back-projected pixels of those with depth, and point_pixels their positions in the images,
+// see back_project_CPU. Only valid when the frame is the first one.
+// texels interleaves gray and its derivatives for the lookups in the current frame, see h_sample_texels. NULL if not interleaved.
+// The *_half copies replace gray, gray_dx, gray_dy and texels in those lookups in the half precision mode, and gray_fixed
+// replaces all of them in the fixed point mode. Not allocated if not used, like the float derivative planes in the half
+// precision and fixed point modes and with GRADIENTS_ON_THE_FLY (see common.h). Only gray, depth and gray_fixed are allocated up front,
+// everything else the first time the level is aligned (allocated), so never below minLevel nor at the levels the time budget always drops.
+// The levels are built on demand, see ensure_level: has_image once gray and depth are, has_derivatives once the
+// derivative planes are (before the rest by ingest_CPU), filled once everything else is, and projected once points_* are.
+// has_fixed once gray_fixed is, see ensure_fixed.
+struct PyramidLevel { PitchedImage<float> gray, depth, gray_dx, gray_dy, texels;
+                      PitchedImage<half_t> gray_half, gray_dx_half, gray_dy_half, texels_half;
+                      PitchedImage<uint16_t> gray_fixed; int *pixels; int n_pixels;
+                      float *points_x, *points_y, *points_z; int *point_pixels; int n_points;
+                      bool allocated, has_image, has_derivatives, has_fixed, filled, projected; };
+// host parameters
+SolvingMethod solvingMethod;   // enum type of possible solving methods
+AlignmentMode alignmentMode;   // forward or inverse compositional
+Accumulator accumulator;   // float, double or compensated sums of the normal equations
+float density;   // fraction of the pixels with depth aligned (semi-dense), 1 for all of them
+bool interleaved;   // current frame sampled from interleaved texels instead of separate planes
+bool half;   // current frame sampled from half precision copies
+bool fixedPoint;   // current frame sampled from fixed point gray planes
+bool tiled;   // texels stored in tiles instead of rows
+int maxIterationsPerLevel;
+int maxLevel;
+int minLevel;   // For speed. Used if the highest precision is not required
+int width;   // width of the first frame (and all frames)
+int height;   // height of the first frame (and all frames)
+Geometry geometry;   // sizes of the pyramid levels, see pyramid.hpp
+ResidualWeight weightType;   // enum type of possible residual weighting. Defined in weights.hpp
+Matrix6f A; // A = J' * W * J
+Matrix6f A_ref; // inverse compositional mode with uniform weights: J'*J of all the points of the level
+Vector6f b; // b = J' * W * r
+float error;
+float VARIANCE_INITIAL = 0.000625f;
+float BIG_FLOAT = std::numeric_limits<float>::max();
+
+float ne[NE_SIZE]; // packed normal equations, see h_calculate_normal_equations
+float *h_arena[2]; // storage of the gray and depth planes of all the levels of each pyramid
+uint16_t *h_arena_fixed[2]; // fixed point mode only: storage of the gray_fixed planes of all the levels of each pyramid
+float *h_tmp; // scratch for downsample2x_gray_CPU, downsample2x_fixed_CPU and ingest_CPU
+float *h_partials; // per-block partial sums of the normal equations, sized for level 0
+float *h_J_ref; // inverse compositional only: reference Jacobian, 6 floats per pixel of level 0
+float *h_H_ref; // inverse compositional only: reference J'*J, NE_A_SIZE floats per pixel of level 0
+unsigned int hist[TDIST_HIST_BINS]; // histogram of the absolute residuals, for the T-Distribution variance
+std::vector<PyramidLevel> h_cur;   // current vector of host pyramid level structures
+std::vector<PyramidLevel> h_prev;   // previous vector of host pyramid level structures
+Matrix3f R;
+Vector3f t;
+
+// watch out: Eigen::Matrix are stored column wise
+std::vector<Matrix3f> K_pyr;   // stores projection matrix and downsampled version (intrinsic camera properties)
+std::vector<Matrix3f> K_inv_pyr;   // inverse K_pyr
+Vector6f xi_delta;
+Vector6f xi;
+Vector6f xi_total;
+
+//______________________________________________________________________________
+//______________________________________________________________________________
+//_________________PRIVATE FUNCTIONS____________________________________________
+//______________________________________________________________________________
+//______________________________________________________________________________
+
+//_______________________________________________________
+//_______________________________________________________
+//________ PREPROCESSING
+//_______________________________________________________
+//_______________________________________________________
+
+void fill_K_levels(Eigen::Matrix3f K) {
+        K_pyr[0] = K;
+        K_inv_pyr[0] = invertKMat(K_pyr[0]);
+        for (int level = 1; level <= maxLevel; level++) {
+                // levels by 2 are decimated (odd sizes drop their last pixel), the others are resampled to their size
+                if (geometry.scale() == 0.5f)
+                        K_pyr[level] = downsampleK(K_pyr[level-1]);
+                else
+                        K_pyr[level] = downsampleK(K_pyr[level-1], (float)geometry.width(level) / geometry.width(level-1),
+                                                   (float)geometry.height(level) / geometry.height(level-1));
+                K_inv_pyr[level] = invertKMat(K_pyr[level]);
+        }
+}
+
+// calls downscale_level with the sizes of the level below, see PyramidGeometry::with_level
+struct DownscaleLevel {
+        TrackerCPUCore *tracker; std::vector<PyramidLevel> *h_img; int level;
+        template<typename Width, typename Height>
+        void operator()(Width w, Height h) { tracker->downscale_level(*h_img, level, w, h); }
+};
+
+// calls downscale_fixed_level with the sizes of the level below
+struct DownscaleFixedLevel {
+        TrackerCPUCore *tracker; std::vector<PyramidLevel> *h_img; int level;
+        template<typename Width, typename Height>
+        void operator()(Width w, Height h) { tracker->downscale_fixed_level(*h_img, level, w, h); }
+};
+
+// calls fill_level with the sizes of the level
+struct FillLevel {
+        TrackerCPUCore *tracker; std::vector<PyramidLevel> *h_img; int level;
+        template<typename Width, typename Height>
+        void operator()(Width w, Height h) { tracker->fill_level(*h_img, level, w, h); }
+};
+
+// calls ingest with the sizes of level 0
+struct IngestLevel {
+        TrackerCPUCore *tracker; std::vector<PyramidLevel> *h_img; const RawFrame *frame;
+        template<typename Width, typename Height>
+        void operator()(Width w, Height h) { tracker->ingest(*h_img, *frame, w, h); }
+};
+
+// calls back_project_level with the sizes of the level
+struct BackProjectLevel {
+        TrackerCPUCore *tracker; std::vector<PyramidLevel> *h_img; int level;
+        template<typename Width, typename Height>
+        void operator()(Width w, Height) { tracker->back_project_level(*h_img, level, w); }
+};
+
+/**
+ * Starts a new frame in a pyramid: marks all its levels as not built, see ensure_level.
+ */
+void reset_pyramid(std::vector<PyramidLevel>& h_img) {
+        for (int level = 0; level <= maxLevel; level++) {
+                PyramidLevel &l = h_img[level];
+                l.has_image = l.has_derivatives = l.has_fixed = l.filled = l.projected = false;
+        }
+}
+
+/**
+ * Copies the input image as the first pyramid level. The remaining levels are calculated upwards
+ * when the alignment first asks for them, see ensure_level.
+ * @param h_img    Vector of PyramidLevel structures allocated in host memory
+ * @param grayImg  Gray image of full resolution (first level size) as an array of floats
+ * @param depthImg Depth image of full resolution (first level size) as an array of floats
+ */
+void fill_pyramid(std::vector<PyramidLevel>& h_img, float *grayImg, float *depthImg) {
+        reset_pyramid(h_img);
+        for (int y = 0; y < height; y++) {
+                memcpy(h_img[0].gray.pixel(0, y), &grayImg[y*width], width*sizeof(float));
+                memcpy(h_img[0].depth.pixel(0, y), &depthImg[y*width], width*sizeof(float));
+        }
+        h_img[0].gray.replicate_border();
+        h_img[0].depth.replicate_border();
+        h_img[0].has_image = true;
+        // fixed point level 0, converted with its guard band
+        if (h_img[0].gray_fixed.data) {
+                float_to_fixed_CPU(h_img[0].gray.begin(), h_img[0].gray_fixed.begin(), h_img[0].gray.count());
+                h_img[0].has_fixed = true;
+        }
+}
+
+/**
+ * fill_pyramid of a frame as decoded: its conversion, level 0 with its derivative planes (if it is aligned for
+ * sure) and its fixed point gray (in the fixed point mode), and the gray and depth of level 1 (if downscaled
+ * by 2) in one pass, see ingest_CPU.
+ * @param h_img    Vector of PyramidLevel structures allocated in host memory
+ * @param frame    Frame of full resolution (first level size)
+ */
+void fill_pyramid_raw(std::vector<PyramidLevel>& h_img, const RawFrame &frame) {
+        reset_pyramid(h_img);
+        // with a time budget level 0 may be dropped (see TimeBudget::plan), so its derivatives are left to
+        // ensure_level like those of the other levels
+        if (minLevel == 0 && !budget.enabled())
+                allocate_level(h_img, 0);
+        IngestLevel ingest_level = { this, &h_img, &frame };
+        geometry.with_level(0, ingest_level);
+}
+
+template<typename Width, typename Height>
+void ingest(std::vector<PyramidLevel>& h_img, const RawFrame &frame, Width level_width, Height level_height) {
+        PyramidLevel &l0 = h_img[0];
+        PyramidLevel *l1 = maxLevel >= 1 && geometry.scale() == 0.5f ? &h_img[1] : NULL;
+        // no derivative planes at level 0 unless fill_pyramid_raw allocated them, nor with GRADIENTS_ON_THE_FLY
+        ingest_CPU(frame, l0.gray.data, l0.depth.data, l0.gray_dx.data, l0.gray_dy.data, l0.gray_fixed.data,
+                   l1 ? l1->gray.data : NULL, l1 ? l1->depth.data : NULL, h_tmp, level_width, level_height);
+        l0.gray.replicate_border();
+        l0.depth.replicate_border();
+        l0.has_image = true;
+        if (l0.gray_dx.data) {
+                l0.gray_dx.replicate_border();
+                l0.gray_dy.replicate_border();
+                l0.has_derivatives = true;
+        }
+        if (l0.gray_fixed.data) {
+                l0.gray_fixed.replicate_border();
+                l0.has_fixed = true;
+        }
+        if (l1) {
+                l1->gray.replicate_border();
+                l1->depth.replicate_border();
+                l1->has_image = true;
+        }
+}
+
+/**
+ * Builds a level of a pyramid if it is not built yet in this frame: the gray and depth of the levels below it
+ * that are missing, only as the sources of their downscaling, then the derivatives, copies and pixel selection
+ * of the level itself.
+ * @param h_img    Vector of PyramidLevel structures allocated in host memory, started by fill_pyramid
+ * @param level    Level to build, not below minLevel
+ */
+void ensure_level(std::vector<PyramidLevel>& h_img, int level) {
+        if (h_img[level].filled) return;
+        allocate_level(h_img, level);
+        int first = level;
+        while (!h_img[first].has_image) first--;
+        DownscaleLevel downscale = { this, &h_img, 0 };
+        for (downscale.level = first + 1; downscale.level <= level; downscale.level++)
+                geometry.with_level(downscale.level - 1, downscale);
+        FillLevel fill = { this, &h_img, level };
+        geometry.with_level(level, fill);
+}
+
+/**
+ * Builds the fixed point gray of a level of the pyramid of the current frame, in the fixed point mode, if it is
+ * not built yet in this frame. Levels by 2 are downscaled in integer arithmetic from the fixed point level below,
+ * starting from the one of level 0 built with the frame, whatever the levels of the float pyramid built so far.
+ * The others are converted from the float gray of the level, which ensure_level has built.
+ * @param h_img    Vector of PyramidLevel structures allocated in host memory, started by fill_pyramid
+ * @param level    Level to build, not below minLevel
+ */
+void ensure_fixed(std::vector<PyramidLevel>& h_img, int level) {
+        PyramidLevel &l = h_img[level];
+        if (!l.gray_fixed.data || l.has_fixed) return;
+        if (geometry.scale() != 0.5f) {
+                float_to_fixed_CPU(l.gray.begin(), l.gray_fixed.begin(), l.gray.count());
+                l.has_fixed = true;
+                return;
+        }
+        int first = level;
+        while (!h_img[first].has_fixed) first--;
+        DownscaleFixedLevel downscale = { this, &h_img, 0 };
+        for (downscale.level = first + 1; downscale.level <= level; downscale.level++)
+                geometry.with_level(downscale.level - 1, downscale);
+}
+
+/**
+ * ensure_level of the first frame, h_prev, which also back-projects its pixels to align, once for all the
+ * iterations of the level.
+ * @param level    Level to build, not below minLevel
+ */
+void ensure_reference(int level) {
+        ensure_level(h_prev, level);
+        if (h_prev[level].projected) return;
+        BackProjectLevel project = { this, &h_prev, level };
+        geometry.with_level(level, project);
+}
+
+/**
+ * Downscales the gray and depth of the level below into a level.
+ * @param h_img         Vector of PyramidLevel structures allocated in host memory
+ * @param level         Level to downscale, above 0
+ * @param below_width   Width of the level below, int or FixedSize (see pyramid.hpp)
+ * @param below_height  Height of the level below, int or FixedSize
+ */
+template<typename Width, typename Height>
+void downscale_level(std::vector<PyramidLevel>& h_img, int level, Width below_width, Height below_height) {
+        PyramidLevel &l = h_img[level];
+        const PyramidLevel &below = h_img[level-1];
+        if (geometry.scale() == 0.5f) {
+                // imresize_CPU by 2, see downsample2x_gray_CPU. The level below may be odd sized, with its own pitch
+                downsample2x_gray_CPU(below.gray.data, l.gray.data, h_tmp, below_width, halved(below_width), halved(below_height));
+                downsample2x_depth_CPU(below.depth.data, l.depth.data, below_width, halved(below_width), halved(below_height));
+        } else {
+                imresize_CPU(below.gray.data, l.gray.data, h_tmp, below_width, below_height,
+                             geometry.width(level), geometry.height(level), 1, false);
+                imresize_CPU(below.depth.data, l.depth.data, h_tmp, below_width, below_height,
+                             geometry.width(level), geometry.height(level), 1, true);
+        }
+        l.gray.replicate_border();
+        l.depth.replicate_border();
+        l.has_image = true;
+}
+
+/**
+ * Downscales the fixed point gray of the level below into a level, by 2, see downsample2x_fixed_CPU.
+ * @param h_img         Vector of PyramidLevel structures allocated in host memory
+ * @param level         Level to downscale, above 0
+ * @param below_width   Width of the level below, int or FixedSize (see pyramid.hpp)
+ * @param below_height  Height of the level below, int or FixedSize
+ */
+template<typename Width, typename Height>
+void downscale_fixed_level(std::vector<PyramidLevel>& h_img, int level, Width below_width, Height below_height) {
+        PyramidLevel &l = h_img[level];
+        downsample2x_fixed_CPU(h_img[level-1].gray_fixed.data, l.gray_fixed.data, reinterpret_cast<uint16_t *>(h_tmp),
+                               below_width, halved(below_width), halved(below_height));
+        l.gray_fixed.replicate_border();
+        l.has_fixed = true;
+}
+
+/**
+ * Computes the derivatives, the copies and the selection of a level whose gray and depth are built.
+ * @param h_img         Vector of PyramidLevel structures allocated in host memory
+ * @param level         Level to fill, not below minLevel
+ * @param level_width   Width of the level, int or FixedSize (see pyramid.hpp)
+ * @param level_height  Height of the level, int or FixedSize
+ */
+template<typename Width, typename Height>
+void fill_level(std::vector<PyramidLevel>& h_img, int level, Width level_width, Height level_height) {
+        PyramidLevel &l = h_img[level];
+        // derivative planes, unless computed on the fly or by ingest_CPU, and float texels
+        const bool derivatives = l.gray_dx.data && !l.has_derivatives;
+        if (derivatives || l.texels.data)
+                image_derivatives_CPU(l.gray.data, derivatives ? l.gray_dx.data : NULL, l.gray_dy.data, level_width, level_height,
+                                      l.texels.data, tiled);
+        if (derivatives) {
+                l.gray_dx.replicate_border();
+                l.gray_dy.replicate_border();
+        }
+        l.has_derivatives = true;
+        if (l.texels.data)
+                l.texels.replicate_border();
+        // half precision copies for the lookups when this frame is the second one. gray is converted
+        // with its guard band, the derivatives straight from gray since there are no float ones in this mode
+        if (l.gray_half.data)
+                float_to_half_CPU(l.gray.begin(), l.gray_half.begin(), l.gray.count());
+        if (l.gray_dx_half.data) {
+                image_derivatives_half_CPU(l.gray.data, l.gray_dx_half.data, l.gray_dy_half.data, level_width, level_height);
+                l.gray_dx_half.replicate_border();
+                l.gray_dy_half.replicate_border();
+        }
+        if (l.texels_half.data) {
+                interleave_half_CPU(l.gray.data, l.gray_dx.data, l.gray_dy.data, l.texels_half.data, level_width, level_height, tiled);
+                l.texels_half.replicate_border();
+        }
+        // semi-dense: pixels with the highest gradients, used when this frame becomes the first one.
+        // Without derivative planes (half precision, fixed point, GRADIENTS_ON_THE_FLY) they are computed from gray
+        if (l.pixels)
+                l.n_pixels = select_pixels_CPU(l.pixels, l.depth.data, l.gray.data, l.gray_dx.data, l.gray_dy.data,
+                                               level_width, level_height, selection_density(density, level_width*level_height));
+        l.filled = true;
+}
+
+/**
+ * Back-projects the pixels to align of a level of a pyramid that is the first frame.
+ * @param h_img        Vector of PyramidLevel structures allocated in host memory, with the level filled
+ * @param level        Level to back-project
+ * @param level_width  Width of the level, int or FixedSize (see pyramid.hpp)
+ */
+template<typename Width>
+void back_project_level(std::vector<PyramidLevel>& h_img, int level, Width level_width) {
+        PyramidLevel &l = h_img[level];
+        l.n_points = back_project_CPU(l.points_x, l.points_y, l.points_z, l.point_pixels, l.pixels, l.n_pixels,
+                                      l.depth.data, K_inv_pyr[level].data(), level_width);
+        l.projected = true;
+}
+
+//_______________________________________________________
+//_______________________________________________________
+//__________ HOST MEMORY allocation
+//_______________________________________________________
+//_______________________________________________________
+
+void allocateHostMemory() {
+        // the horizontal pass of downscaling level 0 is the largest, with all the rows with ingest_CPU
+        const int tmp_width = maxLevel >= 1 ? geometry.width(1) : width / 2;
+        h_tmp = new float[geometry.height(0)*image_pitch(tmp_width)];
+        h_partials = new float[NE_SIZE*h_ne_blocks(width*height)];
+        h_J_ref = NULL;
+        h_H_ref = NULL;
+        if (alignmentMode == INVERSE_COMPOSITIONAL) {
+                h_J_ref = new float[6*width*height];
+                h_H_ref = new float[NE_A_SIZE*width*height];
+        }
+
+        // the gray and depth planes of every pyramid one after the other in its arena, each plane with
+        // all its levels, see PyramidGeometry::level_offset. Sized at compile time with a static geometry
+        const size_t plane_size = geometry.storage_size();
+        const int align = IMAGE_ALIGNMENT / sizeof(float);
+        for (int p = 0; p < 2; p++)
+                h_arena[p] = new float[2*plane_size + align]();
+        // and the fixed point gray planes in an arena of their own
+        const int align_fixed = IMAGE_ALIGNMENT / sizeof(uint16_t);
+        for (int p = 0; p < 2; p++)
+                h_arena_fixed[p] = fixedPoint ? new uint16_t[plane_size + align_fixed]() : NULL;
+
+        // the rest of the levels is allocated when they are first aligned, see allocate_level
+        for (int level = 0; level <= maxLevel; level++) {
+                int level_width = geometry.width(level);
+                int level_height = geometry.height(level);
+                for (int p = 0; p < 2; p++) {
+                        PyramidLevel *l = p ? &h_prev[level] : &h_cur[level];
+                        float *arena = h_arena[p] + (align - ((uintptr_t)h_arena[p] / sizeof(float)) % align) % align;
+                        l->gray.attach(arena + geometry.level_offset(level), level_width, level_height);
+                        l->depth.attach(arena + plane_size + geometry.level_offset(level), level_width, level_height);
+                        if (fixedPoint) {
+                                uint16_t *arena_fixed = h_arena_fixed[p]
+                                        + (align_fixed - ((uintptr_t)h_arena_fixed[p] / sizeof(uint16_t)) % align_fixed) % align_fixed;
+                                l->gray_fixed.attach(arena_fixed + geometry.level_offset(level), level_width, level_height);
+                        }
+                        l->pixels = NULL;
+                        l->points_x = l->points_y = l->points_z = NULL;
+                        l->point_pixels = NULL;
+                        l->n_pixels = l->n_points = 0;
+                        l->allocated = l->has_image = l->has_derivatives = l->has_fixed = l->filled = l->projected = false;
+                }
+        }
+}
+
+/**
+ * Allocates the derivative planes, the copies for the lookups, the pixel list and the points of a level of a
+ * pyramid, unless they are already. Both pyramids get the copies for the lookups since they swap roles every frame.
+ * @param h_img    Vector of PyramidLevel structures allocated in host memory
+ * @param level    Level to allocate, not below minLevel
+ */
+void allocate_level(std::vector<PyramidLevel>& h_img, int level) {
+        PyramidLevel *l = &h_img[level];
+        if (l->allocated) return;
+        int level_width = geometry.width(level);
+        int level_height = geometry.height(level);
+        // Half precision replaces the float planes or texels
+        bool float_texels = interleaved && !half;
+        bool half_planes = half && !interleaved;
+        bool half_texels = half && interleaved;
+        // the pixel lists are only needed at the semi-dense levels
+        bool dense = selection_density(density, level_width*level_height) >= 1.0f;
+        // in half precision the derivative planes are only stored in half, and in fixed point not at all: the
+        // reference side (selection, Jacobian of the inverse compositional, gradients of ESM) computes them from
+        // gray like GRADIENTS_ON_THE_FLY
+        if (g_storeGradients && !half && !fixedPoint) {
+                l->gray_dx.allocate(level_width, level_height);
+                l->gray_dy.allocate(level_width, level_height);
+        }
+        if (float_texels) l->texels.allocate(level_width, level_height, TEXEL_SIZE, tiled);
+        if (half_planes) {
+                l->gray_half.allocate(level_width, level_height);
+                if (g_storeGradients) {
+                        l->gray_dx_half.allocate(level_width, level_height);
+                        l->gray_dy_half.allocate(level_width, level_height);
+                }
+        }
+        if (half_texels) l->texels_half.allocate(level_width, level_height, TEXEL_SIZE, tiled);
+        l->pixels = dense ? NULL : new int[level_width*level_height];
+        l->n_pixels = level_width*level_height;
+        l->points_x = new float[level_width*level_height];
+        l->points_y = new float[level_width*level_height];
+        l->points_z = new float[level_width*level_height];
+        l->point_pixels = new int[level_width*level_height];
+        l->allocated = true;
+}
+
+void deallocateHostMemory() {
+        delete[] h_arena[0];
+        delete[] h_arena[1];
+        delete[] h_arena_fixed[0];
+        delete[] h_arena_fixed[1];
+        delete[] h_tmp;
+        delete[] h_partials;
+        delete[] h_J_ref;
+        delete[] h_H_ref;
+
+        for (int level = 0; level <= maxLevel; level++) {
+                for (PyramidLevel *l : { &h_cur[level], &h_prev[level] }) {
+                        l->gray.release();
+                        l->depth.release();
+                        l->gray_dx.release();
+                        l->gray_dy.release();
+                        l->texels.release();
+                        l->gray_half.release();
+                        l->gray_dx_half.release();
+                        l->gray_dy_half.release();
+                        l->texels_half.release();
+                        l->gray_fixed.release();
+                        delete[] l->pixels;
+                        delete[] l->points_x;
+                        delete[] l->points_y;
+                        delete[] l->points_z;
+                        delete[] l->point_pixels;
+                }
+        }
+}
+
+};
+
+// any image size and number of levels
+typedef TrackerCPUCore<PyramidGeometry> TrackerCPU;
+
+/**
+ * Sizes, numbers of levels and scales that createTrackerCPU compiles the tracker for.
+ */
+inline bool static_pyramid_CPU(int width, int height, int levels, float scale = 0.5f) {
+        return width == 640 && height == 480 && (levels == 4 || levels == 5) && scale == 0.5f;
+}
+
+/**
+ * Creates a CPU tracker compiled for the size of the images and the number of levels when static_pyramid_CPU
+ * holds for them, or a TrackerCPU otherwise. Same parameters as the TrackerCPUCore constructor.
+ */
+inline TrackerBase *createTrackerCPU(
+        float* grayFirstFrame,
+        float* depthFirstFrame,
+        int width,
+        int height,
+        Eigen::Matrix3f K,
+        int minLevel = 0,
+        int maxLevel = 4,
+        ResidualWeight weightType = TDIST,
+        int maxIterationsPerLevel = 20,
+        SolvingMethod solvingMethod = GAUSS_NEWTON,
+        AlignmentMode alignmentMode = FORWARD_COMPOSITIONAL,
+        Accumulator accumulator = ACCUMULATE_FLOAT,
+        float density = 1.0f,
+        bool interleaved = false,
+        bool half = false,
+        bool fixedPoint = false,
+        bool tiled = false,
+        float scale = 0.5f
+        ) {
+#define TRACKER_CPU_ARGS grayFirstFrame, depthFirstFrame, width, height, K, minLevel, maxLevel, weightType, maxIterationsPerLevel, \
+                         solvingMethod, alignmentMode, accumulator, density, interleaved, half, fixedPoint, tiled, scale
+        TrackerBase *tracker;
+        if (!static_pyramid_CPU(width, height, maxLevel+1, scale))
+                tracker = new TrackerCPU(TRACKER_CPU_ARGS);
+        else if (maxLevel == 4)
+                tracker = new TrackerCPUCore< StaticPyramidGeometry<640, 480, 5> >(TRACKER_CPU_ARGS);
+        else
+                tracker = new TrackerCPUCore< StaticPyramidGeometry<640, 480, 4> >(TRACKER_CPU_ARGS);
+#undef TRACKER_CPU_ARGS
+        return tracker;
+}
+
+}   // namespace CPU_ISA_NAMESPACE
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * \file
+ * \brief   Variants of the CPU backend for each instruction set, and the
+ *          factory that picks one at run time, see isa.hpp.
+ *
+ *          tracker_cpu.hpp and the headers of its kernels are included again
+ *          for every instruction set, in its namespace and inside a target
+ *          region, so the compiler generates (and vectorizes) all of the CPU
+ *          backend for that instruction set: warp, sampling, residuals,
+ *          Jacobians and normal equations, pyramid downscaling, derivatives
+ *          and conversions. Their include guards are reset before each pass.
+ *          Everything they include besides them is shared by all variants.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#pragma once
+
+#include "isa.hpp"
+#include "tracker_cpu.hpp"
+
+#ifdef CPU_ISA_DISPATCH
+
+#pragma push_macro("CPU_ISA_NAMESPACE")
+#pragma push_macro("CPU_HAS_F16C")
+
+#undef CPU_ISA_NAMESPACE
+#define CPU_ISA_NAMESPACE isa_sse42
+#undef CPU_HAS_F16C
+#define CPU_HAS_F16C 0
+#undef HALF_HPP
+#undef PREPROCESSING_CPU_HPP
+#undef ALIGNMENT_CPU_HPP
+#undef TRACKER_CPU_HPP
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt")
+#include "tracker_cpu.hpp"
+#pragma GCC pop_options
+
+#undef CPU_ISA_NAMESPACE
+#define CPU_ISA_NAMESPACE isa_avx2
+#undef CPU_HAS_F16C
+#define CPU_HAS_F16C 1
+#undef HALF_HPP
+#undef PREPROCESSING_CPU_HPP
+#undef ALIGNMENT_CPU_HPP
+#undef TRACKER_CPU_HPP
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt,avx,avx2,fma,f16c,bmi,bmi2")
+#include "tracker_cpu.hpp"
+#pragma GCC pop_options
+
+#undef CPU_ISA_NAMESPACE
+#define CPU_ISA_NAMESPACE isa_avx512
+#undef HALF_HPP
+#undef PREPROCESSING_CPU_HPP
+#undef ALIGNMENT_CPU_HPP
+#undef TRACKER_CPU_HPP
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt,avx,avx2,fma,f16c,bmi,bmi2,avx512f,avx512bw,avx512dq,avx512vl")
+#include "tracker_cpu.hpp"
+#pragma GCC pop_options
+
+#pragma pop_macro("CPU_HAS_F16C")
+#pragma pop_macro("CPU_ISA_NAMESPACE")
+
+#endif
+
+/**
+ * Creates a CPU tracker of the variant of an instruction set, see isa.hpp. The baseline if it is not
+ * supported. The other parameters are those of the TrackerCPUCore constructor.
+ */
+inline TrackerBase *createTrackerCPU(
+        CpuIsa isa,
+        float* grayFirstFrame,
+        float* depthFirstFrame,
+        int width,
+        int height,
+        Eigen::Matrix3f K,
+        int minLevel = 0,
+        int maxLevel = 4,
+        ResidualWeight weightType = TDIST,
+        int maxIterationsPerLevel = 20,
+        SolvingMethod solvingMethod = GAUSS_NEWTON,
+        AlignmentMode alignmentMode = FORWARD_COMPOSITIONAL,
+        Accumulator accumulator = ACCUMULATE_FLOAT,
+        float density = 1.0f,
+        bool interleaved = false,
+        bool half = false,
+        bool fixedPoint = false,
+        bool tiled = false,
+        float scale = 0.5f
+        ) {
+#define TRACKER_CPU_ARGS(ns) grayFirstFrame, depthFirstFrame, width, height, K, minLevel, maxLevel, weightType, maxIterationsPerLevel, \
+                             solvingMethod, alignmentMode, (ns::Accumulator)accumulator, density, interleaved, half, fixedPoint, tiled, \
+                             scale
+        if (!cpu_isa_supported(isa)) isa = CPU_ISA_GENERIC;
+        switch (isa) {
+#ifdef CPU_ISA_DISPATCH
+        case CPU_ISA_SSE42:  return isa_sse42::createTrackerCPU(TRACKER_CPU_ARGS(isa_sse42));
+        case CPU_ISA_AVX2:   return isa_avx2::createTrackerCPU(TRACKER_CPU_ARGS(isa_avx2));
+        case CPU_ISA_AVX512: return isa_avx512::createTrackerCPU(TRACKER_CPU_ARGS(isa_avx512));
+#endif
+        default:             return isa_generic::createTrackerCPU(TRACKER_CPU_ARGS(isa_generic));
+        }
+#undef TRACKER_CPU_ARGS
+}
@@ -87,6 +87,22 @@ cv::Mat loadDepth(const std::string &filename)
 }
 
 
+// the frames as decoded, 8 bit gray and 16 bit depth, see RawFrame
+cv::Mat loadIntensityRaw(const std::string &filename)
+{
+    return cv::imread(filename, CV_LOAD_IMAGE_GRAYSCALE);
+}
+
+
+cv::Mat loadDepthRaw(const std::string &filename)
+{
+    cv::Mat imgDepth = cv::imread(filename, CV_LOAD_IMAGE_ANYDEPTH | CV_LOAD_IMAGE_ANYCOLOR);
+    if (imgDepth.type() != CV_16UC1)
+        imgDepth.convertTo(imgDepth, CV_16UC1);
+    return imgDepth;
+}
+
+
 bool savePoses(const std::string &filename, const std::vector<Eigen::Matrix4f> &poses, const std::vector<double> &timestamps)
 {
     if (filename.empty())
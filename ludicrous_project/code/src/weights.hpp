@@ -0,0 +1,126 @@
+/**
+ * \file
+ * \brief   Weight functions for the residuals, shared by the CUDA and the CPU
+ *          alignment. Including:
+ * 		   	* Gaussian (uniform weights, plain least squares)
+ * 		   	* Huber
+ * 		   	* Tukey
+ * 		   	* T-Distribution
+ *
+ *          Every weight function is a policy struct that the alignment kernels
+ *          take as a template parameter, so each one gets its own inner loop
+ *          without a per-pixel switch. The flags of a policy are compile time
+ *          constants:
+ *              uniform        all weights are 1. Kernels skip the weight
+ *                             multiply and never read or write a weight array.
+ *              needsVariance  the weights depend on the variance of the
+ *                             residuals, which has to be estimated at each
+ *                             iteration.
+ *
+ *          The T-Distribution variance is estimated from a histogram of the
+ *          absolute residuals, built by the residual pass as a side product
+ *          (d_calculate_residuals, or h_residual_histogram on the CPU), before
+ *          the weights of the same pass. Its fixed point iteration then costs
+ *          O(bins) instead of a full image pass and a reduction per step.
+ *
+ * \author  Oskar Carlbaum, Guillermo Gonzalez de Garibay, Georg Kuschk 04/2016
+ */
+
+#pragma once
+
+#include <cmath>
+
+#ifdef __CUDACC__
+#define HOST_DEVICE __host__ __device__
+#else
+#define HOST_DEVICE
+#endif
+
+// degrees of freedom of the T-Distribution
+#define TDIST_DOF 5
+// Huber threshold, in gray values scaled to [0, 1]
+#define HUBER_DELTA (4.0f/100)
+// Maximum number of steps of the T-Distribution variance fixed point iteration
+#define TDIST_MAX_ITERATIONS 20
+// Number of bins and range of the histogram of absolute residuals. Residuals
+// beyond the range go to the last bin, where their weight is already tiny
+#define TDIST_HIST_BINS 512
+#define TDIST_HIST_RANGE 0.5f
+// Tukey threshold. 4.685/1.345 keeps the usual ratio between both thresholds (95% efficiency)
+#define TUKEY_C (4.685f/1.345f * HUBER_DELTA)
+
+/**
+ * Residual weight functions, selectable at run time. The trackers dispatch
+ * them to the policies below.
+ */
+enum ResidualWeight { GAUSSIAN, HUBER, TUKEY, TDIST };
+
+struct GaussianWeights {
+        static const bool uniform = true;
+        static const bool needsVariance = false;
+        static HOST_DEVICE float weight(float r, float variance) { return 1.0f; }
+};
+
+struct HuberWeights {
+        static const bool uniform = false;
+        static const bool needsVariance = false;
+        static HOST_DEVICE float weight(float r, float variance) {
+                float r_abs = fabsf(r);
+                return r_abs > HUBER_DELTA ? HUBER_DELTA / r_abs : 1.0f;
+        }
+};
+
+struct TukeyWeights {
+        static const bool uniform = false;
+        static const bool needsVariance = false;
+        static HOST_DEVICE float weight(float r, float variance) {
+                float a = r / TUKEY_C;
+                float b = 1.0f - a * a;
+                return fabsf(r) < TUKEY_C ? b * b : 0.0f;
+        }
+};
+
+struct TDistWeights {
+        static const bool uniform = false;
+        static const bool needsVariance = true;
+        static HOST_DEVICE float weight(float r, float variance) {
+                return ( (TDIST_DOF + 1.0f) / (TDIST_DOF + (r * r) / (variance) ) );
+        }
+};
+
+/**
+ * Histogram bin of a residual, see TDIST_HIST_BINS.
+ */
+inline HOST_DEVICE int tdist_histogram_bin(float r) {
+        int bin = (int)( fabsf(r) * (TDIST_HIST_BINS / TDIST_HIST_RANGE) );
+        return bin < TDIST_HIST_BINS-1 ? bin : TDIST_HIST_BINS-1;
+}
+
+/**
+ * Runs the fixed point iteration of the T-Distribution variance on a histogram
+ * of the absolute residuals. Every bin stands for residuals at its center.
+ * Pixels without a residual are not in the histogram but count in n, like the
+ * zero residuals of the full image version.
+ * @param hist     Input. TDIST_HIST_BINS counts, see tdist_histogram_bin.
+ * @param n        Number of pixels of the level.
+ * @param variance Initial variance, e.g. the one of the previous iteration.
+ * @return         Estimated variance. The initial one if there are no residuals.
+ */
+inline float tdist_variance_from_histogram( const unsigned int *hist,
+                                            const int n,
+                                            float variance ) {
+        const float bin_width = TDIST_HIST_RANGE / TDIST_HIST_BINS;
+        for (int i = 0; i < TDIST_MAX_ITERATIONS; i++) {
+                float variance_prev = variance;
+                double sum = 0.0;
+                for (int bin = 0; bin < TDIST_HIST_BINS; bin++) {
+                        if (hist[bin] == 0) continue;
+                        float r = (bin + 0.5f) * bin_width;
+                        sum += (double)hist[bin] * r * r * TDistWeights::weight(r, variance_prev);
+                }
+                variance = sum / n;
+                if ( !(variance > 0) ) return variance_prev;
+                if ( std::abs( 1/(variance) - 1/(variance_prev) ) <= 1e-3 ) break;
+        }
+        return variance;
+}